@@ -25,8 +25,8 @@
  */
 static size_t huge_class_size = 0;
 
-/* The 32 is align with SWAP_CLUSTER_MAX and BLK_MAX_REQUEST_COUNT */
-#define ZRAM_BLK_MAX_REQUEST_COUNT 32
+#define ZCOMP_ZS_GFP	(__GFP_KSWAPD_RECLAIM | __GFP_NOWARN | \
+			 __GFP_HIGHMEM | __GFP_MOVABLE | __GFP_CMA)
 
 struct zcomp_backend {
 	const char algo_name[ZCOMP_ALGO_NAME_MAX];
@@ -230,23 +230,76 @@ out:
 	return cookie;
 }
 
+/*
+ * Grab up to @nr cookies under a single cookie_pool.lock round trip.
+ * Returns the number of cookies stored in @cookies.
+ */
+static int alloc_zcomp_cookies(struct zcomp *zcomp,
+			       struct zcomp_cookie **cookies, int nr)
+{
+	int i;
+
+	WARN_ON(in_interrupt());
+
+	spin_lock(&zcomp->cookie_pool.lock);
+	for (i = 0; i < nr; i++) {
+		if (list_empty(&zcomp->cookie_pool.head) &&
+		    refill_zcomp_cookie(zcomp))
+			break;
+
+		cookies[i] = list_first_entry(&zcomp->cookie_pool.head,
+					struct zcomp_cookie, list);
+		list_del(&cookies[i]->list);
+		zcomp->cookie_pool.count--;
+	}
+	spin_unlock(&zcomp->cookie_pool.lock);
+
+	return i;
+}
+
+/*
+ * The caller needs to hold cookie_pool.lock
+ */
+static void shrink_zcomp_cookie(struct zcomp *zcomp)
+{
+	struct zcomp_cookie *cookie;
+	int i;
+
+	if (zcomp->cookie_pool.count < BATCH_ZCOMP_REQUEST * 2)
+		return;
+
+	for (i = 0; i < BATCH_ZCOMP_REQUEST; i++) {
+		cookie = list_last_entry(&zcomp->cookie_pool.head,
+					struct zcomp_cookie, list);
+		list_del(&cookie->list);
+		kfree(cookie);
+		zcomp->cookie_pool.count--;
+	}
+}
+
 static void free_zcomp_cookie(struct zcomp *zcomp, struct zcomp_cookie *cookie)
 {
 	spin_lock(&zcomp->cookie_pool.lock);
 	list_add(&cookie->list, &zcomp->cookie_pool.head);
 	zcomp->cookie_pool.count++;
+	shrink_zcomp_cookie(zcomp);
+	spin_unlock(&zcomp->cookie_pool.lock);
+}
 
-	if (zcomp->cookie_pool.count >= BATCH_ZCOMP_REQUEST * 2) {
-		int i;
+static void free_zcomp_cookies(struct zcomp *zcomp,
+			       struct zcomp_cookie **cookies, int nr)
+{
+	int i;
 
-		for (i = 0; i < BATCH_ZCOMP_REQUEST; i++) {
-			cookie = list_last_entry(&zcomp->cookie_pool.head,
-						struct zcomp_cookie, list);
-			list_del(&cookie->list);
-			kfree(cookie);
-			zcomp->cookie_pool.count--;
-		}
+	if (!nr)
+		return;
+
+	spin_lock(&zcomp->cookie_pool.lock);
+	for (i = 0; i < nr; i++) {
+		list_add(&cookies[i]->list, &zcomp->cookie_pool.head);
+		zcomp->cookie_pool.count++;
 	}
+	shrink_zcomp_cookie(zcomp);
 	spin_unlock(&zcomp->cookie_pool.lock);
 }
 
@@ -272,6 +325,41 @@ static void destroy_zcomp_cookie_pool(struct zcomp *zcomp)
 	spin_unlock(&zcomp->cookie_pool.lock);
 }
 
+static void zcomp_cookie_error(struct zcomp *comp, struct zcomp_cookie *cookie)
+{
+	if (cookie->bio)
+		bio_io_error(cookie->bio);
+	free_zcomp_cookie(comp, cookie);
+}
+
+/*
+ * Hand @nr cookies to an async zcomp instance, in a single call if the
+ * instance supports compress_batch.
+ */
+static int zcomp_submit_async(struct zcomp *comp,
+			      struct zcomp_cookie **cookies, int nr)
+{
+	int i, err = 0;
+
+	if (comp->op->compress_batch) {
+		if (!comp->op->compress_batch(comp, cookies, nr))
+			return 0;
+
+		for (i = 0; i < nr; i++)
+			zcomp_cookie_error(comp, cookies[i]);
+		return -EIO;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (comp->op->compress_async(comp, cookies[i]->page, cookies[i])) {
+			zcomp_cookie_error(comp, cookies[i]);
+			err = -EIO;
+		}
+	}
+
+	return err;
+}
+
 static int flush_pending_io(struct zcomp *comp)
 {
 	int err = 0;
@@ -283,15 +371,19 @@ static int flush_pending_io(struct zcomp *comp)
 	spin_unlock(&comp->request_lock);
 
 	while (!list_empty(&req_list)) {
-		struct zcomp_cookie *cookie;
+		struct zcomp_cookie *cookies[ZRAM_BLK_MAX_REQUEST_COUNT];
+		int nr = 0;
 
-		cookie = list_last_entry(&req_list, struct zcomp_cookie, list);
-		list_del(&cookie->list);
-		if (comp->op->compress_async(comp, cookie->page, cookie)) {
-			if (cookie->bio)
-				bio_io_error(cookie->bio);
-			err = -EIO;
+		while (!list_empty(&req_list) &&
+		       nr < ZRAM_BLK_MAX_REQUEST_COUNT) {
+			cookies[nr] = list_last_entry(&req_list,
+						struct zcomp_cookie, list);
+			list_del(&cookies[nr]->list);
+			nr++;
 		}
+
+		if (zcomp_submit_async(comp, cookies, nr))
+			err = -EIO;
 	}
 
 	return err;
@@ -339,7 +431,7 @@ int zcomp_compress(struct zcomp *comp, u32 index, struct page *page,
 	struct zcomp_cookie *cookie;
 
 	if (zcomp_page_same_pattern(page, &element)) {
-		zram_slot_update(comp->zram, index, element, 0);
+		zram_slot_update(comp->zram, index, element, 0, 0, page);
 		return 0;
 	}
 
@@ -351,6 +443,8 @@ int zcomp_compress(struct zcomp *comp, u32 index, struct page *page,
 		cookie->index = index;
 		cookie->page = page;
 		cookie->bio = bio;
+		cookie->alt = false;
+		cookie->recomp = false;
 
 		return comp->op->compress(comp, page, cookie);
 	}
@@ -363,6 +457,8 @@ int zcomp_compress(struct zcomp *comp, u32 index, struct page *page,
 	cookie->index = index;
 	cookie->page = page;
 	cookie->bio = bio;
+	cookie->alt = false;
+	cookie->recomp = false;
 	/*
 	 * Since __zram_make_request has bio_endio, zcomp_async needs
 	 * to hold the bio completion until the IO request is done if
@@ -380,35 +476,113 @@ int zcomp_compress(struct zcomp *comp, u32 index, struct page *page,
 		zram_append_request(comp, cookie);
 	} else {
 		flush_pending_io(comp);
-		if (comp->op->compress_async(comp, page, cookie)) {
-			if (cookie->bio)
-				bio_io_error(cookie->bio);
+		if (zcomp_submit_async(comp, &cookie, 1))
 			ret = -EIO;
-		}
 	}
 
 	return ret;
 }
 
-int zcomp_decompress(struct zcomp *comp, u32 index, struct page *page)
+/*
+ * Compress @nr pages which belong to consecutive zram slots starting at
+ * @index. Same-filled pages are stored inline and the rest are handed to
+ * the zcomp instance as a single batch so it can amortize per-request
+ * setup (stream lookup, cookie allocation, doorbell writes).
+ *
+ * The return value follows zcomp_compress.
+ */
+int zcomp_compress_batch(struct zcomp *comp, u32 index, struct page **pages,
+			int nr, struct bio *bio)
+{
+	struct zcomp_cookie *cookies[ZRAM_BLK_MAX_REQUEST_COUNT];
+	u32 indices[ZRAM_BLK_MAX_REQUEST_COUNT];
+	unsigned long element;
+	int i, nr_cookie, ret;
+
+	if (WARN_ON_ONCE(nr > ZRAM_BLK_MAX_REQUEST_COUNT))
+		return -EINVAL;
+
+	if (!comp->op->compress_batch) {
+		ret = 0;
+		for (i = 0; i < nr; i++) {
+			ret = zcomp_compress(comp, index + i, pages[i], bio);
+			if (ret < 0)
+				break;
+		}
+		return ret;
+	}
+
+	nr_cookie = 0;
+	for (i = 0; i < nr; i++) {
+		if (zcomp_page_same_pattern(pages[i], &element)) {
+			zram_slot_update(comp->zram, index + i, element, 0, 0,
+					 pages[i]);
+			continue;
+		}
+		pages[nr_cookie] = pages[i];
+		indices[nr_cookie] = index + i;
+		nr_cookie++;
+	}
+
+	if (!nr_cookie)
+		return 0;
+
+	ret = alloc_zcomp_cookies(comp, cookies, nr_cookie);
+	if (ret < nr_cookie) {
+		free_zcomp_cookies(comp, cookies, ret);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_cookie; i++) {
+		cookies[i]->zram = comp->zram;
+		cookies[i]->index = indices[i];
+		cookies[i]->page = pages[i];
+		cookies[i]->bio = bio;
+		cookies[i]->alt = false;
+		cookies[i]->recomp = false;
+	}
+
+	if (!zcomp_async(comp)) {
+		ret = comp->op->compress_batch(comp, cookies, nr_cookie);
+		free_zcomp_cookies(comp, cookies, nr_cookie);
+		return ret;
+	}
+
+	/* See zcomp_compress for the bio completion rule */
+	if (bio) {
+		for (i = 0; i < nr_cookie; i++)
+			bio_inc_remaining(bio);
+	}
+
+	/* Keep the order with the requests pended by the plug */
+	flush_pending_io(comp);
+	if (zcomp_submit_async(comp, cookies, nr_cookie))
+		return -EIO;
+
+	return 1;
+}
+
+/*
+ * Decompress the object of slot @index described by @handle and @flags,
+ * the snapshot of its zram_table_entry, into @page.
+ */
+int __zcomp_decompress(struct zcomp *comp, u32 index, unsigned long handle,
+		       unsigned long flags, struct page *page)
 {
 	int ret = 0;
 	void *dst, *src;
 	unsigned int src_len;
-	unsigned long handle;
 	struct zram *zram = comp->zram;
 
-	handle = zram_get_handle(zram, index);
-	if (!handle || zram_test_flag(zram, index, ZRAM_SAME)) {
-		unsigned long val = handle ? zram_get_element(zram, index) : 0;
-
+	if (!handle || flags & BIT(ZRAM_SAME)) {
+		/* the element of a same filled slot is kept in handle */
 		dst = kmap_atomic(page);
-		zcomp_fill_page(dst, PAGE_SIZE, val);
+		zcomp_fill_page(dst, PAGE_SIZE, handle);
 		kunmap_atomic(dst);
 		goto out;
 	}
 
-	src_len = zram_get_obj_size(zram, index);
+	src_len = flags & (BIT(ZRAM_FLAG_SHIFT) - 1);
 	if (src_len == PAGE_SIZE) {
 		src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 		dst = kmap_atomic(page);
@@ -420,17 +594,52 @@ int zcomp_decompress(struct zcomp *comp, u32 index, struct page *page)
 
 	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 	trace_zcomp_decompress_start(page, index);
-	ret = comp->op->decompress(comp, src, src_len, page);
+	if (flags & BIT(ZRAM_ALT_COMP))
+		ret = comp->op->decompress_alt(comp, src, src_len, page);
+	else
+		ret = comp->op->decompress(comp, src, src_len, page);
 	trace_zcomp_decompress_end(page, index);
 	zs_unmap_object(zram->mem_pool, handle);
 out:
 	return ret;
 }
 
+int zcomp_decompress(struct zcomp *comp, u32 index, struct page *page)
+{
+	struct zram *zram = comp->zram;
+
+	return __zcomp_decompress(comp, index, zram_get_handle(zram, index),
+				  zram->table[index].flags, page);
+}
+
+/*
+ * Recompress @page, the content of slot @index, with @comp and replace
+ * the slot's object if the result is smaller. Only zcomp instances with
+ * the sync compress op can be used because the result is needed right
+ * away. The caller should have marked the slot ZRAM_UNDER_WB, @idle is
+ * the ZRAM_IDLE the slot had before.
+ */
+int zcomp_recompress(struct zcomp *comp, u32 index, struct page *page,
+		     bool idle)
+{
+	struct zcomp_cookie cookie = {
+		.zram = comp->zram,
+		.index = index,
+		.page = page,
+		.recomp = true,
+		.idle = idle,
+	};
+
+	if (!comp->op->compress)
+		return -EOPNOTSUPP;
+
+	return comp->op->compress(comp, page, &cookie);
+}
+
 void zcomp_destroy(struct zcomp *comp)
 {
 	comp->op->destroy(comp);
-	if (zcomp_async(comp))
+	if (zcomp_async(comp) || comp->op->compress_batch)
 		destroy_zcomp_cookie_pool(comp);
 }
 
@@ -460,8 +669,11 @@ struct zcomp *zcomp_create(const char *algo_name, struct zram *zram)
 		return ERR_PTR(error);
 	}
 
-	if (zcomp_async(comp)) {
+	/* sync instances need the cookie pool only for compress_batch */
+	if (zcomp_async(comp) || comp->op->compress_batch)
 		init_zcomp_cookie_pool(comp);
+
+	if (zcomp_async(comp)) {
 		INIT_LIST_HEAD(&comp->request_list);
 		spin_lock_init(&comp->request_lock);
 		comp->pend_request = 0;
@@ -475,6 +687,39 @@ struct zcomp *zcomp_create(const char *algo_name, struct zram *zram)
 	return comp;
 }
 
+/*
+ * Store the object compressed by zcomp_recompress. Incompressible
+ * results are dropped since they wouldn't save anything.
+ */
+static int zcomp_copy_recomp_buffer(int err, void *buffer, int comp_len,
+				    struct zcomp_cookie *cookie)
+{
+	struct zram *zram = cookie->zram;
+	unsigned long handle;
+	void *dst_addr;
+
+	if (err)
+		return err;
+
+	if (comp_len >= huge_class_size)
+		return -ENOSPC;
+
+	handle = zs_malloc(zram->mem_pool, comp_len, ZCOMP_ZS_GFP);
+	if (IS_ERR((void *)handle))
+		return PTR_ERR((void *)handle);
+
+	dst_addr = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(dst_addr, buffer, comp_len);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	err = zram_slot_recompressed(zram, cookie->index, handle, comp_len,
+				     cookie->idle);
+	if (err)
+		zs_free(zram->mem_pool, handle);
+
+	return err;
+}
+
 /*
  * Once zcomp instance finishes the compression, it need to copy the compressed
  * buffer to zram's memory space.
@@ -483,6 +728,9 @@ struct zcomp *zcomp_create(const char *algo_name, struct zram *zram)
  * @buffer: memory address compressed objecd is stored
  * @comp_len: compressed object size
  * @cookie: the one we got when comopress function is called
+ *
+ * If the zcomp instance compressed the page with its alternate path, it
+ * should set cookie->alt so the slot is decompressed by decompress_alt.
  */
 int zcomp_copy_buffer(int err, void *buffer, int comp_len,
 		      struct zcomp_cookie *cookie)
@@ -493,6 +741,12 @@ int zcomp_copy_buffer(int err, void *buffer, int comp_len,
 	struct page *page = cookie->page;
 	struct bio *bio = cookie->bio;
 	u32 index = cookie->index;
+	unsigned long flags = cookie->alt ? BIT(ZRAM_ALT_COMP) : 0;
+	bool dedup;
+	u32 checksum;
+
+	if (cookie->recomp)
+		return zcomp_copy_recomp_buffer(err, buffer, comp_len, cookie);
 
 	if (err)
 		goto out;
@@ -500,12 +754,19 @@ int zcomp_copy_buffer(int err, void *buffer, int comp_len,
 	if (comp_len >= huge_class_size)
 		comp_len = PAGE_SIZE;
 
-	handle = zs_malloc(zram->mem_pool, comp_len,
-			__GFP_KSWAPD_RECLAIM |
-			__GFP_NOWARN |
-			__GFP_HIGHMEM |
-			__GFP_MOVABLE |
-			__GFP_CMA);
+	/* huge pages are stored as they are, so only compressed ones */
+	dedup = comp_len != PAGE_SIZE && zram_dedup_enabled(zram);
+	if (dedup) {
+		handle = zram_dedup_get(zram, buffer, comp_len, flags,
+					&checksum);
+		if (handle) {
+			zram_slot_update(zram, index, handle, comp_len,
+					 flags | BIT(ZRAM_DEDUP), page);
+			goto out;
+		}
+	}
+
+	handle = zs_malloc(zram->mem_pool, comp_len, ZCOMP_ZS_GFP);
 	if (IS_ERR((void *)handle)) {
 		err = PTR_ERR((void *)handle);
 		goto out;
@@ -521,7 +782,9 @@ int zcomp_copy_buffer(int err, void *buffer, int comp_len,
 		memcpy(dst_addr, buffer, comp_len);
 	}
 	zs_unmap_object(zram->mem_pool, handle);
-	zram_slot_update(zram, index, handle, comp_len);
+	if (dedup && zram_dedup_insert(zram, handle, checksum, comp_len, flags))
+		flags |= BIT(ZRAM_DEDUP);
+	zram_slot_update(zram, index, handle, comp_len, flags, page);
 out:
 	if (zcomp_async(zram->comp)) {
 		if (!bio) { /* rw_page case */
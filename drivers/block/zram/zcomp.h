@@ -15,6 +15,9 @@ struct bio;
 #define ZCOMP_ALGO_NAME_MAX 64
 #define BATCH_ZCOMP_REQUEST (128)
 
+/* The 32 is align with SWAP_CLUSTER_MAX and BLK_MAX_REQUEST_COUNT */
+#define ZRAM_BLK_MAX_REQUEST_COUNT 32
+
 /*
  * For compression request, zcomp generates a cookie and pass it to
  * the zcomp instance. The zcomp instance need to call zcomp_copy_buffer
@@ -25,6 +28,9 @@ struct zcomp_cookie {
 	u32 index; /* requested page-sized block index in zram block */
 	struct page *page; /* requested page for compression */
 	struct bio *bio;
+	bool alt; /* compressed by the alternate path of the zcomp instance */
+	bool recomp; /* requested by zcomp_recompress */
+	bool idle; /* ZRAM_IDLE of the slot before zcomp_recompress */
 	struct list_head list; /* list for page pool at idle */
 			       /* list for pended io at active */
 };
@@ -38,7 +44,16 @@ struct zcomp_cookie_pool {
 struct zcomp_operation {
 	int (*compress)(struct zcomp *comp, struct page *page, struct zcomp_cookie *cookie);
 	int (*compress_async)(struct zcomp *comp, struct page *page, struct zcomp_cookie *cookie);
+	/*
+	 * Compress @nr cookies (at most ZRAM_BLK_MAX_REQUEST_COUNT) in a go.
+	 * Sync backends complete every cookie before returning. Async
+	 * backends either accept all of the cookies and return 0 or
+	 * accept none of them and return an error.
+	 */
+	int (*compress_batch)(struct zcomp *comp, struct zcomp_cookie **cookies, int nr);
 	int (*decompress)(struct zcomp *comp, void *src, unsigned int src_len, struct page *page);
+	/* decompress a slot stored with cookie->alt set, i.e. ZRAM_ALT_COMP */
+	int (*decompress_alt)(struct zcomp *comp, void *src, unsigned int src_len, struct page *page);
 
 	int (*create)(struct zcomp *comp, const char *name);
 	void (*destroy)(struct zcomp *comp);
@@ -67,7 +82,13 @@ void zcomp_destroy(struct zcomp *comp);
 
 int zcomp_compress(struct zcomp *comp, u32 index, struct page *page,
 			struct bio *bio);
+int zcomp_compress_batch(struct zcomp *comp, u32 index, struct page **pages,
+			int nr, struct bio *bio);
 int zcomp_decompress(struct zcomp *comp, u32 index, struct page *page);
+int __zcomp_decompress(struct zcomp *comp, u32 index, unsigned long handle,
+		       unsigned long flags, struct page *page);
+int zcomp_recompress(struct zcomp *comp, u32 index, struct page *page,
+		     bool idle);
 
 int zcomp_register(const char *algo_name, const struct zcomp_operation *operation);
 int zcomp_unregister(const char *algo_name);
@@ -5,6 +5,10 @@
 #include <linux/highmem.h>
 #include <linux/cpuhotplug.h>
 #include <linux/local_lock.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/topology.h>
+#include <uapi/linux/sched/types.h>
 
 #include "zcomp.h"
 
@@ -27,6 +31,39 @@ static const char * const backends[] = {
 #endif
 };
 
+/*
+ * With thread_mode, compression requests are fanned out to a pool of
+ * per-cpu kthreads instead of being done on the submitting cpu. Each
+ * cpu cluster has its own queue which is served by the threads affined
+ * to that cluster. Threads with nothing to do steal requests from the
+ * other clusters' queues once those build up.
+ */
+static bool thread_mode;
+module_param(thread_mode, bool, 0444);
+MODULE_PARM_DESC(thread_mode, "Compress in per-cluster worker threads");
+
+/* how many requests a worker takes from a queue at once */
+#define ZCOMP_CPU_WORKER_BATCH	8
+/* queue depth at which idle workers of other clusters start stealing */
+#define ZCOMP_CPU_STEAL_THRESHOLD	ZCOMP_CPU_WORKER_BATCH
+
+struct zcomp_cpu_queue {
+	spinlock_t lock;
+	struct list_head head;
+	unsigned int count;
+	wait_queue_head_t wait;
+	struct cpumask cpus;
+};
+
+struct zcomp_cpu_pool {
+	int nr_queue;
+	struct zcomp_cpu_queue *queues;
+	int nr_thread;
+	struct task_struct **threads;
+};
+
+static struct zcomp_cpu_pool zcomp_cpu_pool;
+
 struct zcomp_strm {
 	/* The members ->buffer and ->tfm are protected by ->lock. */
 	local_lock_t lock;
@@ -49,13 +86,15 @@ void zcomp_stream_put(struct zcomp *comp)
 	local_unlock(&zstrm->lock);
 }
 
-int zcomp_cpu_compress(struct zcomp *comp, struct page *page,
+/*
+ * The caller needs to hold the stream via zcomp_stream_get.
+ */
+static int zcomp_strm_compress(struct zcomp_strm *stream,
 				struct zcomp_cookie *cookie)
 {
 	int err;
 	unsigned int comp_len;
 	void *src;
-	struct zcomp_strm *stream;
 
 	/*
 	 * Our dst memory (stream->buffer) is always `2 * PAGE_SIZE' sized
@@ -72,22 +111,51 @@ int zcomp_cpu_compress(struct zcomp *comp, struct page *page,
 	 * compressed buffer is too big.
 	 */
 	comp_len = PAGE_SIZE * 2;
-	stream = zcomp_stream_get(comp);
-	src = kmap_atomic(page);
+	src = kmap_atomic(cookie->page);
 	err = crypto_comp_compress(stream->tfm, src, PAGE_SIZE,
 					stream->buffer, &comp_len);
 	kunmap_atomic(src);
-	if (unlikely(err)) {
-		zcomp_stream_put(comp);
+	if (unlikely(err))
 		pr_err("Compression failed! err=%d\n", err);
-	}
 
-	err = zcomp_copy_buffer(err, stream->buffer, comp_len, cookie);
+	return zcomp_copy_buffer(err, stream->buffer, comp_len, cookie);
+}
+
+int zcomp_cpu_compress(struct zcomp *comp, struct page *page,
+				struct zcomp_cookie *cookie)
+{
+	int err;
+	struct zcomp_strm *stream;
+
+	stream = zcomp_stream_get(comp);
+	err = zcomp_strm_compress(stream, cookie);
 	zcomp_stream_put(comp);
 
 	return err;
 }
 
+/*
+ * Keep the per-cpu stream across the whole batch rather than taking
+ * it for every page. Returns the first error but keeps going so every
+ * cookie is completed.
+ */
+int zcomp_cpu_compress_batch(struct zcomp *comp,
+				struct zcomp_cookie **cookies, int nr)
+{
+	int i, err, ret = 0;
+	struct zcomp_strm *stream;
+
+	stream = zcomp_stream_get(comp);
+	for (i = 0; i < nr; i++) {
+		err = zcomp_strm_compress(stream, cookies[i]);
+		if (err && !ret)
+			ret = err;
+	}
+	zcomp_stream_put(comp);
+
+	return ret;
+}
+
 int zcomp_cpu_decompress(struct zcomp *comp, void *src,
 			unsigned int src_len, struct page *page)
 {
@@ -106,6 +174,254 @@ int zcomp_cpu_decompress(struct zcomp *comp, void *src,
 	return ret;
 }
 
+static int zcomp_cpu_dequeue(struct zcomp_cpu_queue *queue,
+			struct zcomp_cookie **cookies, int nr)
+{
+	int i;
+
+	spin_lock(&queue->lock);
+	for (i = 0; i < nr && !list_empty(&queue->head); i++) {
+		cookies[i] = list_first_entry(&queue->head,
+					struct zcomp_cookie, list);
+		list_del(&cookies[i]->list);
+		queue->count--;
+	}
+	spin_unlock(&queue->lock);
+
+	return i;
+}
+
+static int zcomp_cpu_steal(struct zcomp_cpu_queue *self,
+			struct zcomp_cookie **cookies, int nr)
+{
+	struct zcomp_cpu_queue *queue;
+	int i;
+
+	for (i = 0; i < zcomp_cpu_pool.nr_queue; i++) {
+		queue = &zcomp_cpu_pool.queues[i];
+		if (queue == self ||
+		    READ_ONCE(queue->count) < ZCOMP_CPU_STEAL_THRESHOLD)
+			continue;
+
+		nr = zcomp_cpu_dequeue(queue, cookies, nr);
+		if (nr)
+			return nr;
+	}
+
+	return 0;
+}
+
+static bool zcomp_cpu_has_work(struct zcomp_cpu_queue *self)
+{
+	int i;
+
+	if (READ_ONCE(self->count))
+		return true;
+
+	for (i = 0; i < zcomp_cpu_pool.nr_queue; i++) {
+		if (READ_ONCE(zcomp_cpu_pool.queues[i].count) >=
+				ZCOMP_CPU_STEAL_THRESHOLD)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Requests in a worker batch could come from zram devices with different
+ * zcomp instances so switch the stream only when the instance changes.
+ */
+static void zcomp_cpu_compress_cookies(struct zcomp_cookie **cookies, int nr)
+{
+	struct zcomp *comp = NULL;
+	struct zcomp_strm *stream = NULL;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (cookies[i]->zram->comp != comp) {
+			if (comp)
+				zcomp_stream_put(comp);
+			comp = cookies[i]->zram->comp;
+			stream = zcomp_stream_get(comp);
+		}
+		/* zcomp_copy_buffer completes the IO on its own */
+		zcomp_strm_compress(stream, cookies[i]);
+	}
+
+	if (comp)
+		zcomp_stream_put(comp);
+}
+
+static int zcomp_cpu_worker(void *data)
+{
+	struct zcomp_cpu_queue *queue = data;
+	struct zcomp_cookie *cookies[ZCOMP_CPU_WORKER_BATCH];
+	struct sched_attr attr = {
+		.sched_policy = SCHED_NORMAL,
+		.sched_nice = -10,
+	};
+
+	WARN_ON_ONCE(sched_setattr_nocheck(current, &attr) != 0);
+	current->flags |= PF_MEMALLOC;
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		int nr;
+
+		wait_event_freezable_exclusive(queue->wait,
+				zcomp_cpu_has_work(queue) ||
+				kthread_should_stop());
+
+		nr = zcomp_cpu_dequeue(queue, cookies, ZCOMP_CPU_WORKER_BATCH);
+		if (!nr)
+			nr = zcomp_cpu_steal(queue, cookies,
+					ZCOMP_CPU_WORKER_BATCH);
+		if (nr)
+			zcomp_cpu_compress_cookies(cookies, nr);
+	}
+
+	return 0;
+}
+
+/*
+ * Prefer the least loaded queue. Ties go to the first queue, which is the
+ * cluster of the lowest cpu ids (usually the little cores).
+ */
+static struct zcomp_cpu_queue *zcomp_cpu_select_queue(void)
+{
+	struct zcomp_cpu_queue *queue = &zcomp_cpu_pool.queues[0];
+	int i;
+
+	for (i = 1; i < zcomp_cpu_pool.nr_queue; i++) {
+		if (READ_ONCE(zcomp_cpu_pool.queues[i].count) <
+				READ_ONCE(queue->count))
+			queue = &zcomp_cpu_pool.queues[i];
+	}
+
+	return queue;
+}
+
+static void zcomp_cpu_enqueue(struct zcomp_cookie **cookies, int nr)
+{
+	struct zcomp_cpu_queue *queue = zcomp_cpu_select_queue();
+	unsigned int count;
+	int i;
+
+	spin_lock(&queue->lock);
+	for (i = 0; i < nr; i++)
+		list_add_tail(&cookies[i]->list, &queue->head);
+	queue->count += nr;
+	count = queue->count;
+	spin_unlock(&queue->lock);
+
+	wake_up(&queue->wait);
+	if (count < ZCOMP_CPU_STEAL_THRESHOLD)
+		return;
+
+	/* the cluster is falling behind so let the others help */
+	for (i = 0; i < zcomp_cpu_pool.nr_queue; i++) {
+		if (&zcomp_cpu_pool.queues[i] != queue)
+			wake_up(&zcomp_cpu_pool.queues[i].wait);
+	}
+}
+
+int zcomp_cpu_compress_async(struct zcomp *comp, struct page *page,
+				struct zcomp_cookie *cookie)
+{
+	zcomp_cpu_enqueue(&cookie, 1);
+	return 0;
+}
+
+/*
+ * Split the batch into worker sized chunks so a large write is spread
+ * over several clusters.
+ */
+int zcomp_cpu_compress_batch_async(struct zcomp *comp,
+				struct zcomp_cookie **cookies, int nr)
+{
+	int i, chunk;
+
+	for (i = 0; i < nr; i += chunk) {
+		chunk = min(nr - i, ZCOMP_CPU_WORKER_BATCH);
+		zcomp_cpu_enqueue(&cookies[i], chunk);
+	}
+
+	return 0;
+}
+
+static void zcomp_cpu_pool_destroy(void)
+{
+	struct zcomp_cpu_pool *pool = &zcomp_cpu_pool;
+	int i;
+
+	for (i = 0; i < pool->nr_thread; i++)
+		kthread_stop(pool->threads[i]);
+
+	for (i = 0; i < pool->nr_queue; i++)
+		WARN_ON(!list_empty(&pool->queues[i].head));
+
+	kfree(pool->threads);
+	kfree(pool->queues);
+	pool->threads = NULL;
+	pool->queues = NULL;
+	pool->nr_thread = 0;
+	pool->nr_queue = 0;
+}
+
+/*
+ * Create a queue per cpu cluster and a worker per cpu affined to the
+ * cluster it belongs to.
+ */
+static int zcomp_cpu_pool_init(void)
+{
+	struct zcomp_cpu_pool *pool = &zcomp_cpu_pool;
+	struct zcomp_cpu_queue *queue;
+	struct task_struct *task;
+	cpumask_var_t covered;
+	int cpu, i, ret = 0;
+
+	if (!zalloc_cpumask_var(&covered, GFP_KERNEL))
+		return -ENOMEM;
+
+	pool->queues = kcalloc(nr_cpu_ids, sizeof(*pool->queues), GFP_KERNEL);
+	pool->threads = kcalloc(nr_cpu_ids, sizeof(*pool->threads), GFP_KERNEL);
+	if (!pool->queues || !pool->threads) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for_each_online_cpu(cpu) {
+		if (cpumask_test_cpu(cpu, covered))
+			continue;
+
+		queue = &pool->queues[pool->nr_queue++];
+		spin_lock_init(&queue->lock);
+		INIT_LIST_HEAD(&queue->head);
+		init_waitqueue_head(&queue->wait);
+		cpumask_and(&queue->cpus, topology_cluster_cpumask(cpu),
+				cpu_online_mask);
+		cpumask_set_cpu(cpu, &queue->cpus);
+		cpumask_or(covered, covered, &queue->cpus);
+
+		for_each_cpu(i, &queue->cpus) {
+			task = kthread_create(zcomp_cpu_worker, queue,
+					"zcomp_cpu/%d", i);
+			if (IS_ERR(task)) {
+				ret = PTR_ERR(task);
+				goto out;
+			}
+			set_cpus_allowed_ptr(task, &queue->cpus);
+			pool->threads[pool->nr_thread++] = task;
+			wake_up_process(task);
+		}
+	}
+out:
+	free_cpumask_var(covered);
+	if (ret)
+		zcomp_cpu_pool_destroy();
+	return ret;
+}
+
 static void zcomp_strm_free(struct zcomp_strm *zstrm)
 {
 	if (!IS_ERR_OR_NULL(zstrm->tfm))
@@ -164,6 +480,17 @@ const struct zcomp_operation zcomp_cpu_op = {
 	.create = zcomp_cpu_create,
 	.destroy = zcomp_cpu_destroy,
 	.compress = zcomp_cpu_compress,
+	.compress_batch = zcomp_cpu_compress_batch,
+	.decompress = zcomp_cpu_decompress,
+};
+
+const struct zcomp_operation zcomp_cpu_thread_op = {
+	.create = zcomp_cpu_create,
+	.destroy = zcomp_cpu_destroy,
+	/* for zcomp_recompress */
+	.compress = zcomp_cpu_compress,
+	.compress_async = zcomp_cpu_compress_async,
+	.compress_batch = zcomp_cpu_compress_batch_async,
 	.decompress = zcomp_cpu_decompress,
 };
 
@@ -194,11 +521,19 @@ int zcomp_cpu_dead(unsigned int cpu, struct hlist_node *node)
 
 static int __init zcomp_cpu_init(void)
 {
+	const struct zcomp_operation *op = &zcomp_cpu_op;
 	int ret;
 	int i;
 
+	if (thread_mode) {
+		ret = zcomp_cpu_pool_init();
+		if (ret)
+			return ret;
+		op = &zcomp_cpu_thread_op;
+	}
+
 	for (i = 0; i < ARRAY_SIZE(backends); i++) {
-		ret = zcomp_register(backends[i], &zcomp_cpu_op);
+		ret = zcomp_register(backends[i], op);
 		if (ret)
 			goto out;
 	}
@@ -214,6 +549,8 @@ static int __init zcomp_cpu_init(void)
 out:
 	for (i = i - 1; i >= 0; i--)
 		zcomp_unregister(backends[i]);
+	if (thread_mode)
+		zcomp_cpu_pool_destroy();
 
 	return ret;
 }
@@ -226,6 +563,8 @@ static void __exit zcomp_cpu_exit(void)
 		zcomp_unregister(backends[i]);
 
 	cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
+	if (thread_mode)
+		zcomp_cpu_pool_destroy();
 }
 
 module_init(zcomp_cpu_init);
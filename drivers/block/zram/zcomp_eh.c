@@ -1,10 +1,32 @@
 // SPDX-License-Identifier: GPL-2.0
 
 #include <linux/module.h>
+#include <linux/crypto.h>
+#include <linux/highmem.h>
+#include <linux/local_lock.h>
 
 #include "zcomp.h"
 #include <linux/eh.h>
 
+/*
+ * lz77eh_hybrid compresses with EH while its fifo has room and spills
+ * to a CPU lz4 stream once EH is congested instead of stalling the
+ * caller. Slots compressed by CPU are tagged with ZRAM_ALT_COMP.
+ */
+#define ZCOMP_EH_HYBRID_CPU_ALGO "lz4"
+
+struct zcomp_eh_strm {
+	/* The members ->buffer and ->tfm are protected by ->lock. */
+	local_lock_t lock;
+	void *buffer;
+	struct crypto_comp *tfm;
+};
+
+struct zcomp_eh_hybrid {
+	struct eh_device *eh_dev;
+	struct zcomp_eh_strm __percpu *strm;
+};
+
 static void zcomp_eh_compress_done(int compr_ret, void *buffer,
 				   unsigned int size, void *priv)
 {
@@ -17,6 +39,21 @@ static int zcomp_eh_compress(struct zcomp *comp, struct page *page,
 	return eh_compress_page(comp->private, page, cookie);
 }
 
+static int zcomp_eh_compress_batch(struct zcomp *comp,
+				struct zcomp_cookie **cookies, int nr)
+{
+	struct page *pages[ZRAM_BLK_MAX_REQUEST_COUNT];
+	void *priv[ZRAM_BLK_MAX_REQUEST_COUNT];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pages[i] = cookies[i]->page;
+		priv[i] = cookies[i];
+	}
+
+	return eh_compress_pages(comp->private, pages, priv, nr);
+}
+
 static int zcomp_eh_decompress(struct zcomp *comp, void *src,
 			unsigned int src_len, struct page *page)
 {
@@ -46,16 +83,173 @@ const struct zcomp_operation zcomp_eh_op = {
 	.create = zcomp_eh_create,
 	.destroy = zcomp_eh_destroy,
 	.compress_async = zcomp_eh_compress,
+	.compress_batch = zcomp_eh_compress_batch,
 	.decompress = zcomp_eh_decompress,
 };
 
+#if IS_ENABLED(CONFIG_CRYPTO_LZ4)
+/*
+ * Compress the page on the current cpu and complete the request right
+ * away. Any error is propagated through zcomp_copy_buffer so the request
+ * is always consumed.
+ */
+static int zcomp_eh_hybrid_cpu_compress(struct zcomp_eh_hybrid *hybrid,
+				struct zcomp_cookie *cookie)
+{
+	struct zcomp_eh_strm *zstrm;
+	unsigned int comp_len = PAGE_SIZE * 2;
+	void *src;
+	int err;
+
+	local_lock(&hybrid->strm->lock);
+	zstrm = this_cpu_ptr(hybrid->strm);
+	src = kmap_atomic(cookie->page);
+	err = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+				   zstrm->buffer, &comp_len);
+	kunmap_atomic(src);
+	if (unlikely(err))
+		pr_err("Compression failed! err=%d\n", err);
+
+	cookie->alt = true;
+	zcomp_copy_buffer(err, zstrm->buffer, comp_len, cookie);
+	local_unlock(&hybrid->strm->lock);
+
+	return 0;
+}
+
+static int zcomp_eh_hybrid_compress(struct zcomp *comp, struct page *page,
+				struct zcomp_cookie *cookie)
+{
+	struct zcomp_eh_hybrid *hybrid = comp->private;
+
+	if (!eh_compress_page_nowait(hybrid->eh_dev, page, cookie))
+		return 0;
+
+	return zcomp_eh_hybrid_cpu_compress(hybrid, cookie);
+}
+
+static int zcomp_eh_hybrid_decompress(struct zcomp *comp, void *src,
+			unsigned int src_len, struct page *page)
+{
+	struct zcomp_eh_hybrid *hybrid = comp->private;
+
+	return eh_decompress_page(hybrid->eh_dev, src, src_len, page);
+}
+
+static int zcomp_eh_hybrid_decompress_alt(struct zcomp *comp, void *src,
+			unsigned int src_len, struct page *page)
+{
+	struct zcomp_eh_hybrid *hybrid = comp->private;
+	struct zcomp_eh_strm *zstrm;
+	unsigned int dst_len = PAGE_SIZE;
+	void *dst;
+	int ret;
+
+	dst = kmap_atomic(page);
+	local_lock(&hybrid->strm->lock);
+	zstrm = this_cpu_ptr(hybrid->strm);
+	ret = crypto_comp_decompress(zstrm->tfm, src, src_len, dst, &dst_len);
+	local_unlock(&hybrid->strm->lock);
+	kunmap_atomic(dst);
+
+	return ret;
+}
+
+static void zcomp_eh_hybrid_free(struct zcomp_eh_hybrid *hybrid)
+{
+	struct zcomp_eh_strm *zstrm;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		zstrm = per_cpu_ptr(hybrid->strm, cpu);
+		if (!IS_ERR_OR_NULL(zstrm->tfm))
+			crypto_free_comp(zstrm->tfm);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+	free_percpu(hybrid->strm);
+	kfree(hybrid);
+}
+
+static void zcomp_eh_hybrid_destroy(struct zcomp *comp)
+{
+	struct zcomp_eh_hybrid *hybrid = comp->private;
+
+	eh_destroy(hybrid->eh_dev);
+	zcomp_eh_hybrid_free(hybrid);
+	module_put(THIS_MODULE);
+}
+
+static int zcomp_eh_hybrid_create(struct zcomp *comp, const char *name)
+{
+	struct zcomp_eh_hybrid *hybrid;
+	struct zcomp_eh_strm *zstrm;
+	int cpu;
+
+	hybrid = kzalloc(sizeof(*hybrid), GFP_KERNEL);
+	if (!hybrid)
+		return -ENOMEM;
+
+	hybrid->strm = alloc_percpu(struct zcomp_eh_strm);
+	if (!hybrid->strm) {
+		kfree(hybrid);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		zstrm = per_cpu_ptr(hybrid->strm, cpu);
+		local_lock_init(&zstrm->lock);
+		zstrm->tfm = crypto_alloc_comp(ZCOMP_EH_HYBRID_CPU_ALGO, 0, 0);
+		/* see zcomp_strm_init in zcomp_cpu.c for the 2 pages */
+		zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+		if (IS_ERR_OR_NULL(zstrm->tfm) || !zstrm->buffer) {
+			zcomp_eh_hybrid_free(hybrid);
+			return -ENOMEM;
+		}
+	}
+
+	hybrid->eh_dev = eh_create(zcomp_eh_compress_done);
+	if (IS_ERR(hybrid->eh_dev)) {
+		zcomp_eh_hybrid_free(hybrid);
+		return -ENODEV;
+	}
+
+	comp->private = hybrid;
+	__module_get(THIS_MODULE);
+
+	return 0;
+}
+
+const struct zcomp_operation zcomp_eh_hybrid_op = {
+	.create = zcomp_eh_hybrid_create,
+	.destroy = zcomp_eh_hybrid_destroy,
+	.compress_async = zcomp_eh_hybrid_compress,
+	.decompress = zcomp_eh_hybrid_decompress,
+	.decompress_alt = zcomp_eh_hybrid_decompress_alt,
+};
+#endif
+
 static int __init zcomp_eh_init(void)
 {
-	return zcomp_register("lz77eh", &zcomp_eh_op);
+	int ret;
+
+	ret = zcomp_register("lz77eh", &zcomp_eh_op);
+	if (ret)
+		return ret;
+
+#if IS_ENABLED(CONFIG_CRYPTO_LZ4)
+	ret = zcomp_register("lz77eh_hybrid", &zcomp_eh_hybrid_op);
+	if (ret)
+		zcomp_unregister("lz77eh");
+#endif
+
+	return ret;
 }
 
 static void __exit zcomp_eh_exit(void)
 {
+#if IS_ENABLED(CONFIG_CRYPTO_LZ4)
+	zcomp_unregister("lz77eh_hybrid");
+#endif
 	zcomp_unregister("lz77eh");
 }
 
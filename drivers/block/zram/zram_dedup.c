@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Deduplication of zram objects
+ *
+ * The same page compresses to the same object with the same algorithm,
+ * so compressed objects are looked up by the checksum of their data and
+ * shared across slots by refcount. Slots sharing an object are marked
+ * ZRAM_DEDUP.
+ *
+ * Both tables are guarded by arrays of bucket locks, each lock covering
+ * the buckets with the same low bits. The refcount of an entry is guarded
+ * by the lock of its checksum bucket. If both locks are needed, the
+ * checksum bucket lock is taken first.
+ */
+
+#include <linux/kernel.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+#define ZRAM_DEDUP_MIN_BITS	8
+#define ZRAM_DEDUP_MAX_BITS	20
+#define ZRAM_DEDUP_LOCK_BITS	ZRAM_DEDUP_MIN_BITS
+#define ZRAM_DEDUP_NR_LOCKS	(1 << ZRAM_DEDUP_LOCK_BITS)
+
+struct zram_dedup_entry {
+	struct hlist_node csum_node;
+	struct hlist_node handle_node;
+	unsigned long handle;
+	u32 checksum;
+	unsigned int len;
+	/* zram_pageflags the object should be decompressed with */
+	unsigned long flags;
+	unsigned int refs;
+};
+
+struct zram_dedup {
+	unsigned int bits;
+	struct hlist_head *csum_table;
+	struct hlist_head *handle_table;
+	spinlock_t csum_locks[ZRAM_DEDUP_NR_LOCKS];
+	spinlock_t handle_locks[ZRAM_DEDUP_NR_LOCKS];
+};
+
+static struct kmem_cache *zram_dedup_cache;
+
+static struct hlist_head *csum_bucket(struct zram_dedup *dedup, u32 checksum)
+{
+	return &dedup->csum_table[hash_32(checksum, dedup->bits)];
+}
+
+static spinlock_t *csum_lock(struct zram_dedup *dedup, u32 checksum)
+{
+	u32 idx = hash_32(checksum, dedup->bits);
+
+	return &dedup->csum_locks[idx & (ZRAM_DEDUP_NR_LOCKS - 1)];
+}
+
+static struct hlist_head *handle_bucket(struct zram_dedup *dedup,
+					unsigned long handle)
+{
+	return &dedup->handle_table[hash_long(handle, dedup->bits)];
+}
+
+static spinlock_t *handle_lock(struct zram_dedup *dedup, unsigned long handle)
+{
+	unsigned long idx = hash_long(handle, dedup->bits);
+
+	return &dedup->handle_locks[idx & (ZRAM_DEDUP_NR_LOCKS - 1)];
+}
+
+static bool zram_dedup_same(struct zram *zram, struct zram_dedup_entry *entry,
+			    void *mem, unsigned int len, unsigned long flags)
+{
+	void *src;
+	bool same;
+
+	if (entry->len != len || entry->flags != flags)
+		return false;
+
+	src = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	same = !memcmp(src, mem, len);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return same;
+}
+
+/*
+ * Look up the object having the same data as @mem. Returns the handle of
+ * the object with its refcount taken, or 0 with @checksum set for
+ * zram_dedup_insert.
+ */
+unsigned long zram_dedup_get(struct zram *zram, void *mem, unsigned int len,
+			     unsigned long flags, u32 *checksum)
+{
+	struct zram_dedup *dedup = zram->dedup;
+	struct zram_dedup_entry *entry;
+	unsigned long handle = 0;
+
+	*checksum = jhash(mem, len, 0);
+
+	spin_lock(csum_lock(dedup, *checksum));
+	hlist_for_each_entry(entry, csum_bucket(dedup, *checksum), csum_node) {
+		if (entry->checksum != *checksum)
+			continue;
+
+		if (zram_dedup_same(zram, entry, mem, len, flags)) {
+			entry->refs++;
+			handle = entry->handle;
+			break;
+		}
+	}
+	spin_unlock(csum_lock(dedup, *checksum));
+
+	if (handle) {
+		this_cpu_inc(zram->pcp_stats->items[NR_DEDUP_HIT]);
+		this_cpu_add(zram->pcp_stats->items[DEDUP_SAVED_SIZE], len);
+	}
+
+	return handle;
+}
+
+/*
+ * Track the new object @handle so that following slots can share it.
+ * Returns false if it couldn't be tracked; the slot then owns the object
+ * as usual.
+ */
+bool zram_dedup_insert(struct zram *zram, unsigned long handle, u32 checksum,
+		       unsigned int len, unsigned long flags)
+{
+	struct zram_dedup *dedup = zram->dedup;
+	struct zram_dedup_entry *entry;
+
+	entry = kmem_cache_alloc(zram_dedup_cache, GFP_NOWAIT | __GFP_NOWARN);
+	if (!entry)
+		return false;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->flags = flags;
+	entry->refs = 1;
+
+	spin_lock(csum_lock(dedup, checksum));
+	hlist_add_head(&entry->csum_node, csum_bucket(dedup, checksum));
+	spin_lock(handle_lock(dedup, handle));
+	hlist_add_head(&entry->handle_node, handle_bucket(dedup, handle));
+	spin_unlock(handle_lock(dedup, handle));
+	spin_unlock(csum_lock(dedup, checksum));
+
+	return true;
+}
+
+/*
+ * Drop a reference of the object @handle. Returns true if it was the last
+ * one so the caller should free the object.
+ */
+bool zram_dedup_put(struct zram *zram, unsigned long handle)
+{
+	struct zram_dedup *dedup = zram->dedup;
+	struct zram_dedup_entry *entry, *found = NULL;
+	unsigned int len = 0;
+	bool last = false;
+
+	/*
+	 * The reference of the caller keeps the entry alive, so it can be
+	 * used after the handle bucket lock is dropped.
+	 */
+	spin_lock(handle_lock(dedup, handle));
+	hlist_for_each_entry(entry, handle_bucket(dedup, handle), handle_node) {
+		if (entry->handle == handle) {
+			found = entry;
+			break;
+		}
+	}
+	spin_unlock(handle_lock(dedup, handle));
+
+	entry = found;
+	if (entry) {
+		spin_lock(csum_lock(dedup, entry->checksum));
+		if (--entry->refs) {
+			len = entry->len;
+		} else {
+			hlist_del(&entry->csum_node);
+			spin_lock(handle_lock(dedup, handle));
+			hlist_del(&entry->handle_node);
+			spin_unlock(handle_lock(dedup, handle));
+			last = true;
+		}
+		spin_unlock(csum_lock(dedup, entry->checksum));
+	}
+
+	if (last)
+		kmem_cache_free(zram_dedup_cache, entry);
+	else if (len)
+		this_cpu_sub(zram->pcp_stats->items[DEDUP_SAVED_SIZE], len);
+	else
+		WARN_ON_ONCE(1);
+
+	return last;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	struct zram_dedup *dedup;
+	size_t size;
+	int i;
+
+	if (!zram->use_dedup)
+		return 0;
+
+	dedup = kvzalloc(sizeof(*dedup), GFP_KERNEL);
+	if (!dedup)
+		return -ENOMEM;
+
+	/* a bucket per 8 pages is enough for the duplicates we see */
+	dedup->bits = clamp_t(int, ilog2(max_t(size_t, num_pages, 1)) - 3,
+			      ZRAM_DEDUP_MIN_BITS, ZRAM_DEDUP_MAX_BITS);
+	size = array_size(1UL << dedup->bits, sizeof(struct hlist_head));
+	dedup->csum_table = kvzalloc(size, GFP_KERNEL);
+	dedup->handle_table = kvzalloc(size, GFP_KERNEL);
+	if (!dedup->csum_table || !dedup->handle_table) {
+		kvfree(dedup->csum_table);
+		kvfree(dedup->handle_table);
+		kvfree(dedup);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < ZRAM_DEDUP_NR_LOCKS; i++) {
+		spin_lock_init(&dedup->csum_locks[i]);
+		spin_lock_init(&dedup->handle_locks[i]);
+	}
+	zram->dedup = dedup;
+
+	return 0;
+}
+
+/* Called after every slot was freed */
+void zram_dedup_fini(struct zram *zram)
+{
+	struct zram_dedup *dedup = zram->dedup;
+
+	if (!dedup)
+		return;
+
+	kvfree(dedup->csum_table);
+	kvfree(dedup->handle_table);
+	kvfree(dedup);
+	zram->dedup = NULL;
+}
+
+int __init zram_dedup_cache_init(void)
+{
+	zram_dedup_cache = KMEM_CACHE(zram_dedup_entry, 0);
+	if (!zram_dedup_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void zram_dedup_cache_destroy(void)
+{
+	kmem_cache_destroy(zram_dedup_cache);
+}
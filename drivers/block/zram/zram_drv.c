@@ -55,6 +55,12 @@ static unsigned int num_devices = 1;
 static const struct block_device_operations zram_devops;
 
 static void zram_free_page(struct zram *zram, size_t index);
+
+/*
+ * zsmalloc handle being read by zram_read_lockless on this CPU. The
+ * handle isn't freed by zram_free_page while it's published here.
+ */
+static DEFINE_PER_CPU(unsigned long, zram_read_handle);
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			u32 index, int offset, struct bio *bio, bool accesss);
 
@@ -71,6 +77,8 @@ void zram_slot_lock(struct zram *zram, u32 index)
 
 void zram_slot_unlock(struct zram *zram, u32 index)
 {
+	/* tell lockless readers that the slot might have been changed */
+	zram->table[index].flags += BIT(ZRAM_GEN_SHIFT);
 	bit_spin_unlock(ZRAM_LOCK, &zram->table[index].flags);
 }
 
@@ -626,19 +634,263 @@ static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
 #define HUGE_WRITEBACK (1<<0)
 #define IDLE_WRITEBACK (1<<1)
 
+/*
+ * Allocate the block right after @blk_idx so that it can be added to the
+ * same writeback bio. Returns 0 if the block is out of range or in use.
+ */
+static unsigned long alloc_next_block_bdev(struct zram *zram,
+					unsigned long blk_idx)
+{
+	if (++blk_idx >= zram->nr_pages)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		return 0;
+
+	this_cpu_inc(zram->pcp_stats->items[NR_BD_COUNT]);
+	return blk_idx;
+}
+
+/* state of a writeback_store run shared with its in-flight requests */
+struct zram_wb_ctl {
+	struct zram *zram;
+	/* no. of bios in flight, bounded by zram->wb_depth */
+	atomic_t nr_inflight;
+	/* no. of pages submitted but not completed yet */
+	atomic_t nr_pending;
+	wait_queue_head_t wait;
+	/* the last IO error */
+	int err;
+	/* held by writeback_store and every request until it's completed */
+	atomic_t refs;
+	struct completion done;
+};
+
+struct zram_wb_req {
+	struct zram_wb_ctl *ctl;
+	struct work_struct work;
+	struct bio *bio;
+	/* the first block, the n-th page is written to blk_idx + n */
+	unsigned long blk_idx;
+	ktime_t start;
+	ktime_t latency;
+	int nr;
+	u32 index[ZRAM_WB_BATCH];
+	struct page *page[ZRAM_WB_BATCH];
+};
 
+static void zram_wb_put_ctl(struct zram_wb_ctl *ctl)
+{
+	if (atomic_dec_and_test(&ctl->refs))
+		complete(&ctl->done);
+}
+
+static void zram_wb_account_latency(struct zram *zram, ktime_t latency)
+{
+	unsigned long ms = ktime_to_ms(latency);
+	int bucket = ms ? min(ilog2(ms) + 1, ZRAM_WB_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(zram->pcp_stats->items[NR_BD_WB_LAT + bucket]);
+}
+
+/*
+ * Mark the slot written back to @blk_idx unless it was changed while
+ * the write was in flight. Returns false if the block should be freed.
+ */
+static bool zram_wb_finish_slot(struct zram *zram, u32 index,
+				unsigned long blk_idx, int err)
+{
+	unsigned short memcg_id;
+
+	zram_slot_lock(zram, index);
+	/*
+	 * We released zram_slot_lock so need to check if the slot was
+	 * changed. If there is freeing for the slot, we can catch it
+	 * easily by zram_allocated.
+	 * A subtle case is the slot is freed/reallocated/marked as
+	 * ZRAM_IDLE again. To close the race, idle_store doesn't
+	 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
+	 * Thus, we could close the race by checking ZRAM_IDLE bit.
+	 */
+	if (err || !zram_allocated(zram, index) ||
+			!zram_test_flag(zram, index, ZRAM_IDLE)) {
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+		return false;
+	}
+
+	memcg_id = zram_memcg_uncharge(zram, index);
+	zram_free_page(zram, index);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_set_flag(zram, index, ZRAM_WB);
+	zram_set_element(zram, index, blk_idx);
+	this_cpu_inc(zram->pcp_stats->items[NR_PAGE_STORED]);
+	/* the page stays charged while it's on the backing device */
+	zram_memcg_charge(zram, index, memcg_id);
+	zram_memcg_writeback(zram, memcg_id);
+	zram_slot_unlock(zram, index);
+
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
+		zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
+	spin_unlock(&zram->wb_limit_lock);
+
+	return true;
+}
+
+/*
+ * Slot updates take zram_slot_lock, which isn't safe in the bio
+ * completion context, so they are deferred to a worker.
+ */
+static void zram_wb_complete(struct work_struct *work)
+{
+	struct zram_wb_req *req = container_of(work, struct zram_wb_req, work);
+	struct zram_wb_ctl *ctl = req->ctl;
+	struct zram *zram = ctl->zram;
+	int err = blk_status_to_errno(req->bio->bi_status);
+	int i;
+
+	if (err)
+		ctl->err = err;
+	else
+		this_cpu_add(zram->pcp_stats->items[NR_BD_WRITE], req->nr);
+	zram_wb_account_latency(zram, req->latency);
+
+	for (i = 0; i < req->nr; i++) {
+		if (!zram_wb_finish_slot(zram, req->index[i],
+					req->blk_idx + i, err))
+			free_block_bdev(zram, req->blk_idx + i);
+		__free_page(req->page[i]);
+	}
+
+	atomic_sub(req->nr, &ctl->nr_pending);
+	bio_put(req->bio);
+	kfree(req);
+
+	atomic_dec(&ctl->nr_inflight);
+	wake_up(&ctl->wait);
+	zram_wb_put_ctl(ctl);
+}
+
+static void zram_wb_end_io(struct bio *bio)
+{
+	struct zram_wb_req *req = bio->bi_private;
+
+	req->latency = ktime_sub(ktime_get(), req->start);
+	queue_work(system_unbound_wq, &req->work);
+}
+
+static struct zram_wb_req *zram_wb_alloc_req(struct zram_wb_ctl *ctl)
+{
+	struct zram *zram = ctl->zram;
+	struct zram_wb_req *req;
+
+	wait_event(ctl->wait, atomic_read(&ctl->nr_inflight) <
+			READ_ONCE(zram->wb_depth));
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	req->bio = bio_alloc(zram->bdev, ZRAM_WB_BATCH, REQ_OP_WRITE,
+			GFP_NOIO);
+	if (!req->bio) {
+		kfree(req);
+		return NULL;
+	}
+
+	req->ctl = ctl;
+	INIT_WORK(&req->work, zram_wb_complete);
+	req->bio->bi_private = req;
+	req->bio->bi_end_io = zram_wb_end_io;
+
+	return req;
+}
+
+static void zram_wb_submit_req(struct zram_wb_req *req)
+{
+	struct zram_wb_ctl *ctl = req->ctl;
+
+	atomic_inc(&ctl->nr_inflight);
+	atomic_inc(&ctl->refs);
+	req->bio->bi_iter.bi_sector = req->blk_idx * (PAGE_SIZE >> 9);
+	req->start = ktime_get();
+	submit_bio(req->bio);
+}
+
+/*
+ * Add the page of slot @index to @req if its block can follow the
+ * blocks already in the request. Returns -EAGAIN if @req should be
+ * submitted first.
+ */
+static int zram_wb_add_page(struct zram_wb_req *req, u32 index,
+			struct page *page)
+{
+	struct zram *zram = req->ctl->zram;
+	unsigned long blk_idx;
+
+	if (!req->nr) {
+		blk_idx = alloc_block_bdev(zram);
+		if (!blk_idx)
+			return -ENOSPC;
+		req->blk_idx = blk_idx;
+	} else {
+		if (req->nr == ZRAM_WB_BATCH)
+			return -EAGAIN;
+		blk_idx = alloc_next_block_bdev(zram,
+				req->blk_idx + req->nr - 1);
+		if (!blk_idx)
+			return -EAGAIN;
+	}
+
+	bio_add_page(req->bio, page, PAGE_SIZE, 0);
+	req->index[req->nr] = index;
+	req->page[req->nr] = page;
+	req->nr++;
+	atomic_inc(&req->ctl->nr_pending);
+
+	return 0;
+}
+
+static void zram_wb_abort_slot(struct zram *zram, u32 index)
+{
+	zram_slot_lock(zram, index);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_slot_unlock(zram, index);
+}
+
+static bool zram_wb_limit_reached(struct zram_wb_ctl *ctl)
+{
+	struct zram *zram = ctl->zram;
+	u64 pending = (u64)atomic_read(&ctl->nr_pending) <<
+			(PAGE_SHIFT - 12);
+	bool ret;
+
+	spin_lock(&zram->wb_limit_lock);
+	ret = zram->wb_limit_enable && zram->bd_wb_limit <= pending;
+	spin_unlock(&zram->wb_limit_lock);
+
+	return ret;
+}
+
+/*
+ * Pages to write back are packed into bios over contiguous blocks of
+ * the backing device and up to zram->wb_depth bios are kept in flight.
+ * Slots are switched to ZRAM_WB when their bio is completed.
+ */
 static ssize_t writeback_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
 	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
 	unsigned long index = 0;
-	struct bio bio;
-	struct bio_vec bio_vec;
-	struct page *page;
+	struct zram_wb_ctl ctl;
+	struct zram_wb_req *req = NULL;
+	struct page *page = NULL;
 	ssize_t ret = len;
 	int mode, err;
-	unsigned long blk_idx = 0;
 
 	if (sysfs_streq(buf, "idle"))
 		mode = IDLE_WRITEBACK;
@@ -669,31 +921,26 @@ static ssize_t writeback_store(struct device *dev,
 		goto release_init_lock;
 	}
 
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
-		ret = -ENOMEM;
-		goto release_init_lock;
-	}
+	ctl.zram = zram;
+	ctl.err = 0;
+	atomic_set(&ctl.nr_inflight, 0);
+	atomic_set(&ctl.nr_pending, 0);
+	atomic_set(&ctl.refs, 1);
+	init_waitqueue_head(&ctl.wait);
+	init_completion(&ctl.done);
 
 	for (; nr_pages != 0; index++, nr_pages--) {
 		struct bio_vec bvec;
 
-		bvec.bv_page = page;
-		bvec.bv_len = PAGE_SIZE;
-		bvec.bv_offset = 0;
-
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && !zram->bd_wb_limit) {
-			spin_unlock(&zram->wb_limit_lock);
+		if (zram_wb_limit_reached(&ctl)) {
 			ret = -EIO;
 			break;
 		}
-		spin_unlock(&zram->wb_limit_lock);
 
-		if (!blk_idx) {
-			blk_idx = alloc_block_bdev(zram);
-			if (!blk_idx) {
-				ret = -ENOSPC;
+		if (!page) {
+			page = alloc_page(GFP_KERNEL);
+			if (!page) {
+				ret = -ENOMEM;
 				break;
 			}
 		}
@@ -721,79 +968,99 @@ static ssize_t writeback_store(struct device *dev,
 		/* Need for hugepage writeback racing */
 		zram_set_flag(zram, index, ZRAM_IDLE);
 		zram_slot_unlock(zram, index);
+
+		bvec.bv_page = page;
+		bvec.bv_len = PAGE_SIZE;
+		bvec.bv_offset = 0;
 		if (zram_bvec_read(zram, &bvec, index, 0, NULL, false)) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
+			zram_wb_abort_slot(zram, index);
 			continue;
 		}
 
-		bio_init(&bio, zram->bdev, &bio_vec, 1,
-			 REQ_OP_WRITE | REQ_SYNC);
-		bio.bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
+		if (!req) {
+			req = zram_wb_alloc_req(&ctl);
+			if (!req) {
+				zram_wb_abort_slot(zram, index);
+				ret = -ENOMEM;
+				break;
+			}
+		}
 
-		bio_add_page(&bio, bvec.bv_page, bvec.bv_len,
-				bvec.bv_offset);
-		/*
-		 * XXX: A single page IO would be inefficient for write
-		 * but it would be not bad as starter.
-		 */
-		err = submit_bio_wait(&bio);
+		err = zram_wb_add_page(req, index, page);
+		if (err == -EAGAIN) {
+			zram_wb_submit_req(req);
+			req = zram_wb_alloc_req(&ctl);
+			if (!req) {
+				zram_wb_abort_slot(zram, index);
+				ret = -ENOMEM;
+				break;
+			}
+			err = zram_wb_add_page(req, index, page);
+		}
 		if (err) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
-			/*
-			 * Return last IO error unless every IO were
-			 * not suceeded.
-			 */
+			zram_wb_abort_slot(zram, index);
 			ret = err;
-			continue;
-		}
-
-		this_cpu_inc(zram->pcp_stats->items[NR_BD_WRITE]);
-		/*
-		 * We released zram_slot_lock so need to check if the slot was
-		 * changed. If there is freeing for the slot, we can catch it
-		 * easily by zram_allocated.
-		 * A subtle case is the slot is freed/reallocated/marked as
-		 * ZRAM_IDLE again. To close the race, idle_store doesn't
-		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
-		 * Thus, we could close the race by checking ZRAM_IDLE bit.
-		 */
-		zram_slot_lock(zram, index);
-		if (!zram_allocated(zram, index) ||
-			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			goto next;
+			break;
 		}
 
-		zram_free_page(zram, index);
-		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-		zram_set_flag(zram, index, ZRAM_WB);
-		zram_set_element(zram, index, blk_idx);
-		blk_idx = 0;
-		this_cpu_inc(zram->pcp_stats->items[NR_PAGE_STORED]);
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
-			zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
-		spin_unlock(&zram->wb_limit_lock);
+		/* the page is owned by the request now */
+		page = NULL;
+		continue;
 next:
 		zram_slot_unlock(zram, index);
 	}
 
-	if (blk_idx)
-		free_block_bdev(zram, blk_idx);
-	__free_page(page);
+	if (req) {
+		if (req->nr) {
+			zram_wb_submit_req(req);
+		} else {
+			bio_put(req->bio);
+			kfree(req);
+		}
+	}
+
+	zram_wb_put_ctl(&ctl);
+	wait_for_completion(&ctl.done);
+	/*
+	 * Return last IO error unless every IO were
+	 * not suceeded.
+	 */
+	if (ctl.err && ret == len)
+		ret = ctl.err;
+
+	if (page)
+		__free_page(page);
 release_init_lock:
 	up_read(&zram->init_lock);
 
 	return ret;
 }
 
+static ssize_t writeback_depth_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	if (!val || val > ZRAM_WB_DEPTH_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(zram->wb_depth, val);
+
+	return len;
+}
+
+static ssize_t writeback_depth_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(zram->wb_depth));
+}
+
 struct zram_work {
 	struct work_struct work;
 	struct zram *zram;
@@ -854,6 +1121,244 @@ static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
 	else
 		return read_from_bdev_async(zram, bvec, entry, parent);
 }
+
+/*
+ * Backing device readahead
+ *
+ * A read of a written back slot also reads the following slots whose
+ * blocks follow the slot's block, i.e. which were written by the same
+ * writeback bio, with a single bio. The pages are kept decompressed in
+ * ra_cache until they are read or the slots are freed.
+ *
+ * Slots under readahead are marked ZRAM_UNDER_WB so that they can't be
+ * written back again, possibly to the same block, before the readahead
+ * is completed.
+ */
+struct zram_ra_req {
+	struct zram *zram;
+	struct work_struct work;
+	struct bio *bio;
+	/* the n-th page is of slot index + n read from blk_idx + n */
+	u32 index;
+	unsigned long blk_idx;
+	int nr;
+	struct page *page[ZRAM_WB_BATCH];
+};
+
+static void zram_ra_cache_insert(struct zram *zram, u32 index,
+				unsigned long blk_idx, struct page *page)
+{
+	struct page *victim = NULL;
+
+	page->index = index;
+	set_page_private(page, blk_idx);
+
+	spin_lock(&zram->ra_lock);
+	if (xa_load(&zram->ra_cache, index) ||
+			xa_is_err(xa_store(&zram->ra_cache, index, page,
+					GFP_NOWAIT | __GFP_NOWARN))) {
+		spin_unlock(&zram->ra_lock);
+		__free_page(page);
+		return;
+	}
+
+	list_add_tail(&page->lru, &zram->ra_lru);
+	if (++zram->ra_count > ZRAM_RA_CACHE_PAGES) {
+		victim = list_first_entry(&zram->ra_lru, struct page, lru);
+		list_del(&victim->lru);
+		xa_erase(&zram->ra_cache, victim->index);
+		zram->ra_count--;
+	}
+	spin_unlock(&zram->ra_lock);
+
+	if (victim)
+		__free_page(victim);
+}
+
+/*
+ * Remove the page of slot @index from ra_cache. The caller should hold
+ * the slot lock.
+ */
+static struct page *zram_ra_cache_take(struct zram *zram, u32 index)
+{
+	struct page *page;
+
+	if (!READ_ONCE(zram->ra_count))
+		return NULL;
+
+	spin_lock(&zram->ra_lock);
+	page = xa_erase(&zram->ra_cache, index);
+	if (page) {
+		list_del(&page->lru);
+		zram->ra_count--;
+	}
+	spin_unlock(&zram->ra_lock);
+
+	return page;
+}
+
+static void zram_ra_complete(struct work_struct *work)
+{
+	struct zram_ra_req *req = container_of(work, struct zram_ra_req, work);
+	struct zram *zram = req->zram;
+	int err = blk_status_to_errno(req->bio->bi_status);
+	int i;
+
+	for (i = 0; i < req->nr; i++) {
+		u32 index = req->index + i;
+		unsigned long blk_idx = req->blk_idx + i;
+
+		zram_slot_lock(zram, index);
+		if (!err && zram_test_flag(zram, index, ZRAM_WB) &&
+				zram_get_element(zram, index) == blk_idx) {
+			zram_ra_cache_insert(zram, index, blk_idx,
+					req->page[i]);
+			this_cpu_inc(zram->pcp_stats->items[NR_BD_RA]);
+		} else {
+			__free_page(req->page[i]);
+		}
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+	}
+
+	bio_put(req->bio);
+	kfree(req);
+
+	if (atomic_dec_and_test(&zram->ra_inflight))
+		wake_up_var(&zram->ra_inflight);
+}
+
+static void zram_ra_end_io(struct bio *bio)
+{
+	struct zram_ra_req *req = bio->bi_private;
+
+	/* see zram_wb_complete */
+	queue_work(system_unbound_wq, &req->work);
+}
+
+/*
+ * Read ahead slots following slot @index stored at @blk_idx. Called
+ * without the slot lock.
+ */
+static void zram_readahead(struct zram *zram, u32 index,
+			unsigned long blk_idx)
+{
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned int ra_pages = READ_ONCE(zram->ra_pages);
+	struct zram_ra_req *req;
+	int i;
+
+	if (!ra_pages)
+		return;
+
+	req = kzalloc(sizeof(*req), GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN);
+	if (!req)
+		return;
+
+	req->zram = zram;
+	req->index = index + 1;
+	req->blk_idx = blk_idx + 1;
+
+	for (i = 0; i < ra_pages; i++) {
+		u32 ra_index = req->index + i;
+		struct page *page;
+
+		if (ra_index >= nr_pages)
+			break;
+
+		zram_slot_lock(zram, ra_index);
+		if (!zram_test_flag(zram, ra_index, ZRAM_WB) ||
+				zram_test_flag(zram, ra_index, ZRAM_UNDER_WB) ||
+				zram_get_element(zram, ra_index) !=
+					req->blk_idx + i) {
+			zram_slot_unlock(zram, ra_index);
+			break;
+		}
+		zram_set_flag(zram, ra_index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, ra_index);
+
+		page = alloc_page(GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN);
+		if (!page) {
+			zram_slot_lock(zram, ra_index);
+			zram_clear_flag(zram, ra_index, ZRAM_UNDER_WB);
+			zram_slot_unlock(zram, ra_index);
+			break;
+		}
+		req->page[i] = page;
+		req->nr++;
+	}
+
+	if (!req->nr)
+		goto out_free_req;
+
+	req->bio = bio_alloc(zram->bdev, req->nr, REQ_OP_READ | REQ_RAHEAD,
+			GFP_NOIO);
+	if (!req->bio)
+		goto out_abort;
+
+	req->bio->bi_iter.bi_sector = req->blk_idx * (PAGE_SIZE >> 9);
+	for (i = 0; i < req->nr; i++)
+		bio_add_page(req->bio, req->page[i], PAGE_SIZE, 0);
+	req->bio->bi_private = req;
+	req->bio->bi_end_io = zram_ra_end_io;
+	INIT_WORK(&req->work, zram_ra_complete);
+
+	atomic_inc(&zram->ra_inflight);
+	submit_bio(req->bio);
+	return;
+
+out_abort:
+	for (i = 0; i < req->nr; i++) {
+		zram_slot_lock(zram, req->index + i);
+		zram_clear_flag(zram, req->index + i, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, req->index + i);
+		__free_page(req->page[i]);
+	}
+out_free_req:
+	kfree(req);
+}
+
+/* Wait for readahead in flight and drop the cached pages */
+static void zram_ra_drain(struct zram *zram)
+{
+	struct page *page, *tmp;
+
+	wait_var_event(&zram->ra_inflight, !atomic_read(&zram->ra_inflight));
+
+	spin_lock(&zram->ra_lock);
+	list_for_each_entry_safe(page, tmp, &zram->ra_lru, lru) {
+		list_del(&page->lru);
+		xa_erase(&zram->ra_cache, page->index);
+		__free_page(page);
+	}
+	zram->ra_count = 0;
+	spin_unlock(&zram->ra_lock);
+}
+
+static ssize_t readahead_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	if (val >= ZRAM_WB_BATCH)
+		return -EINVAL;
+
+	WRITE_ONCE(zram->ra_pages, val);
+
+	return len;
+}
+
+static ssize_t readahead_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(zram->ra_pages));
+}
 #else
 static inline void reset_bdev(struct zram *zram) {};
 static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
@@ -863,6 +1368,13 @@ static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
 }
 
 static void free_block_bdev(struct zram *zram, unsigned long blk_idx) {};
+static inline struct page *zram_ra_cache_take(struct zram *zram, u32 index)
+{
+	return NULL;
+}
+static inline void zram_readahead(struct zram *zram, u32 index,
+				unsigned long blk_idx) {};
+static inline void zram_ra_drain(struct zram *zram) {};
 #endif
 
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
@@ -958,19 +1470,94 @@ static void zram_debugfs_register(struct zram *zram)
 				zram, &proc_zram_block_state_op);
 }
 
-static void zram_debugfs_unregister(struct zram *zram)
-{
-	debugfs_remove_recursive(zram->debugfs_dir);
+static void zram_debugfs_unregister(struct zram *zram)
+{
+	debugfs_remove_recursive(zram->debugfs_dir);
+}
+#else
+static void zram_debugfs_create(void) {};
+static void zram_debugfs_destroy(void) {};
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+};
+static void zram_debugfs_register(struct zram *zram) {};
+static void zram_debugfs_unregister(struct zram *zram) {};
+#endif
+
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", (int)val);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtobool(buf, &val))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
+	up_write(&zram->init_lock);
+
+	return len;
+}
+#endif
+
+#ifdef CONFIG_ZRAM_MEMCG
+static ssize_t memcg_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = zram_memcg_stat_show(zram, buf);
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+/* "<cgroup inode number> <limit>", limit 0 removes the limit */
+static ssize_t memcg_limit_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 ino, limit;
+	char *tmp;
+	int ret, n;
+
+	if (sscanf(buf, "%llu %n", &ino, &n) != 1)
+		return -EINVAL;
+
+	buf += n;
+	limit = memparse(buf, &tmp);
+	if (buf == tmp) /* no chars parsed, invalid input */
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	ret = zram_memcg_set_limit(zram, ino, limit);
+	up_read(&zram->init_lock);
+
+	return ret ? ret : len;
 }
-#else
-static void zram_debugfs_create(void) {};
-static void zram_debugfs_destroy(void) {};
-static void zram_accessed(struct zram *zram, u32 index)
-{
-	zram_clear_flag(zram, index, ZRAM_IDLE);
-};
-static void zram_debugfs_register(struct zram *zram) {};
-static void zram_debugfs_unregister(struct zram *zram) {};
 #endif
 
 /*
@@ -1035,6 +1622,216 @@ static ssize_t comp_algorithm_store(struct device *dev,
 	return len;
 }
 
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->recomp_algorithm, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char compressor[ARRAY_SIZE(zram->recomp_algorithm)];
+	size_t sz;
+
+	strscpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	/* an empty string disables recompression */
+	if (sz && !zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+
+	strcpy(zram->recomp_algorithm, compressor);
+	up_write(&zram->init_lock);
+	return len;
+}
+
+#define HUGE_RECOMPRESS (1<<0)
+#define IDLE_RECOMPRESS (1<<1)
+
+static bool zram_recompress_candidate(struct zram *zram, u32 index, int mode)
+{
+	if (!zram_allocated(zram, index))
+		return false;
+
+	/*
+	 * A shared object stays referenced by the other slots, so giving
+	 * one of them a new object would only grow the pool.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_SAME) ||
+			zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+			zram_test_flag(zram, index, ZRAM_RECOMP) ||
+			zram_test_flag(zram, index, ZRAM_DEDUP))
+		return false;
+
+	if (mode & IDLE_RECOMPRESS &&
+			!zram_test_flag(zram, index, ZRAM_IDLE))
+		return false;
+	if (mode & HUGE_RECOMPRESS &&
+			!zram_test_flag(zram, index, ZRAM_HUGE))
+		return false;
+
+	return true;
+}
+
+/*
+ * Replace the object of the slot with the one recompressed by
+ * zram->recomp. Returns -ESTALE if the slot was changed or accessed
+ * since recompress_store picked it and -ENOSPC if the new object
+ * isn't smaller than the current one. @idle is the ZRAM_IDLE the slot
+ * had before recompress_store marked it.
+ */
+int zram_slot_recompressed(struct zram *zram, u32 index,
+		unsigned long handle, unsigned int comp_len, bool idle)
+{
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	ktime_t ac_time;
+#endif
+	unsigned short memcg_id;
+	int ret = 0;
+
+	zram_slot_lock(zram, index);
+	/* See the comment in writeback_store */
+	if (!zram_allocated(zram, index) ||
+			!zram_test_flag(zram, index, ZRAM_IDLE)) {
+		ret = -ESTALE;
+		goto out;
+	}
+
+	if (comp_len >= zram_get_obj_size(zram, index)) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	ac_time = zram->table[index].ac_time;
+#endif
+	memcg_id = zram_memcg_uncharge(zram, index);
+	zram_free_page(zram, index);
+	__this_cpu_inc(zram->pcp_stats->items[NR_PAGE_STORED]);
+	__this_cpu_add(zram->pcp_stats->items[COMPRESSED_SIZE], comp_len);
+	zram_set_handle(zram, index, handle);
+	zram_set_obj_size(zram, index, comp_len);
+	zram_memcg_charge(zram, index, memcg_id);
+	zram_set_flag(zram, index, ZRAM_RECOMP);
+	/* the slot is as cold as it was */
+	if (idle)
+		zram_set_flag(zram, index, ZRAM_IDLE);
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	zram->table[index].ac_time = ac_time;
+#endif
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+out:
+	zram_slot_unlock(zram, index);
+	if (!ret)
+		update_used_max(zram, zs_get_total_pages(zram->mem_pool));
+	return ret;
+}
+
+/*
+ * Recompress idle and/or huge slots with the secondary algorithm to
+ * save memory on cold pages while the primary algorithm stays fast.
+ */
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long index;
+	struct bio_vec bvec;
+	struct page *page;
+	ssize_t ret = len;
+	int mode, err;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = IDLE_RECOMPRESS;
+	else if (sysfs_streq(buf, "huge"))
+		mode = HUGE_RECOMPRESS;
+	else if (sysfs_streq(buf, "huge_idle"))
+		mode = IDLE_RECOMPRESS | HUGE_RECOMPRESS;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram->recomp) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		ret = -ENOMEM;
+		goto release_init_lock;
+	}
+
+	bvec.bv_page = page;
+	bvec.bv_len = PAGE_SIZE;
+	bvec.bv_offset = 0;
+
+	for (index = 0; index < nr_pages; index++) {
+		bool idle;
+
+		zram_slot_lock(zram, index);
+		if (!zram_recompress_candidate(zram, index, mode)) {
+			zram_slot_unlock(zram, index);
+			continue;
+		}
+
+		/*
+		 * ZRAM_UNDER_WB keeps writeback and mark_idle off the slot
+		 * and ZRAM_IDLE tells us whether the slot was changed by the
+		 * time the new object is stored like writeback_store does.
+		 */
+		idle = zram_test_flag(zram, index, ZRAM_IDLE);
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+
+		err = zram_bvec_read(zram, &bvec, index, 0, NULL, false);
+		if (!err)
+			err = zcomp_recompress(zram->recomp, index, page, idle);
+		if (err) {
+			zram_slot_lock(zram, index);
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			if (!idle)
+				zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+		}
+
+		cond_resched();
+	}
+
+	__free_page(page);
+release_init_lock:
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
@@ -1080,7 +1877,8 @@ static ssize_t mm_stat_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 	struct zs_pool_stats pool_stats;
 	unsigned long orig_size, compr_size, max_used, same_pages,
-		      huge_pages, huge_pages_since, mem_used;
+		      huge_pages, huge_pages_since, mem_used, dup_hits,
+		      dup_size;
 	ssize_t ret;
 
 	mem_used = 0;
@@ -1098,9 +1896,11 @@ static ssize_t mm_stat_show(struct device *dev,
 	same_pages = zram_stat_read(zram, NR_SAME_PAGE);
 	huge_pages = zram_stat_read(zram, NR_HUGE_PAGE);
 	huge_pages_since = zram_stat_read(zram, NR_HUGE_PAGE_SINCE);
+	dup_hits = zram_stat_read(zram, NR_DEDUP_HIT);
+	dup_size = zram_stat_read(zram, DEDUP_SAVED_SIZE);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8lu %8lu %8lu %8lu %8lu %8lu %8ld %8lu %8lu\n",
+			"%8lu %8lu %8lu %8lu %8lu %8lu %8ld %8lu %8lu %8lu %8lu\n",
 			orig_size << PAGE_SHIFT,
 			compr_size,
 			mem_used << PAGE_SHIFT,
@@ -1109,7 +1909,9 @@ static ssize_t mm_stat_show(struct device *dev,
 			same_pages,
 			atomic_long_read(&pool_stats.pages_compacted),
 			huge_pages,
-			huge_pages_since);
+			huge_pages_since,
+			dup_hits,
+			dup_size);
 
 	up_read(&zram->init_lock);
 
@@ -1124,14 +1926,21 @@ static ssize_t bd_stat_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 	ssize_t ret;
 	unsigned long bd_count, bd_reads, bd_writes;
+	int i;
 
 	down_read(&zram->init_lock);
 	bd_count = zram_stat_read(zram, NR_BD_COUNT);
 	bd_reads = zram_stat_read(zram, NR_BD_READ);
 	bd_writes = zram_stat_read(zram, NR_BD_WRITE);
 
-	ret = scnprintf(buf, PAGE_SIZE, "%8lu %8lu %8lu\n",
+	ret = scnprintf(buf, PAGE_SIZE, "%8lu %8lu %8lu",
 			FOUR_K(bd_count), FOUR_K(bd_reads),FOUR_K(bd_writes));
+	for (i = 0; i < ZRAM_WB_LAT_BUCKETS; i++)
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, " %8lu",
+				zram_stat_read(zram, NR_BD_WB_LAT + i));
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, " %8lu %8lu\n",
+			FOUR_K(zram_stat_read(zram, NR_BD_RA)),
+			FOUR_K(zram_stat_read(zram, NR_BD_RA_HIT)));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1173,6 +1982,8 @@ static void zram_meta_free(struct zram *zram, u64 disksize)
 		zram_slot_unlock(zram, index);
 	}
 
+	zram_dedup_fini(zram);
+	zram_memcg_fini(zram);
 	zs_destroy_pool(zram->mem_pool);
 	vfree(zram->table);
 }
@@ -1192,13 +2003,25 @@ static bool zram_meta_alloc(struct zram *zram, u64 disksize)
 		return false;
 	}
 
+	if (zram_dedup_init(zram, num_pages)) {
+		zs_destroy_pool(zram->mem_pool);
+		vfree(zram->table);
+		return false;
+	}
+
 	return true;
 }
 
+/*
+ * @flags: extra zram_pageflags to set on the slot along with the object
+ * @page: the page stored, its memcg is charged for the slot
+ */
 void zram_slot_update(struct zram *zram, u32 index,
-		unsigned long handle, unsigned int comp_len)
+		unsigned long handle, unsigned int comp_len,
+		unsigned long flags, struct page *page)
 {
 	unsigned long alloced_pages;
+	unsigned short memcg_id = zram_memcg_get(zram, page);
 
 	/*
 	 * free memory associated with this sector
@@ -1221,7 +2044,9 @@ void zram_slot_update(struct zram *zram, u32 index,
 		}
 		zram_set_handle(zram, index, handle);
 		zram_set_obj_size(zram, index, comp_len);
+		zram->table[index].flags |= flags;
 	}
+	zram_memcg_charge(zram, index, memcg_id);
 	zram_accessed(zram, index);
 	zram_slot_unlock(zram, index);
 	if (comp_len) {
@@ -1231,6 +2056,16 @@ void zram_slot_update(struct zram *zram, u32 index,
 	}
 }
 
+static void zram_wait_lockless_readers(unsigned long handle)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		while (READ_ONCE(per_cpu(zram_read_handle, cpu)) == handle)
+			cpu_relax();
+	}
+}
+
 /*
  * To protect concurrent access to the same index entry,
  * caller should hold this table index entry's bit_spinlock to
@@ -1239,7 +2074,14 @@ void zram_slot_update(struct zram *zram, u32 index,
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	unsigned long handle;
+	bool last = true;
 
+	/*
+	 * Pairs with smp_mb in zram_read_lockless. Either the reader sees
+	 * the slot locked or we see the handle it published.
+	 */
+	smp_mb();
+	zram_memcg_uncharge(zram, index);
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	zram->table[index].ac_time = 0;
 #endif
@@ -1251,7 +2093,17 @@ static void zram_free_page(struct zram *zram, size_t index)
 		__this_cpu_dec(zram->pcp_stats->items[NR_HUGE_PAGE]);
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_ALT_COMP))
+		zram_clear_flag(zram, index, ZRAM_ALT_COMP);
+
+	if (zram_test_flag(zram, index, ZRAM_RECOMP))
+		zram_clear_flag(zram, index, ZRAM_RECOMP);
+
 	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		struct page *page = zram_ra_cache_take(zram, index);
+
+		if (page)
+			__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_WB);
 		free_block_bdev(zram, zram_get_element(zram, index));
 		goto out;
@@ -1271,29 +2123,95 @@ static void zram_free_page(struct zram *zram, size_t index)
 	if (!handle)
 		return;
 
-	zs_free(zram->mem_pool, handle);
+	/* the object might be still shared by other slots */
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		last = zram_dedup_put(zram, handle);
+	}
+
+	if (last) {
+		zram_wait_lockless_readers(handle);
+		zs_free(zram->mem_pool, handle);
+	}
 
 	__this_cpu_sub(zram->pcp_stats->items[COMPRESSED_SIZE], zram_get_obj_size(zram, index));
 out:
 	__this_cpu_dec(zram->pcp_stats->items[NR_PAGE_STORED]);
 	zram_set_handle(zram, index, 0);
 	zram_set_obj_size(zram, index, 0);
-	WARN_ON_ONCE(zram->table[index].flags &
+	WARN_ON_ONCE(zram->table[index].flags & (BIT(ZRAM_GEN_SHIFT) - 1) &
 		~(1UL << ZRAM_LOCK | 1UL << ZRAM_UNDER_WB));
 }
 
+/*
+ * Read a slot without zram_slot_lock so that parallel readers don't
+ * bounce the cache lines of the table. The slot is read only if it
+ * doesn't need to be updated by the read and the flags, including the
+ * generation, are the same before and after taking the snapshot of the
+ * handle. Returns -EAGAIN if the caller should read it under the lock.
+ */
+static int zram_read_lockless(struct zram *zram, struct page *page,
+			u32 index, bool access)
+{
+	struct zram_table_entry *entry = &zram->table[index];
+	unsigned long flags, handle;
+	struct zcomp *comp;
+	int ret = -EAGAIN;
+
+	flags = READ_ONCE(entry->flags);
+	if (flags & (BIT(ZRAM_LOCK) | BIT(ZRAM_WB)))
+		return -EAGAIN;
+
+	/* zram_accessed would update the slot */
+	if (access && (IS_ENABLED(CONFIG_ZRAM_MEMORY_TRACKING) ||
+			flags & BIT(ZRAM_IDLE)))
+		return -EAGAIN;
+
+	preempt_disable();
+	smp_rmb();
+	handle = READ_ONCE(entry->handle);
+	__this_cpu_write(zram_read_handle, handle);
+	/* Pairs with smp_mb in zram_free_page */
+	smp_mb();
+	if (READ_ONCE(entry->flags) != flags)
+		goto out;
+
+	comp = flags & BIT(ZRAM_RECOMP) ? zram->recomp : zram->comp;
+	ret = __zcomp_decompress(comp, index, handle, flags, page);
+out:
+	/* the object is not accessed any longer once the handle is cleared */
+	smp_store_release(this_cpu_ptr(&zram_read_handle), 0);
+	preempt_enable();
+
+	return ret;
+}
+
 static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 				struct bio *bio, bool partial_io, bool access)
 {
+	struct zcomp *comp;
 	int ret;
 
+	ret = zram_read_lockless(zram, page, index, access);
+	if (ret != -EAGAIN)
+		goto out;
+
 	zram_slot_lock(zram, index);
 	if (access)
 		zram_accessed(zram, index);
 	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk_idx = zram_get_element(zram, index);
+		struct page *ra_page = zram_ra_cache_take(zram, index);
 		struct bio_vec bvec;
 
 		zram_slot_unlock(zram, index);
+		if (ra_page) {
+			copy_highpage(page, ra_page);
+			__free_page(ra_page);
+			this_cpu_inc(zram->pcp_stats->items[NR_BD_RA_HIT]);
+			return 0;
+		}
+
 		/* A null bio means rw_page was used, we must fallback to bio */
 		if (!bio)
 			return -EOPNOTSUPP;
@@ -1301,14 +2219,16 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		bvec.bv_page = page;
 		bvec.bv_len = PAGE_SIZE;
 		bvec.bv_offset = 0;
-		return read_from_bdev(zram, &bvec,
-				zram_get_element(zram, index),
-				bio, partial_io);
+		ret = read_from_bdev(zram, &bvec, blk_idx, bio, partial_io);
+		if (ret >= 0)
+			zram_readahead(zram, index, blk_idx);
+		return ret;
 	}
 
-	ret = zcomp_decompress(zram->comp, index, page);
+	comp = zram_test_flag(zram, index, ZRAM_RECOMP) ? zram->recomp : zram->comp;
+	ret = zcomp_decompress(comp, index, page);
 	zram_slot_unlock(zram, index);
-
+out:
 	/* Should NEVER happen. Return bio error if it does. */
 	if (WARN_ON(ret))
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
@@ -1358,6 +2278,9 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 			zs_get_total_pages(zram->mem_pool) > zram->limit_pages)
 		return -ENOMEM;
 
+	if (zram_memcg_over_limit(zram, page))
+		return -ENOMEM;
+
 	return zcomp_compress(zram->comp, index, page, bio);
 }
 
@@ -1487,6 +2410,78 @@ void zram_page_write_endio(struct zram *zram, struct page *page, int err)
 	page_endio(page, true, err);
 }
 
+/*
+ * Only bios made of full, page aligned segments are handed over to
+ * zcomp_compress_batch. Anything else goes through zram_bvec_rw.
+ */
+static bool zram_bio_batchable(struct bio *bio, int offset)
+{
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+
+	if (offset)
+		return false;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		if (bvec.bv_offset || bvec.bv_len != PAGE_SIZE)
+			return false;
+	}
+
+	return true;
+}
+
+static int zram_bvec_write_batch(struct zram *zram, struct page **pages,
+				int nr, u32 index, struct bio *bio)
+{
+	int i;
+
+	this_cpu_add(zram->pcp_stats->items[NR_WRITE], nr);
+	if (zram->limit_pages &&
+			zs_get_total_pages(zram->mem_pool) > zram->limit_pages)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		if (zram_memcg_over_limit(zram, pages[i]))
+			return -ENOMEM;
+	}
+
+	return zcomp_compress_batch(zram->comp, index, pages, nr, bio);
+}
+
+/*
+ * Returns errno if it has some problem. Otherwise return 0 or 1 like
+ * zram_bvec_rw.
+ */
+static int zram_bio_write_batch(struct zram *zram, struct bio *bio, u32 index)
+{
+	struct page *pages[ZRAM_BLK_MAX_REQUEST_COUNT];
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	int nr = 0, ret = 0, err;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		pages[nr++] = bvec.bv_page;
+		if (nr < ZRAM_BLK_MAX_REQUEST_COUNT)
+			continue;
+
+		err = zram_bvec_write_batch(zram, pages, nr, index, bio);
+		if (err < 0)
+			return err;
+		ret |= err;
+		index += nr;
+		nr = 0;
+	}
+
+	if (nr) {
+		err = zram_bvec_write_batch(zram, pages, nr, index, bio);
+		if (err < 0)
+			return err;
+		ret |= err;
+	}
+
+	return ret;
+}
+
 static void __zram_make_request(struct zram *zram, struct bio *bio)
 {
 	int offset;
@@ -1512,6 +2507,13 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 	}
 
 	start_time = bio_start_io_acct(bio);
+	if (op_is_write(op) && zram_bio_batchable(bio, offset)) {
+		ret = zram_bio_write_batch(zram, bio, index);
+		if (ret < 0)
+			bio->bi_status = BLK_STS_IOERR;
+		goto out;
+	}
+
 	bio_for_each_segment(bvec, bio, iter) {
 		struct bio_vec bv = bvec;
 		unsigned int unwritten = bvec.bv_len;
@@ -1531,6 +2533,7 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 			update_position(&index, &offset, &bv);
 		} while (unwritten);
 	}
+out:
 	bio_end_io_acct(bio, start_time);
 	zram_bio_endio(zram, bio, op_is_write(op), ret);
 }
@@ -1639,11 +2642,16 @@ static void zram_reset_device(struct zram *zram)
 	part_stat_set_all(zram->disk->part0, 0);
 
 	/* I/O operation under all of CPU are done so let's free */
+	zram_ra_drain(zram);
 	zram_meta_free(zram, zram->disksize);
 	zram->disksize = 0;
 	init_zram_stat(zram);
 	zcomp_destroy(zram->comp);
 	zram->comp = NULL;
+	if (zram->recomp) {
+		zcomp_destroy(zram->recomp);
+		zram->recomp = NULL;
+	}
 	reset_bdev(zram);
 
 	up_write(&zram->init_lock);
@@ -1653,7 +2661,7 @@ static ssize_t disksize_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	u64 disksize;
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp = NULL;
 	struct zram *zram = dev_to_zram(dev);
 	int err;
 
@@ -1682,13 +2690,42 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_free_meta;
 	}
 
+	/*
+	 * zcomp instances are shared by algorithm so the secondary one
+	 * should be different from the primary and able to compress
+	 * synchronously.
+	 */
+	if (zram->recomp_algorithm[0]) {
+		if (!strcmp(zram->recomp_algorithm, zram->compressor)) {
+			err = -EINVAL;
+			goto out_free_comp;
+		}
+
+		recomp = zcomp_create(zram->recomp_algorithm, zram);
+		if (IS_ERR(recomp)) {
+			pr_err("Cannot initialise %s recompressing backend\n",
+					zram->recomp_algorithm);
+			err = PTR_ERR(recomp);
+			goto out_free_comp;
+		}
+
+		if (!recomp->op->compress) {
+			zcomp_destroy(recomp);
+			err = -EINVAL;
+			goto out_free_comp;
+		}
+	}
+
 	zram->comp = comp;
+	zram->recomp = recomp;
 	zram->disksize = disksize;
 	set_capacity_and_notify(zram->disk, zram->disksize >> SECTOR_SHIFT);
 	up_write(&zram->init_lock);
 
 	return len;
 
+out_free_comp:
+	zcomp_destroy(comp);
 out_free_meta:
 	zram_meta_free(zram, disksize);
 out_unlock:
@@ -1768,11 +2805,22 @@ static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_WO(idle);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(recompress);
+#ifdef CONFIG_ZRAM_DEDUP
+static DEVICE_ATTR_RW(use_dedup);
+#endif
+#ifdef CONFIG_ZRAM_MEMCG
+static DEVICE_ATTR_RO(memcg_stat);
+static DEVICE_ATTR_WO(memcg_limit);
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
 static DEVICE_ATTR_WO(writeback);
 static DEVICE_ATTR_RW(writeback_limit);
 static DEVICE_ATTR_RW(writeback_limit_enable);
+static DEVICE_ATTR_RW(writeback_depth);
+static DEVICE_ATTR_RW(readahead);
 #endif
 
 static struct attribute *zram_disk_attrs[] = {
@@ -1785,11 +2833,22 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_idle.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recompress.attr,
+#ifdef CONFIG_ZRAM_DEDUP
+	&dev_attr_use_dedup.attr,
+#endif
+#ifdef CONFIG_ZRAM_MEMCG
+	&dev_attr_memcg_stat.attr,
+	&dev_attr_memcg_limit.attr,
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
 	&dev_attr_writeback.attr,
 	&dev_attr_writeback_limit.attr,
 	&dev_attr_writeback_limit_enable.attr,
+	&dev_attr_writeback_depth.attr,
+	&dev_attr_readahead.attr,
 #endif
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
@@ -1827,8 +2886,13 @@ static int zram_add(void)
 	device_id = ret;
 
 	init_rwsem(&zram->init_lock);
+	zram_memcg_init(zram);
 #ifdef CONFIG_ZRAM_WRITEBACK
 	spin_lock_init(&zram->wb_limit_lock);
+	zram->wb_depth = ZRAM_WB_DEPTH;
+	spin_lock_init(&zram->ra_lock);
+	xa_init(&zram->ra_cache);
+	INIT_LIST_HEAD(&zram->ra_lru);
 #endif
 
 	/* gendisk structure */
@@ -2066,11 +3130,16 @@ static int __init zram_init(void)
 {
 	int ret;
 
-	BUILD_BUG_ON(__NR_ZRAM_PAGEFLAGS > BITS_PER_LONG);
+	BUILD_BUG_ON(__NR_ZRAM_PAGEFLAGS >= BITS_PER_LONG);
+
+	ret = zram_dedup_cache_init();
+	if (ret)
+		return ret;
 
 	ret = class_register(&zram_control_class);
 	if (ret) {
 		pr_err("Unable to register zram-control class\n");
+		zram_dedup_cache_destroy();
 		return ret;
 	}
 
@@ -2079,6 +3148,7 @@ static int __init zram_init(void)
 	if (zram_major <= 0) {
 		pr_err("Unable to get major number\n");
 		class_unregister(&zram_control_class);
+		zram_dedup_cache_destroy();
 		return -EBUSY;
 	}
 
@@ -2097,12 +3167,14 @@ static int __init zram_init(void)
 
 out_error:
 	destroy_devices();
+	zram_dedup_cache_destroy();
 	return ret;
 }
 
 static void __exit zram_exit(void)
 {
 	destroy_devices();
+	zram_dedup_cache_destroy();
 }
 
 module_init(zram_init);
@@ -18,6 +18,7 @@
 #include <linux/rwsem.h>
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
+#include <linux/xarray.h>
 
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
@@ -26,6 +27,18 @@
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
 
+/* max pages in a writeback bio */
+#define ZRAM_WB_BATCH		32
+/* max decompressed pages kept by backing device readahead */
+#define ZRAM_RA_CACHE_PAGES	(8 * ZRAM_WB_BATCH)
+/* default number of writeback bios in flight */
+#define ZRAM_WB_DEPTH		8
+#define ZRAM_WB_DEPTH_MAX	64
+/*
+ * writeback latency buckets: <1ms, <2ms, <4ms, ... <64ms, >=64ms
+ */
+#define ZRAM_WB_LAT_BUCKETS	8
+
 
 /*
  * ZRAM is mainly used for memory efficiency so we want to keep memory
@@ -47,10 +60,20 @@ enum zram_pageflags {
 	ZRAM_UNDER_WB,	/* page is under writeback */
 	ZRAM_HUGE,	/* Incompressible page */
 	ZRAM_IDLE,	/* not accessed page since last idle marking */
+	ZRAM_ALT_COMP,	/* compressed by the alternate path of the zcomp */
+	ZRAM_RECOMP,	/* compressed by the secondary algorithm (recomp) */
+	ZRAM_DEDUP,	/* object is shared by refcount, see zram_dedup.c */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/*
+ * The bits above zram_pageflags hold a generation of the slot, which is
+ * bumped by zram_slot_unlock. Lockless readers compare the flags before
+ * and after reading the slot to see whether it was changed.
+ */
+#define ZRAM_GEN_SHIFT	__NR_ZRAM_PAGEFLAGS
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
@@ -63,6 +86,9 @@ struct zram_table_entry {
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	ktime_t ac_time;
 #endif
+#ifdef CONFIG_ZRAM_MEMCG
+	unsigned short memcg_id;	/* memcg the slot is charged to */
+#endif
 };
 
 enum zram_stat_item {
@@ -79,10 +105,16 @@ enum zram_stat_item {
 	NR_PAGE_STORED,		/* no. of pages currently stored */
 	NR_WRITESTALL,		/* no. of write slow paths */
 	NR_MISS_FREE,		/* no. of missed free */
+	NR_DEDUP_HIT,		/* no. of writes deduplicated */
+	DEDUP_SAVED_SIZE,	/* compressed bytes saved by dedup */
 #ifdef	CONFIG_ZRAM_WRITEBACK
 	NR_BD_COUNT,		/* no. of pages in backing device */
 	NR_BD_READ,		/* no. of reads from backing device */
 	NR_BD_WRITE,		/* no. of writes from backing device */
+	NR_BD_WB_LAT,		/* writeback bio latency histogram */
+	NR_BD_WB_LAT_LAST = NR_BD_WB_LAT + ZRAM_WB_LAT_BUCKETS - 1,
+	NR_BD_RA,		/* no. of pages cached by readahead */
+	NR_BD_RA_HIT,		/* no. of reads served by readahead */
 #endif
 	NR_ZRAM_STAT_ITEM,
 };
@@ -95,6 +127,8 @@ struct zram {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
 	struct zcomp *comp;
+	/* secondary zcomp used by recompress, NULL if not configured */
+	struct zcomp *recomp;
 	struct gendisk *disk;
 	/* Prevent concurrent execution of device init */
 	struct rw_semaphore init_lock;
@@ -112,15 +146,31 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 	char compressor[CRYPTO_MAX_ALG_NAME];
+	char recomp_algorithm[CRYPTO_MAX_ALG_NAME];
 	/*
 	 * zram is claimed so open request will be failed
 	 */
 	bool claim; /* Protected by disk->open_mutex */
+#ifdef CONFIG_ZRAM_DEDUP
+	bool use_dedup;
+	struct zram_dedup *dedup;
+#endif
+#ifdef CONFIG_ZRAM_MEMCG
+	struct xarray memcgs;	/* memcg id -> struct zram_memcg */
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 	struct file *backing_dev;
 	spinlock_t wb_limit_lock;
 	bool wb_limit_enable;
 	u64 bd_wb_limit;
+	unsigned int wb_depth;	/* max writeback bios in flight */
+	/* backing device readahead, ra_pages 0 means disabled */
+	unsigned int ra_pages;
+	atomic_t ra_inflight;
+	spinlock_t ra_lock;
+	struct xarray ra_cache;	/* slot index -> page read ahead */
+	struct list_head ra_lru;
+	unsigned int ra_count;
 	struct block_device *bdev;
 	unsigned long *bitmap;
 	unsigned long nr_pages;
@@ -134,7 +184,10 @@ struct zram {
 void zram_slot_lock(struct zram *zram, u32 index);
 void zram_slot_unlock(struct zram *zram, u32 index);
 void zram_slot_update(struct zram *zram, u32 index, unsigned long handle,
-			unsigned int comp_len);
+			unsigned int comp_len, unsigned long flags,
+			struct page *page);
+int zram_slot_recompressed(struct zram *zram, u32 index, unsigned long handle,
+			unsigned int comp_len, bool idle);
 
 unsigned long zram_get_handle(struct zram *zram, u32 index);
 size_t zram_get_obj_size(struct zram *zram, u32 index);
@@ -145,4 +198,76 @@ struct bio;
 void zram_bio_endio(struct zram *zram, struct bio *bio, bool is_write, int err);
 void zram_page_write_endio(struct zram *zram, struct page *page, int err);
 unsigned long zram_stat_read(struct zram *zram, enum zram_stat_item item);
+
+#ifdef CONFIG_ZRAM_DEDUP
+static inline bool zram_dedup_enabled(struct zram *zram)
+{
+	return zram->dedup;
+}
+
+unsigned long zram_dedup_get(struct zram *zram, void *mem, unsigned int len,
+			     unsigned long flags, u32 *checksum);
+bool zram_dedup_insert(struct zram *zram, unsigned long handle, u32 checksum,
+		       unsigned int len, unsigned long flags);
+bool zram_dedup_put(struct zram *zram, unsigned long handle);
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+int zram_dedup_cache_init(void);
+void zram_dedup_cache_destroy(void);
+#else
+static inline bool zram_dedup_enabled(struct zram *zram) { return false; }
+static inline unsigned long zram_dedup_get(struct zram *zram, void *mem,
+		unsigned int len, unsigned long flags, u32 *checksum)
+{
+	return 0;
+}
+static inline bool zram_dedup_insert(struct zram *zram, unsigned long handle,
+		u32 checksum, unsigned int len, unsigned long flags)
+{
+	return false;
+}
+static inline bool zram_dedup_put(struct zram *zram, unsigned long handle)
+{
+	return true;
+}
+static inline int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	return 0;
+}
+static inline void zram_dedup_fini(struct zram *zram) {}
+static inline int zram_dedup_cache_init(void) { return 0; }
+static inline void zram_dedup_cache_destroy(void) {}
+#endif
+
+#ifdef CONFIG_ZRAM_MEMCG
+unsigned short zram_memcg_get(struct zram *zram, struct page *page);
+void zram_memcg_charge(struct zram *zram, u32 index, unsigned short id);
+unsigned short zram_memcg_uncharge(struct zram *zram, u32 index);
+void zram_memcg_writeback(struct zram *zram, unsigned short id);
+bool zram_memcg_over_limit(struct zram *zram, struct page *page);
+ssize_t zram_memcg_stat_show(struct zram *zram, char *buf);
+int zram_memcg_set_limit(struct zram *zram, u64 ino, unsigned long limit);
+void zram_memcg_init(struct zram *zram);
+void zram_memcg_fini(struct zram *zram);
+#else
+static inline unsigned short zram_memcg_get(struct zram *zram,
+					    struct page *page)
+{
+	return 0;
+}
+static inline void zram_memcg_charge(struct zram *zram, u32 index,
+				     unsigned short id) {}
+static inline unsigned short zram_memcg_uncharge(struct zram *zram, u32 index)
+{
+	return 0;
+}
+static inline void zram_memcg_writeback(struct zram *zram,
+					unsigned short id) {}
+static inline bool zram_memcg_over_limit(struct zram *zram, struct page *page)
+{
+	return false;
+}
+static inline void zram_memcg_init(struct zram *zram) {}
+static inline void zram_memcg_fini(struct zram *zram) {}
+#endif
 #endif
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Per-memcg accounting of zram
+ *
+ * Every slot remembers the memcg id of the page stored in it and the
+ * pages, compressed bytes and writebacks are accounted to the memcg so
+ * that userspace can see the compressed footprint of each cgroup and
+ * cap it.
+ *
+ * Memcg ids are recycled once a cgroup is gone so the slots left by a
+ * dead cgroup are accounted to the next cgroup having the same id. The
+ * entry is then handed over to the new cgroup, see zram_memcg_refresh.
+ */
+
+#include <linux/kernel.h>
+#include <linux/memcontrol.h>
+#include <linux/slab.h>
+#include <linux/xarray.h>
+
+#include "zram_drv.h"
+
+struct zram_memcg {
+	unsigned short id;
+	/* cgroup inode number reported to userspace */
+	u64 ino;
+	atomic_long_t nr_pages;
+	atomic_long_t compr_size;
+	atomic_long_t nr_wb;
+	/* compressed bytes the memcg can store, 0 means no limit */
+	unsigned long limit;
+};
+
+static struct zram_memcg *zram_memcg_lookup(struct zram *zram,
+					    unsigned short id)
+{
+	return id ? xa_load(&zram->memcgs, id) : NULL;
+}
+
+/*
+ * The entry found by the id may be left by a dead cgroup. Report it as
+ * @memcg from now on and drop the limit set for the dead one.
+ */
+static void zram_memcg_refresh(struct zram_memcg *zmemcg,
+			       struct mem_cgroup *memcg)
+{
+	u64 ino = cgroup_ino(memcg->css.cgroup);
+
+	if (READ_ONCE(zmemcg->ino) == ino)
+		return;
+
+	WRITE_ONCE(zmemcg->limit, 0);
+	WRITE_ONCE(zmemcg->ino, ino);
+}
+
+/*
+ * Returns the id of @page's memcg for zram_memcg_charge, or 0 if the
+ * page isn't charged to any memcg or the memcg can't be tracked.
+ */
+unsigned short zram_memcg_get(struct zram *zram, struct page *page)
+{
+	struct mem_cgroup *memcg;
+	struct zram_memcg *zmemcg;
+	unsigned short id;
+	void *old;
+
+	if (!page || mem_cgroup_disabled())
+		return 0;
+
+	rcu_read_lock();
+	memcg = page_memcg(page);
+	if (!memcg) {
+		rcu_read_unlock();
+		return 0;
+	}
+	id = mem_cgroup_id(memcg);
+	zmemcg = xa_load(&zram->memcgs, id);
+	if (zmemcg) {
+		zram_memcg_refresh(zmemcg, memcg);
+		rcu_read_unlock();
+		return id;
+	}
+
+	zmemcg = kzalloc(sizeof(*zmemcg), GFP_NOWAIT | __GFP_NOWARN);
+	if (!zmemcg) {
+		rcu_read_unlock();
+		return 0;
+	}
+	zmemcg->id = id;
+	zmemcg->ino = cgroup_ino(memcg->css.cgroup);
+	rcu_read_unlock();
+
+	old = xa_cmpxchg(&zram->memcgs, id, NULL, zmemcg,
+			 GFP_NOWAIT | __GFP_NOWARN);
+	if (old) {
+		kfree(zmemcg);
+		return xa_is_err(old) ? 0 : id;
+	}
+
+	return id;
+}
+
+/* Called under the slot lock of @index */
+void zram_memcg_charge(struct zram *zram, u32 index, unsigned short id)
+{
+	struct zram_memcg *zmemcg = zram_memcg_lookup(zram, id);
+
+	if (!zmemcg)
+		return;
+
+	zram->table[index].memcg_id = id;
+	atomic_long_inc(&zmemcg->nr_pages);
+	atomic_long_add(zram_get_obj_size(zram, index), &zmemcg->compr_size);
+}
+
+/*
+ * Called under the slot lock of @index before the slot is freed. Returns
+ * the memcg id the slot was charged to.
+ */
+unsigned short zram_memcg_uncharge(struct zram *zram, u32 index)
+{
+	unsigned short id = zram->table[index].memcg_id;
+	struct zram_memcg *zmemcg = zram_memcg_lookup(zram, id);
+
+	if (!zmemcg)
+		return 0;
+
+	zram->table[index].memcg_id = 0;
+	atomic_long_dec(&zmemcg->nr_pages);
+	atomic_long_sub(zram_get_obj_size(zram, index), &zmemcg->compr_size);
+
+	return id;
+}
+
+void zram_memcg_writeback(struct zram *zram, unsigned short id)
+{
+	struct zram_memcg *zmemcg = zram_memcg_lookup(zram, id);
+
+	if (zmemcg)
+		atomic_long_inc(&zmemcg->nr_wb);
+}
+
+/* Returns true if the memcg of @page reached its compressed size limit */
+bool zram_memcg_over_limit(struct zram *zram, struct page *page)
+{
+	struct zram_memcg *zmemcg;
+	struct mem_cgroup *memcg;
+	bool ret = false;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	rcu_read_lock();
+	memcg = page_memcg(page);
+	if (memcg) {
+		zmemcg = xa_load(&zram->memcgs, mem_cgroup_id(memcg));
+		if (zmemcg)
+			zram_memcg_refresh(zmemcg, memcg);
+		ret = zmemcg && READ_ONCE(zmemcg->limit) &&
+		      atomic_long_read(&zmemcg->compr_size) >=
+				READ_ONCE(zmemcg->limit);
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+ssize_t zram_memcg_stat_show(struct zram *zram, char *buf)
+{
+	struct zram_memcg *zmemcg;
+	unsigned long id;
+	ssize_t ret = 0;
+
+	xa_for_each(&zram->memcgs, id, zmemcg) {
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+				 "%8llu %8ld %8ld %8ld %8lu\n",
+				 READ_ONCE(zmemcg->ino),
+				 atomic_long_read(&zmemcg->nr_pages),
+				 atomic_long_read(&zmemcg->compr_size),
+				 atomic_long_read(&zmemcg->nr_wb),
+				 READ_ONCE(zmemcg->limit));
+	}
+
+	return ret;
+}
+
+/*
+ * Set the compressed size limit of the cgroup whose inode number is @ino.
+ * Only cgroups which have stored pages in zram, i.e. shown in memcg_stat,
+ * can be limited.
+ */
+int zram_memcg_set_limit(struct zram *zram, u64 ino, unsigned long limit)
+{
+	struct zram_memcg *zmemcg;
+	unsigned long id;
+
+	xa_for_each(&zram->memcgs, id, zmemcg) {
+		if (READ_ONCE(zmemcg->ino) == ino) {
+			WRITE_ONCE(zmemcg->limit, limit);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void zram_memcg_init(struct zram *zram)
+{
+	xa_init(&zram->memcgs);
+}
+
+/* Called after every slot was freed */
+void zram_memcg_fini(struct zram *zram)
+{
+	struct zram_memcg *zmemcg;
+	unsigned long id;
+
+	xa_for_each(&zram->memcgs, id, zmemcg)
+		kfree(zmemcg);
+	xa_destroy(&zram->memcgs);
+}
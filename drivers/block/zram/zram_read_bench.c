@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Microbenchmark of parallel zram reads
+ *
+ * Writing the maximum number of CPUs into the run parameter fills the
+ * first nr_pages pages of the device and reads random pages of them on
+ * 1, 2, ... up to that many online CPUs for duration_ms each. The
+ * throughput per CPU count is printed to the kernel log.
+ *
+ * E.g.,
+ * echo 8 > /sys/module/zram_read_bench/parameters/run
+ *
+ * The benchmark overwrites the device, so it must be a dedicated zram
+ * device that is initialized but not used as swap. Reads take the
+ * lockless path only if the slots are not idle and
+ * CONFIG_ZRAM_MEMORY_TRACKING is disabled.
+ */
+
+#define pr_fmt(fmt) "zram_read_bench: " fmt
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/cpumask.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/prandom.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+static char *dev_path = "/dev/zram0";
+module_param_named(dev, dev_path, charp, 0644);
+MODULE_PARM_DESC(dev, "zram device to benchmark, overwritten by the run");
+
+static unsigned int nr_pages = 4096;
+module_param(nr_pages, uint, 0644);
+MODULE_PARM_DESC(nr_pages, "number of pages to fill and read");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0644);
+MODULE_PARM_DESC(duration_ms, "read duration per CPU count");
+
+struct zram_bench_work {
+	struct work_struct work;
+	struct block_device *bdev;
+	unsigned int nr_pages;
+	ktime_t deadline;
+	u64 seed;
+	unsigned long ops;
+	int err;
+};
+
+static struct workqueue_struct *bench_wq;
+
+static int zram_bench_rw(struct block_device *bdev, struct page *page,
+			 unsigned int index, blk_opf_t opf)
+{
+	struct bio_vec bvec;
+	struct bio bio;
+
+	bio_init(&bio, bdev, &bvec, 1, opf);
+	bio.bi_iter.bi_sector = (sector_t)index << (PAGE_SHIFT - SECTOR_SHIFT);
+	__bio_add_page(&bio, page, PAGE_SIZE, 0);
+
+	return submit_bio_wait(&bio);
+}
+
+/*
+ * Fill the page with words that compress well but aren't same-filled, so
+ * that reads go through the decompression path.
+ */
+static int zram_bench_fill(struct block_device *bdev, unsigned int nr)
+{
+	struct page *page;
+	unsigned int index;
+	int err = 0;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < nr; index++) {
+		u32 *words = kmap_local_page(page);
+		int i;
+
+		for (i = 0; i < PAGE_SIZE / sizeof(*words); i++)
+			words[i] = index + i % 64;
+		kunmap_local(words);
+
+		err = zram_bench_rw(bdev, page, index, REQ_OP_WRITE);
+		if (err)
+			break;
+	}
+
+	__free_page(page);
+	return err;
+}
+
+static void zram_bench_read_work(struct work_struct *work)
+{
+	struct zram_bench_work *bw = container_of(work, typeof(*bw), work);
+	struct rnd_state rnd;
+	struct page *page;
+
+	prandom_seed_state(&rnd, bw->seed);
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		bw->err = -ENOMEM;
+		return;
+	}
+
+	while (ktime_before(ktime_get(), bw->deadline)) {
+		bw->err = zram_bench_rw(bw->bdev, page,
+					prandom_u32_state(&rnd) % bw->nr_pages,
+					REQ_OP_READ);
+		if (bw->err)
+			break;
+		bw->ops++;
+	}
+
+	__free_page(page);
+}
+
+static int zram_bench_run(unsigned int max_cpus)
+{
+	struct zram_bench_work *works;
+	struct block_device *bdev;
+	unsigned int nr = nr_pages;
+	unsigned int nr_cpus, i;
+	int cpu, err;
+
+	max_cpus = min(max_cpus, num_online_cpus());
+	if (!max_cpus || !nr)
+		return -EINVAL;
+
+	works = kcalloc(max_cpus, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(dev_path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  works);
+	if (IS_ERR(bdev)) {
+		err = PTR_ERR(bdev);
+		pr_err("cannot open %s: %d\n", dev_path, err);
+		goto out_free;
+	}
+
+	nr = min_t(u64, nr, bdev_nr_bytes(bdev) >> PAGE_SHIFT);
+	err = zram_bench_fill(bdev, nr);
+	if (err) {
+		pr_err("cannot fill %s: %d\n", dev_path, err);
+		goto out_put;
+	}
+
+	for (nr_cpus = 1; nr_cpus <= max_cpus; nr_cpus++) {
+		ktime_t deadline = ktime_add_ms(ktime_get(), duration_ms);
+		unsigned long ops = 0;
+
+		cpus_read_lock();
+		i = 0;
+		for_each_online_cpu(cpu) {
+			struct zram_bench_work *bw = &works[i];
+
+			if (i == nr_cpus)
+				break;
+			INIT_WORK(&bw->work, zram_bench_read_work);
+			bw->bdev = bdev;
+			bw->nr_pages = nr;
+			bw->deadline = deadline;
+			bw->seed = cpu;
+			bw->ops = 0;
+			bw->err = 0;
+			queue_work_on(cpu, bench_wq, &bw->work);
+			i++;
+		}
+		cpus_read_unlock();
+
+		for (i = 0; i < nr_cpus; i++) {
+			flush_work(&works[i].work);
+			if (works[i].err)
+				err = works[i].err;
+			ops += works[i].ops;
+		}
+		if (err) {
+			pr_err("read failed on %u cpus: %d\n", nr_cpus, err);
+			break;
+		}
+
+		pr_info("cpus=%u reads=%lu reads/s=%llu\n", nr_cpus, ops,
+			div_u64((u64)ops * MSEC_PER_SEC, max(duration_ms, 1U)));
+	}
+
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_free:
+	kfree(works);
+	return err;
+}
+
+static int zram_bench_run_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int max_cpus;
+	int err;
+
+	/* not as a load time parameter */
+	if (!bench_wq)
+		return -EBUSY;
+
+	err = kstrtouint(val, 0, &max_cpus);
+	if (err)
+		return err;
+
+	return zram_bench_run(max_cpus);
+}
+
+static const struct kernel_param_ops zram_bench_run_ops = {
+	.set = zram_bench_run_set,
+};
+
+/* Runs serialize on the module's parameter lock */
+module_param_cb(run, &zram_bench_run_ops, NULL, 0200);
+MODULE_PARM_DESC(run, "run the benchmark on up to this many CPUs");
+
+static int __init zram_read_bench_init(void)
+{
+	bench_wq = alloc_workqueue("zram_read_bench",
+				   WQ_HIGHPRI | WQ_CPU_INTENSIVE, 0);
+	if (!bench_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void __exit zram_read_bench_exit(void)
+{
+	destroy_workqueue(bench_wq);
+}
+
+module_init(zram_read_bench_init);
+module_exit(zram_read_bench_exit);
+
+MODULE_DESCRIPTION("Microbenchmark of parallel zram reads");
+MODULE_LICENSE("GPL v2");
@@ -11,22 +11,50 @@
 #include <linux/dma-buf.h>
 #include <linux/dma-heap.h>
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/highmem.h>
+#include <linux/kthread.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of.h>
 #include <linux/of_reserved_mem.h>
 #include <linux/platform_device.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/sort.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "samsung-dma-heap.h"
+#include "dmabuf_heap_trace.h"
 
 #define GFP_CHUNK_HEAP_NORETRY_NOWARN (__GFP_NORETRY | __GFP_NOWARN)
 
+#define CHUNK_HEAP_RESERVE_TIMEOUT_MS	10000
+
+/*
+ * The chunks can be reserved in advance through the reserve_chunks sysfs
+ * attribute of the heap device, e.g. before the secure video playback starts,
+ * so that the following allocations don't wait for CMA to migrate the pages.
+ * The reserve thread allocates the chunks in the background and keeps them
+ * until reserve_timeout_ms passes since the last hint. The chunks taken by
+ * allocations are not refilled, otherwise the reserve would pin as many
+ * chunks again on top of the allocated ones.
+ */
 struct chunk_heap {
 	struct cma *cma;
+	unsigned int chunk_order;
+
+	struct mutex reserve_lock;
+	struct page **reserved;
+	unsigned int nr_reserved;
+	unsigned int reserve_target;
+	unsigned int reserve_max;
+	unsigned int reserve_timeout_ms;
+	struct task_struct *reserve_task;
+	wait_queue_head_t reserve_wait;
+	struct delayed_work reserve_release_work;
 };
 
 static int chunk_pages_compare(const void *p1, const void *p2)
@@ -91,6 +119,211 @@ static int chunk_heap_buffer_allocate(struct cma *cma, unsigned int need_count,
 	return 0;
 }
 
+static void chunk_heap_release_chunks(struct chunk_heap *chunk_heap, struct page **pages,
+				      unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		cma_release(chunk_heap->cma, pages[i], 1 << chunk_heap->chunk_order);
+		dma_heap_dec_inuse(1 << chunk_heap->chunk_order);
+	}
+}
+
+/*
+ * Take up to @nr chunks from the reserve. Returns the number of chunks taken.
+ * The hint is consumed by the chunks taken.
+ */
+static unsigned int chunk_heap_reserve_take(struct chunk_heap *chunk_heap, struct page **pages,
+					    unsigned int nr)
+{
+	unsigned int taken;
+
+	mutex_lock(&chunk_heap->reserve_lock);
+	taken = min(nr, chunk_heap->nr_reserved);
+	chunk_heap->nr_reserved -= taken;
+	chunk_heap->reserve_target -= min(taken, chunk_heap->reserve_target);
+	memcpy(pages, &chunk_heap->reserved[chunk_heap->nr_reserved], taken * sizeof(*pages));
+	mutex_unlock(&chunk_heap->reserve_lock);
+
+	return taken;
+}
+
+static bool chunk_heap_reserve_short(struct chunk_heap *chunk_heap)
+{
+	return READ_ONCE(chunk_heap->nr_reserved) < READ_ONCE(chunk_heap->reserve_target);
+}
+
+static void chunk_heap_reserve_fill(struct chunk_heap *chunk_heap)
+{
+	unsigned int alloc_order = max_t(unsigned int, pageblock_order, chunk_heap->chunk_order);
+	unsigned int nr_per_alloc = 1 << (alloc_order - chunk_heap->chunk_order);
+	unsigned int nr, keep;
+	struct page **pages;
+	ktime_t start;
+	int ret;
+
+	pages = kmalloc_array(nr_per_alloc, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return;
+
+	while (!kthread_should_stop() && chunk_heap_reserve_short(chunk_heap)) {
+		mutex_lock(&chunk_heap->reserve_lock);
+		nr = chunk_heap->reserve_target - min(chunk_heap->nr_reserved,
+						      chunk_heap->reserve_target);
+		mutex_unlock(&chunk_heap->reserve_lock);
+
+		nr = min(nr, nr_per_alloc);
+		if (!nr)
+			break;
+
+		start = ktime_get();
+		ret = chunk_heap_buffer_allocate(chunk_heap->cma, nr, pages, chunk_heap->chunk_order);
+		trace_dma_heap_chunk_reserve(PAGE_SIZE << chunk_heap->chunk_order, nr,
+					     ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+
+		mutex_lock(&chunk_heap->reserve_lock);
+		if (ret) {
+			/* give up the hint rather than retrying on the busy CMA */
+			chunk_heap->reserve_target = chunk_heap->nr_reserved;
+			mutex_unlock(&chunk_heap->reserve_lock);
+			break;
+		}
+
+		keep = min(nr, chunk_heap->reserve_target -
+			   min(chunk_heap->nr_reserved, chunk_heap->reserve_target));
+		memcpy(&chunk_heap->reserved[chunk_heap->nr_reserved], pages, keep * sizeof(*pages));
+		chunk_heap->nr_reserved += keep;
+		mutex_unlock(&chunk_heap->reserve_lock);
+
+		/* the hint is lowered or expired while allocating */
+		chunk_heap_release_chunks(chunk_heap, pages + keep, nr - keep);
+	}
+
+	kfree(pages);
+}
+
+static int chunk_heap_reserve_thread(void *data)
+{
+	struct chunk_heap *chunk_heap = data;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(chunk_heap->reserve_wait,
+				     chunk_heap_reserve_short(chunk_heap) ||
+				     kthread_should_stop());
+
+		chunk_heap_reserve_fill(chunk_heap);
+	}
+
+	return 0;
+}
+
+static void chunk_heap_reserve_release(struct work_struct *work)
+{
+	struct chunk_heap *chunk_heap = container_of(to_delayed_work(work), struct chunk_heap,
+						     reserve_release_work);
+
+	mutex_lock(&chunk_heap->reserve_lock);
+	chunk_heap->reserve_target = 0;
+	chunk_heap_release_chunks(chunk_heap, chunk_heap->reserved, chunk_heap->nr_reserved);
+	chunk_heap->nr_reserved = 0;
+	mutex_unlock(&chunk_heap->reserve_lock);
+}
+
+/* Stop the reserve and return the chunks it holds to CMA on unbind */
+static void chunk_heap_reserve_destroy(void *data)
+{
+	struct chunk_heap *chunk_heap = data;
+
+	kthread_stop(chunk_heap->reserve_task);
+	cancel_delayed_work_sync(&chunk_heap->reserve_release_work);
+	chunk_heap_reserve_release(&chunk_heap->reserve_release_work.work);
+	kvfree(chunk_heap->reserved);
+}
+
+static ssize_t reserve_chunks_show(struct device *dev, struct device_attribute *attr,
+				   char *buf)
+{
+	struct chunk_heap *chunk_heap = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u %u\n", READ_ONCE(chunk_heap->nr_reserved),
+			  READ_ONCE(chunk_heap->reserve_target));
+}
+
+static ssize_t reserve_chunks_store(struct device *dev, struct device_attribute *attr,
+				    const char *buf, size_t len)
+{
+	struct chunk_heap *chunk_heap = dev_get_drvdata(dev);
+	unsigned int target;
+
+	if (kstrtouint(buf, 0, &target))
+		return -EINVAL;
+
+	if (target > chunk_heap->reserve_max)
+		return -EINVAL;
+
+	mutex_lock(&chunk_heap->reserve_lock);
+	if (target && !chunk_heap->reserved) {
+		chunk_heap->reserved = kvcalloc(chunk_heap->reserve_max,
+						sizeof(*chunk_heap->reserved), GFP_KERNEL);
+		if (!chunk_heap->reserved) {
+			mutex_unlock(&chunk_heap->reserve_lock);
+			return -ENOMEM;
+		}
+	}
+	chunk_heap->reserve_target = target;
+	if (chunk_heap->nr_reserved > target) {
+		chunk_heap_release_chunks(chunk_heap, &chunk_heap->reserved[target],
+					  chunk_heap->nr_reserved - target);
+		chunk_heap->nr_reserved = target;
+	}
+	mutex_unlock(&chunk_heap->reserve_lock);
+
+	if (target) {
+		mod_delayed_work(system_wq, &chunk_heap->reserve_release_work,
+				 msecs_to_jiffies(READ_ONCE(chunk_heap->reserve_timeout_ms)));
+		wake_up(&chunk_heap->reserve_wait);
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RW(reserve_chunks);
+
+static ssize_t reserve_timeout_ms_show(struct device *dev, struct device_attribute *attr,
+				       char *buf)
+{
+	struct chunk_heap *chunk_heap = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(chunk_heap->reserve_timeout_ms));
+}
+
+static ssize_t reserve_timeout_ms_store(struct device *dev, struct device_attribute *attr,
+					const char *buf, size_t len)
+{
+	struct chunk_heap *chunk_heap = dev_get_drvdata(dev);
+	unsigned int timeout;
+
+	if (kstrtouint(buf, 0, &timeout))
+		return -EINVAL;
+
+	WRITE_ONCE(chunk_heap->reserve_timeout_ms, timeout);
+
+	return len;
+}
+static DEVICE_ATTR_RW(reserve_timeout_ms);
+
+static struct attribute *chunk_heap_attrs[] = {
+	&dev_attr_reserve_chunks.attr,
+	&dev_attr_reserve_timeout_ms.attr,
+	NULL,
+};
+
+static const struct attribute_group chunk_heap_attr_group = {
+	.attrs = chunk_heap_attrs,
+};
+
 static void *chunk_heap_protect(struct samsung_dma_buffer *buffer,
 				unsigned int chunk_size, struct page **pages,
 				unsigned long nr_pages)
@@ -151,7 +384,7 @@ static struct dma_buf *chunk_heap_allocate(struct dma_heap *heap, unsigned long
 	struct scatterlist *sg;
 	struct dma_buf *dmabuf;
 	struct page **pages;
-	unsigned long size, nr_chunks;
+	unsigned long size, nr_chunks, nr_taken;
 	unsigned int chunk_order = get_order(samsung_dma_heap->alignment);
 	unsigned int chunk_size = PAGE_SIZE << chunk_order;
 	int ret = -ENOMEM, protret = 0;
@@ -164,9 +397,17 @@ static struct dma_buf *chunk_heap_allocate(struct dma_heap *heap, unsigned long
 	if (!pages)
 		return ERR_PTR(-ENOMEM);
 
-	ret = chunk_heap_buffer_allocate(chunk_heap->cma, nr_chunks, pages, chunk_order);
-	if (ret)
-		goto err_alloc;
+	nr_taken = chunk_heap_reserve_take(chunk_heap, pages, nr_chunks);
+	if (nr_taken < nr_chunks) {
+		ret = chunk_heap_buffer_allocate(chunk_heap->cma, nr_chunks - nr_taken,
+						 pages + nr_taken, chunk_order);
+		if (ret) {
+			chunk_heap_release_chunks(chunk_heap, pages, nr_taken);
+			goto err_alloc;
+		}
+	}
+	if (nr_taken)
+		sort(pages, nr_chunks, sizeof(*pages), chunk_pages_compare, NULL);
 
 	buffer = samsung_dma_buffer_alloc(samsung_dma_heap, size, nr_chunks);
 	if (IS_ERR(buffer)) {
@@ -206,12 +447,8 @@ err_export:
 err_prot:
 	samsung_dma_buffer_free(buffer);
 err_buffer:
-	if (!protret) {
-		for (pg = 0; pg < nr_chunks; pg++) {
-			cma_release(chunk_heap->cma, pages[pg], 1 << chunk_order);
-			dma_heap_dec_inuse(1 << chunk_order);
-		}
-	}
+	if (!protret)
+		chunk_heap_release_chunks(chunk_heap, pages, nr_chunks);
 err_alloc:
 	kvfree(pages);
 	return ERR_PTR(ret);
@@ -252,6 +489,7 @@ static const struct dma_heap_ops chunk_heap_ops = {
 static int chunk_heap_probe(struct platform_device *pdev)
 {
 	struct chunk_heap *chunk_heap;
+	unsigned int alignment = PAGE_SIZE;
 	int ret;
 
 	ret = of_reserved_mem_device_init(&pdev->dev);
@@ -271,12 +509,47 @@ static int chunk_heap_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	chunk_heap->cma = pdev->dev.cma_area;
 
+	/* the same chunk size as samsung_heap_add() */
+	of_property_read_u32(pdev->dev.of_node, "dma-heap,alignment", &alignment);
+	chunk_heap->chunk_order = min_t(unsigned int, get_order(alignment), MAX_ORDER);
+
+	/* the allocation takes the reserve as soon as the heap is added */
+	chunk_heap->reserve_max = cma_get_size(chunk_heap->cma) >>
+				  (PAGE_SHIFT + chunk_heap->chunk_order);
+	chunk_heap->reserve_timeout_ms = CHUNK_HEAP_RESERVE_TIMEOUT_MS;
+	mutex_init(&chunk_heap->reserve_lock);
+	init_waitqueue_head(&chunk_heap->reserve_wait);
+	INIT_DELAYED_WORK(&chunk_heap->reserve_release_work, chunk_heap_reserve_release);
+	platform_set_drvdata(pdev, chunk_heap);
+
 	ret = samsung_heap_add(&pdev->dev, chunk_heap, chunk_heap_release, &chunk_heap_ops);
 
 	if (ret == -ENODEV)
 		return 0;
 
-	return ret;
+	if (ret)
+		return ret;
+
+	/* the heap works without the reserve */
+	chunk_heap->reserve_task = kthread_run(chunk_heap_reserve_thread, chunk_heap,
+					       "chunk_heap_reserve");
+	if (IS_ERR(chunk_heap->reserve_task)) {
+		dev_err(&pdev->dev, "failed to create the reserve thread\n");
+		chunk_heap->reserve_task = NULL;
+		return 0;
+	}
+
+	/* added before the sysfs group so the group is gone by the time it runs */
+	ret = devm_add_action_or_reset(&pdev->dev, chunk_heap_reserve_destroy, chunk_heap);
+	if (ret) {
+		dev_err(&pdev->dev, "failed to add the reserve teardown\n");
+		return 0;
+	}
+
+	if (devm_device_add_group(&pdev->dev, &chunk_heap_attr_group))
+		dev_err(&pdev->dev, "failed to create the reserve sysfs\n");
+
+	return 0;
 }
 
 static const struct of_device_id chunk_heap_of_match[] = {
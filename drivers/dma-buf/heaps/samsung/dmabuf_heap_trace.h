@@ -33,6 +33,55 @@ TRACE_EVENT(dma_heap_stat,
 		      __entry->total_allocated)
 );
 
+TRACE_EVENT(dma_heap_system_alloc,
+	    TP_PROTO(unsigned long len, unsigned int nents, u64 alloc_ns,
+		     u64 flush_ns, u64 export_ns),
+	    TP_ARGS(len, nents, alloc_ns, flush_ns, export_ns),
+	    TP_STRUCT__entry(
+		__field(unsigned long, len)
+		__field(unsigned int, nents)
+		__field(u64, alloc_ns)
+		__field(u64, flush_ns)
+		__field(u64, export_ns)
+	    ),
+	    TP_fast_assign(
+		__entry->len = len;
+		__entry->nents = nents;
+		__entry->alloc_ns = alloc_ns;
+		__entry->flush_ns = flush_ns;
+		__entry->export_ns = export_ns;
+	    ),
+	    TP_printk("len=%luB nents=%u alloc=%lluns flush=%lluns export=%lluns",
+		      __entry->len,
+		      __entry->nents,
+		      __entry->alloc_ns,
+		      __entry->flush_ns,
+		      __entry->export_ns)
+);
+
+TRACE_EVENT(dma_heap_chunk_reserve,
+	    TP_PROTO(unsigned long chunk_size, unsigned int nr_chunks, u64 migrate_ns, int ret),
+	    TP_ARGS(chunk_size, nr_chunks, migrate_ns, ret),
+	    TP_STRUCT__entry(
+		__field(unsigned long, chunk_size)
+		__field(unsigned int, nr_chunks)
+		__field(u64, migrate_ns)
+		__field(int, ret)
+	    ),
+	    TP_fast_assign(
+		__entry->chunk_size = chunk_size;
+		__entry->nr_chunks = nr_chunks;
+		__entry->migrate_ns = migrate_ns;
+		__entry->ret = ret;
+	    ),
+	    TP_printk("chunk_size=%luB nr_chunks=%u migrate=%lluns per_chunk=%lluns ret=%d",
+		      __entry->chunk_size,
+		      __entry->nr_chunks,
+		      __entry->migrate_ns,
+		      __entry->nr_chunks ? __entry->migrate_ns / __entry->nr_chunks : 0,
+		      __entry->ret)
+);
+
 #endif /* _DMABUF_HEAP_TRACE_H */
 
 /* This part must be outside protection */
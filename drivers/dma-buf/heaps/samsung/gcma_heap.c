@@ -61,19 +61,32 @@ static inline bool page_is_gcma(struct page *page)
 	return page_private(page) ? true : false;
 }
 
-struct page *gcma_alloc(struct gcma_heap *gcma_heap, unsigned long size)
+/* Gives the range reserved for the next fixed allocation back to the pool */
+static bool gcma_release_ahead(struct gcma_heap *gcma_heap)
 {
-	struct gen_pool *pool = gcma_heap->pool;
 	phys_addr_t paddr;
-	unsigned long pfn;
-	struct page *page = NULL;
+	unsigned long size;
 
-	paddr = gen_pool_alloc(pool, size);
-	if (!paddr)
-		return NULL;
+	spin_lock(&gcma_heap->ahead_lock);
+	paddr = gcma_heap->ahead_paddr;
+	size = gcma_heap->ahead_size;
+	gcma_heap->ahead_size = 0;
+	spin_unlock(&gcma_heap->ahead_lock);
+
+	if (!size)
+		return false;
+
+	/* a gcma_alloc_range of the range in the meantime takes the discarded pages */
+	gen_pool_free(gcma_heap->pool, paddr, size);
+	return true;
+}
+
+static struct page *gcma_take(struct gcma_heap *gcma_heap, phys_addr_t paddr,
+			      unsigned long size)
+{
+	unsigned long pfn = PFN_DOWN(paddr);
+	struct page *page = phys_to_page(paddr);
 
-	pfn = PFN_DOWN(paddr);
-	page = phys_to_page(paddr);
 	gcma_alloc_range(pfn, pfn + (size >> PAGE_SHIFT) - 1);
 	gcma_set_size(page, size);
 	inc_gcma_heap_stat(gcma_heap, USAGE, size);
@@ -86,6 +99,80 @@ struct page *gcma_alloc(struct gcma_heap *gcma_heap, unsigned long size)
 	return page;
 }
 
+struct page *gcma_alloc(struct gcma_heap *gcma_heap, unsigned long size)
+{
+	struct gen_pool *pool = gcma_heap->pool;
+	phys_addr_t paddr;
+
+	paddr = gen_pool_alloc(pool, size);
+	if (!paddr && gcma_release_ahead(gcma_heap))
+		paddr = gen_pool_alloc(pool, size);
+	if (!paddr)
+		return NULL;
+
+	return gcma_take(gcma_heap, paddr, size);
+}
+
+/*
+ * Fixed allocations of a heap usually come in runs of the same size, such
+ * as the buffers of a camera stream. After each one, the next range of the
+ * size is taken from the pool and its cached pages are discarded in the
+ * background, so the next allocation of the size doesn't wait for the
+ * discard. The range goes back to the pool if an allocation of another
+ * size comes or the pool runs out.
+ */
+static void gcma_reserve_ahead(struct gcma_heap *gcma_heap, unsigned long size)
+{
+	phys_addr_t paddr;
+	unsigned long pfn;
+
+	paddr = gen_pool_alloc(gcma_heap->pool, size);
+	if (!paddr)
+		return;
+
+	pfn = PFN_DOWN(paddr);
+	if (gcma_discard_range_ahead(pfn, pfn + (size >> PAGE_SHIFT) - 1))
+		goto free;
+
+	spin_lock(&gcma_heap->ahead_lock);
+	if (!gcma_heap->ahead_size) {
+		gcma_heap->ahead_paddr = paddr;
+		gcma_heap->ahead_size = size;
+		paddr = 0;
+	}
+	spin_unlock(&gcma_heap->ahead_lock);
+
+	if (!paddr)
+		return;
+free:
+	gen_pool_free(gcma_heap->pool, paddr, size);
+}
+
+static struct page *gcma_alloc_fixed(struct gcma_heap *gcma_heap, unsigned long size)
+{
+	phys_addr_t paddr = 0;
+	struct page *page;
+
+	spin_lock(&gcma_heap->ahead_lock);
+	if (gcma_heap->ahead_size == size) {
+		paddr = gcma_heap->ahead_paddr;
+		gcma_heap->ahead_size = 0;
+	}
+	spin_unlock(&gcma_heap->ahead_lock);
+
+	if (paddr) {
+		page = gcma_take(gcma_heap, paddr, size);
+	} else {
+		gcma_release_ahead(gcma_heap);
+		page = gcma_alloc(gcma_heap, size);
+	}
+
+	if (page)
+		gcma_reserve_ahead(gcma_heap, size);
+
+	return page;
+}
+
 void gcma_free(struct gen_pool *pool, struct page *page)
 {
 	unsigned long size, pfn;
@@ -102,8 +189,9 @@ static void free_gcma_heap_page(struct gcma_heap *gcma_heap, struct page *page)
 		return;
 
 	if (page_is_gcma(page)) {
-		gcma_free(gcma_heap->pool, page);
+		/* gcma_free_range resets page->private holding the size */
 		dec_gcma_heap_stat(gcma_heap, USAGE, gcma_get_size(page));
+		gcma_free(gcma_heap->pool, page);
 	} else {
 		unsigned int order = compound_order(page);
 		__free_pages(page, order);
@@ -202,7 +290,7 @@ out_flexible_alloc:
 static int allocate_fixed_pages(struct gcma_heap *gcma_heap, unsigned long len,
 					    struct heap_pages *heap_pages)
 {
-	struct page *page = gcma_alloc(gcma_heap, len);
+	struct page *page = gcma_alloc_fixed(gcma_heap, len);
 	if (page) {
 		list_add_tail(&page->lru, &heap_pages->pages_list);
 		heap_pages->count = 1;
@@ -358,6 +446,7 @@ static int gcma_heap_probe(struct platform_device *pdev)
 	if (ret)
 		return ret;
 
+	spin_lock_init(&gcma_heap->ahead_lock);
 	gcma_heap->pool = devm_gen_pool_create(&pdev->dev, PAGE_SHIFT, -1, 0);
 	if (!gcma_heap->pool)
 		return -ENOMEM;
@@ -13,6 +13,10 @@ struct gcma_heap {
         struct gcma_heap_stat *stat;
 #endif
         bool flexible_alloc;
+        /* range taken from the pool and discarded ahead for a fixed allocation */
+        spinlock_t ahead_lock;
+        phys_addr_t ahead_paddr;
+        unsigned long ahead_size;
 };
 
 
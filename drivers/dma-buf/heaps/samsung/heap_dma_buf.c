@@ -16,10 +16,13 @@
 #include <linux/dma-heap.h>
 #include <linux/dma-map-ops.h>
 #include <linux/err.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/interval_tree.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/samsung-dma-mapping.h>
+#include <linux/rcupdate.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <uapi/linux/dma-buf.h>
@@ -27,16 +30,45 @@
 #include "dmabuf_heap_trace.h"
 #include "samsung-dma-heap.h"
 
+/*
+ * The iova mappings of a buffer are shared by the attachments of the same
+ * iommu domain with the same attributes and direction. They are indexed in
+ * buffer->iovm_maps by dma_iovm_map_key() so that the attachments of the
+ * frame pipelines find the existing mapping without buffer->lock. The maps
+ * of the same key are chained by @next.
+ *
+ * @mapcnt is -1 once the map is being removed, the lockless lookup takes a
+ * reference only if it's not negative.
+ */
 struct dma_iovm_map {
 	struct list_head list;
+	struct dma_iovm_map __rcu *next;
 	struct device *dev;
+	struct iommu_domain *domain;
 	struct sg_table table;
 	unsigned long attrs;
-	unsigned int mapcnt;
+	atomic_t mapcnt;
 	enum dma_data_direction dir;
+	struct rcu_head rcu;
 };
 
+#define DMA_MAP_ATTRS_MASK	DMA_ATTR_PRIVILEGED
+#define DMA_MAP_ATTRS(attrs)	((attrs) & DMA_MAP_ATTRS_MASK)
+
+#define IOVM_MAP_HASH_BITS	3
+
+#define iovm_map_next(buffer, iovm_map) \
+	rcu_dereference_protected((iovm_map)->next, lockdep_is_held(&(buffer)->lock))
+
+static unsigned long dma_iovm_map_key(struct iommu_domain *domain, unsigned long attrs,
+				      enum dma_data_direction dir)
+{
+	return (hash_ptr(domain, IOVM_MAP_HASH_BITS) << 3) | (dir << 1) |
+		!!DMA_MAP_ATTRS(attrs);
+}
+
 static struct dma_iovm_map *dma_iova_create(struct dma_buf_attachment *a,
+					    struct iommu_domain *domain,
 					    enum dma_data_direction dir)
 {
 	struct samsung_dma_buffer *buffer = a->dmabuf->priv;
@@ -61,8 +93,10 @@ static struct dma_iovm_map *dma_iova_create(struct dma_buf_attachment *a,
 	}
 
 	iovm_map->dev = a->dev;
+	iovm_map->domain = domain;
 	iovm_map->attrs = a->dma_map_attrs;
 	iovm_map->dir = dir;
+	atomic_set(&iovm_map->mapcnt, 1);
 
 	return iovm_map;
 }
@@ -70,7 +104,61 @@ static struct dma_iovm_map *dma_iova_create(struct dma_buf_attachment *a,
 static void dma_iova_remove(struct dma_iovm_map *iovm_map)
 {
 	sg_free_table(&iovm_map->table);
-	kfree(iovm_map);
+	kfree_rcu(iovm_map, rcu);
+}
+
+static void dma_iova_unmap(struct samsung_dma_buffer *buffer, struct dma_iovm_map *iovm_map)
+{
+	if (!dma_heap_tzmp_buffer(iovm_map->dev, buffer->flags))
+		dma_unmap_sgtable(iovm_map->dev, &iovm_map->table,
+				  iovm_map->dir, DMA_ATTR_SKIP_CPU_SYNC);
+	dma_iova_remove(iovm_map);
+}
+
+static bool dma_iovm_map_match(struct dma_iovm_map *iovm_map, struct iommu_domain *domain,
+			       unsigned long attrs, enum dma_data_direction dir)
+{
+	return iovm_map->domain == domain &&
+		DMA_MAP_ATTRS(iovm_map->attrs) == attrs &&
+		iovm_map->dir == dir;
+}
+
+/* this function should only be called while buffer->lock is held */
+static int dma_insert_iovm_map(struct samsung_dma_buffer *buffer,
+			       struct dma_iovm_map *iovm_map)
+{
+	unsigned long key = dma_iovm_map_key(iovm_map->domain, iovm_map->attrs, iovm_map->dir);
+	int ret;
+
+	RCU_INIT_POINTER(iovm_map->next, xa_load(&buffer->iovm_maps, key));
+	ret = xa_err(xa_store(&buffer->iovm_maps, key, iovm_map, GFP_KERNEL));
+	if (ret)
+		return ret;
+
+	list_add(&iovm_map->list, &buffer->attachments);
+
+	return 0;
+}
+
+/* this function should only be called while buffer->lock is held */
+static void dma_remove_iovm_map(struct samsung_dma_buffer *buffer,
+				struct dma_iovm_map *iovm_map)
+{
+	unsigned long key = dma_iovm_map_key(iovm_map->domain, iovm_map->attrs, iovm_map->dir);
+	struct dma_iovm_map *prev, *next = iovm_map_next(buffer, iovm_map);
+
+	prev = xa_load(&buffer->iovm_maps, key);
+	if (prev == iovm_map) {
+		if (next)
+			xa_store(&buffer->iovm_maps, key, next, GFP_KERNEL);
+		else
+			xa_erase(&buffer->iovm_maps, key);
+	} else {
+		while (iovm_map_next(buffer, prev) != iovm_map)
+			prev = iovm_map_next(buffer, prev);
+		rcu_assign_pointer(prev->next, next);
+	}
+	list_del(&iovm_map->list);
 }
 
 static void dma_iova_release(struct dma_buf *dmabuf)
@@ -79,28 +167,19 @@ static void dma_iova_release(struct dma_buf *dmabuf)
 	struct dma_iovm_map *iovm_map, *tmp;
 
 	list_for_each_entry_safe(iovm_map, tmp, &buffer->attachments, list) {
-		if (iovm_map->mapcnt)
+		if (atomic_read(&iovm_map->mapcnt))
 			WARN(1, "iova_map refcount leak found for %s\n",
 			     dev_name(iovm_map->dev));
 
 		list_del(&iovm_map->list);
-		if (!dma_heap_tzmp_buffer(iovm_map->dev, buffer->flags))
-			dma_unmap_sgtable(iovm_map->dev, &iovm_map->table,
-					  iovm_map->dir, DMA_ATTR_SKIP_CPU_SYNC);
-		dma_iova_remove(iovm_map);
+		dma_iova_unmap(buffer, iovm_map);
 	}
+	xa_destroy(&buffer->iovm_maps);
 }
 
-#define DMA_MAP_ATTRS_MASK	DMA_ATTR_PRIVILEGED
-#define DMA_MAP_ATTRS(attrs)	((attrs) & DMA_MAP_ATTRS_MASK)
-
-/* this function should only be called while buffer->lock is held */
-static struct dma_iovm_map *dma_find_iovm_map(struct dma_buf_attachment *a,
-					      enum dma_data_direction dir)
+static unsigned long dma_iovm_map_attrs(struct dma_buf_attachment *a)
 {
 	struct samsung_dma_buffer *buffer = a->dmabuf->priv;
-	struct dma_iovm_map *iovm_map;
-	unsigned long attrs;
 
 	if (dma_heap_flags_uncached(buffer->flags)) {
 		/*
@@ -113,38 +192,55 @@ static struct dma_iovm_map *dma_find_iovm_map(struct dma_buf_attachment *a,
 		 */
 		a->dma_map_attrs |= (DMA_ATTR_PRIVILEGED | DMA_ATTR_SKIP_CPU_SYNC);
 	}
-	attrs = DMA_MAP_ATTRS(a->dma_map_attrs);
+	return DMA_MAP_ATTRS(a->dma_map_attrs);
+}
 
-	list_for_each_entry(iovm_map, &buffer->attachments, list) {
-		if ((iommu_get_domain_for_dev(iovm_map->dev) ==
-		    iommu_get_domain_for_dev(a->dev)) &&
-		    (DMA_MAP_ATTRS(iovm_map->attrs) == attrs) &&
-		    (iovm_map->dir == dir)) {
-			return iovm_map;
-		}
+/*
+ * Find the map of @domain, @attrs and @dir and take its reference. It's safe
+ * without buffer->lock.
+ */
+static struct dma_iovm_map *dma_find_iovm_map(struct samsung_dma_buffer *buffer,
+					      struct iommu_domain *domain,
+					      unsigned long attrs,
+					      enum dma_data_direction dir)
+{
+	unsigned long key = dma_iovm_map_key(domain, attrs, dir);
+	struct dma_iovm_map *iovm_map;
+
+	rcu_read_lock();
+	for (iovm_map = xa_load(&buffer->iovm_maps, key); iovm_map;
+	     iovm_map = rcu_dereference(iovm_map->next)) {
+		if (dma_iovm_map_match(iovm_map, domain, attrs, dir) &&
+		    atomic_inc_unless_negative(&iovm_map->mapcnt))
+			break;
 	}
-	return NULL;
+	rcu_read_unlock();
+
+	return iovm_map;
 }
 
 static struct dma_iovm_map *dma_put_iovm_map(struct dma_buf_attachment *a,
 					     enum dma_data_direction dir)
 {
 	struct samsung_dma_buffer *buffer = a->dmabuf->priv;
+	struct iommu_domain *domain = iommu_get_domain_for_dev(a->dev);
+	unsigned long attrs = dma_iovm_map_attrs(a);
+	unsigned long key = dma_iovm_map_key(domain, attrs, dir);
 	struct dma_iovm_map *iovm_map;
 
 	mutex_lock(&buffer->lock);
-	iovm_map = dma_find_iovm_map(a, dir);
-	if (iovm_map) {
-		iovm_map->mapcnt--;
-
-		if (!iovm_map->mapcnt && (a->dma_map_attrs & DMA_ATTR_SKIP_LAZY_UNMAP)) {
-			list_del(&iovm_map->list);
-			if (!dma_heap_tzmp_buffer(iovm_map->dev, buffer->flags))
-				dma_unmap_sgtable(iovm_map->dev, &iovm_map->table,
-						  iovm_map->dir, DMA_ATTR_SKIP_CPU_SYNC);
-			dma_iova_remove(iovm_map);
-			iovm_map = NULL;
-		}
+	for (iovm_map = xa_load(&buffer->iovm_maps, key); iovm_map;
+	     iovm_map = iovm_map_next(buffer, iovm_map)) {
+		if (dma_iovm_map_match(iovm_map, domain, attrs, dir))
+			break;
+	}
+
+	if (iovm_map && atomic_dec_and_test(&iovm_map->mapcnt) &&
+	    (a->dma_map_attrs & DMA_ATTR_SKIP_LAZY_UNMAP) &&
+	    atomic_cmpxchg(&iovm_map->mapcnt, 0, -1) == 0) {
+		dma_remove_iovm_map(buffer, iovm_map);
+		dma_iova_unmap(buffer, iovm_map);
+		iovm_map = NULL;
 	}
 	mutex_unlock(&buffer->lock);
 
@@ -155,19 +251,16 @@ static struct dma_iovm_map *dma_get_iovm_map(struct dma_buf_attachment *a,
 					     enum dma_data_direction direction)
 {
 	struct samsung_dma_buffer *buffer = a->dmabuf->priv;
+	struct iommu_domain *domain = iommu_get_domain_for_dev(a->dev);
+	unsigned long attrs = dma_iovm_map_attrs(a);
 	struct dma_iovm_map *iovm_map, *dup_iovm_map;
 	int ret;
 
-	mutex_lock(&buffer->lock);
-	iovm_map = dma_find_iovm_map(a, direction);
-	if (iovm_map) {
-		iovm_map->mapcnt++;
-		mutex_unlock(&buffer->lock);
+	iovm_map = dma_find_iovm_map(buffer, domain, attrs, direction);
+	if (iovm_map)
 		return iovm_map;
-	}
-	mutex_unlock(&buffer->lock);
 
-	iovm_map = dma_iova_create(a, direction);
+	iovm_map = dma_iova_create(a, domain, direction);
 	if (!iovm_map)
 		return NULL;
 
@@ -188,17 +281,11 @@ static struct dma_iovm_map *dma_get_iovm_map(struct dma_buf_attachment *a,
 	}
 
 	mutex_lock(&buffer->lock);
-	dup_iovm_map = dma_find_iovm_map(a, direction);
-	if (!dup_iovm_map) {
-		list_add(&iovm_map->list, &buffer->attachments);
-	} else {
-		if (!dma_heap_tzmp_buffer(iovm_map->dev, buffer->flags))
-			dma_unmap_sgtable(iovm_map->dev, &iovm_map->table, iovm_map->dir,
-					  DMA_ATTR_SKIP_CPU_SYNC);
-		dma_iova_remove(iovm_map);
+	dup_iovm_map = dma_find_iovm_map(buffer, domain, attrs, direction);
+	if (dup_iovm_map || dma_insert_iovm_map(buffer, iovm_map)) {
+		dma_iova_unmap(buffer, iovm_map);
 		iovm_map = dup_iovm_map;
 	}
-	iovm_map->mapcnt++;
 	mutex_unlock(&buffer->lock);
 
 	return iovm_map;
@@ -232,6 +319,187 @@ static void samsung_heap_unmap_dma_buf(struct dma_buf_attachment *a,
 	dma_put_iovm_map(a, direction);
 }
 
+/*
+ * The ranges the cpu may have written since the last full end_cpu_access are
+ * tracked by the partial begin_cpu_access so that end_cpu_access cleans only
+ * them instead of the whole buffer. Once a full begin_cpu_access for writing
+ * is seen or too many ranges are tracked, the whole buffer is regarded as
+ * dirty. Both are protected by buffer->lock.
+ */
+#define HEAP_MAX_DIRTY_RANGES	64
+
+static void heap_dirty_ranges_reset(struct samsung_dma_buffer *buffer)
+{
+	struct interval_tree_node *node, *next;
+
+	node = interval_tree_iter_first(&buffer->dirty_ranges, 0, ULONG_MAX);
+	while (node) {
+		next = interval_tree_iter_next(node, 0, ULONG_MAX);
+		interval_tree_remove(node, &buffer->dirty_ranges);
+		kfree(node);
+		node = next;
+	}
+	buffer->nr_dirty_ranges = 0;
+	buffer->dirty_all = false;
+}
+
+static void heap_dirty_range_add(struct samsung_dma_buffer *buffer,
+				 unsigned long start, unsigned long last)
+{
+	unsigned long qstart = start ? start - 1 : 0, qlast = last + 1;
+	struct interval_tree_node *node, *next;
+
+	if (buffer->dirty_all)
+		return;
+
+	/* merge the adjacent and overlapping ranges */
+	node = interval_tree_iter_first(&buffer->dirty_ranges, qstart, qlast);
+	while (node) {
+		next = interval_tree_iter_next(node, qstart, qlast);
+		start = min(start, node->start);
+		last = max(last, node->last);
+		interval_tree_remove(node, &buffer->dirty_ranges);
+		kfree(node);
+		buffer->nr_dirty_ranges--;
+		node = next;
+	}
+
+	if (buffer->nr_dirty_ranges >= HEAP_MAX_DIRTY_RANGES)
+		goto dirty_all;
+
+	node = kmalloc(sizeof(*node), GFP_KERNEL);
+	if (!node)
+		goto dirty_all;
+
+	node->start = start;
+	node->last = last;
+	interval_tree_insert(node, &buffer->dirty_ranges);
+	buffer->nr_dirty_ranges++;
+	return;
+
+dirty_all:
+	heap_dirty_ranges_reset(buffer);
+	buffer->dirty_all = true;
+}
+
+/* Drop the ranges cleaned by the partial end_cpu_access */
+static void heap_dirty_range_clear(struct samsung_dma_buffer *buffer,
+				   unsigned long start, unsigned long last)
+{
+	struct interval_tree_node *node, *next;
+
+	node = interval_tree_iter_first(&buffer->dirty_ranges, start, last);
+	while (node) {
+		next = interval_tree_iter_next(node, start, last);
+		if (node->start >= start && node->last <= last) {
+			interval_tree_remove(node, &buffer->dirty_ranges);
+			kfree(node);
+			buffer->nr_dirty_ranges--;
+		}
+		node = next;
+	}
+}
+
+/*
+ * The offset of each entry of buffer->sg_table to find the entry of an offset
+ * by binary search rather than walking the list. It's built on the first
+ * partial cpu access under buffer->lock and kept until the buffer is freed.
+ */
+struct heap_sg_index {
+	unsigned long offset;
+	struct scatterlist *sg;
+};
+
+static struct heap_sg_index *heap_sg_index_get(struct samsung_dma_buffer *buffer)
+{
+	struct sg_table *sgt = &buffer->sg_table;
+	struct heap_sg_index *index;
+	struct scatterlist *sg;
+	unsigned long offset = 0;
+	int i;
+
+	if (buffer->sg_index)
+		return buffer->sg_index;
+
+	index = kvmalloc_array(sgt->orig_nents, sizeof(*index), GFP_KERNEL);
+	if (!index)
+		return NULL;
+
+	for_each_sgtable_sg(sgt, sg, i) {
+		index[i].offset = offset;
+		index[i].sg = sg;
+		offset += sg->length;
+	}
+	buffer->sg_index = index;
+
+	return index;
+}
+
+/* Returns the entry containing @offset and makes @offset relative to it */
+static struct scatterlist *heap_sg_seek(struct samsung_dma_buffer *buffer,
+					struct heap_sg_index *index,
+					unsigned long *offset)
+{
+	unsigned int lo = 0, hi = buffer->sg_table.orig_nents, mid;
+	struct scatterlist *sg;
+
+	if (!index) {
+		for_each_sgtable_sg(&buffer->sg_table, sg, mid) {
+			if (*offset < sg->length)
+				return sg;
+			*offset -= sg->length;
+		}
+		return NULL;
+	}
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (index[mid].offset <= *offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*offset -= index[lo].offset;
+
+	return *offset < index[lo].sg->length ? index[lo].sg : NULL;
+}
+
+static void dma_sync_range(struct samsung_dma_buffer *buffer, struct heap_sg_index *index,
+			   enum dma_data_direction direction, unsigned long offset,
+			   unsigned long len, bool for_device)
+{
+	struct device *dev = dma_heap_get_dev(buffer->heap->dma_heap);
+	struct scatterlist *sg;
+	unsigned long size;
+
+	for (sg = heap_sg_seek(buffer, index, &offset); sg && len; sg = sg_next(sg)) {
+		dma_addr_t dma_addr = phys_to_dma(dev, sg_phys(sg));
+
+		size = min_t(unsigned long, len, sg->length - offset);
+		len -= size;
+
+		if (for_device)
+			dma_sync_single_range_for_device(dev, dma_addr, offset, size, direction);
+		else
+			dma_sync_single_range_for_cpu(dev, dma_addr, offset, size, direction);
+
+		offset = 0;
+	}
+}
+
+/* this function should only be called while buffer->lock is held */
+static struct dma_iovm_map *dma_find_noncoherent_map(struct samsung_dma_buffer *buffer)
+{
+	struct dma_iovm_map *iovm_map;
+
+	list_for_each_entry(iovm_map, &buffer->attachments, list) {
+		if (atomic_read(&iovm_map->mapcnt) > 0 && !dev_is_dma_coherent(iovm_map->dev))
+			return iovm_map;
+	}
+	return NULL;
+}
+
 static int samsung_heap_dma_buf_begin_cpu_access(struct dma_buf *dmabuf,
 						 enum dma_data_direction direction)
 {
@@ -242,12 +510,14 @@ static int samsung_heap_dma_buf_begin_cpu_access(struct dma_buf *dmabuf,
 		return 0;
 
 	mutex_lock(&buffer->lock);
-	list_for_each_entry(iovm_map, &buffer->attachments, list) {
-		if (iovm_map->mapcnt && !dev_is_dma_coherent(iovm_map->dev)) {
-			dma_sync_sgtable_for_cpu(iovm_map->dev, &iovm_map->table, direction);
-			break;
-		}
+	if (direction != DMA_FROM_DEVICE) {
+		heap_dirty_ranges_reset(buffer);
+		buffer->dirty_all = true;
 	}
+
+	iovm_map = dma_find_noncoherent_map(buffer);
+	if (iovm_map)
+		dma_sync_sgtable_for_cpu(iovm_map->dev, &iovm_map->table, direction);
 	mutex_unlock(&buffer->lock);
 
 	return 0;
@@ -257,18 +527,30 @@ static int samsung_heap_dma_buf_end_cpu_access(struct dma_buf *dmabuf,
 					       enum dma_data_direction direction)
 {
 	struct samsung_dma_buffer *buffer = dmabuf->priv;
+	struct interval_tree_node *node;
 	struct dma_iovm_map *iovm_map;
+	struct heap_sg_index *index;
 
 	if (dma_heap_skip_cache_ops(buffer->flags))
 		return 0;
 
 	mutex_lock(&buffer->lock);
-	list_for_each_entry(iovm_map, &buffer->attachments, list) {
-		if (iovm_map->mapcnt && !dev_is_dma_coherent(iovm_map->dev)) {
-			dma_sync_sgtable_for_device(iovm_map->dev, &iovm_map->table, direction);
-			break;
-		}
+	iovm_map = dma_find_noncoherent_map(buffer);
+	if (!iovm_map)
+		goto out;
+
+	/* clean only the ranges written if the cpu told which ranges it wrote */
+	if (!buffer->dirty_all && buffer->nr_dirty_ranges) {
+		index = heap_sg_index_get(buffer);
+		for (node = interval_tree_iter_first(&buffer->dirty_ranges, 0, ULONG_MAX);
+		     node; node = interval_tree_iter_next(node, 0, ULONG_MAX))
+			dma_sync_range(buffer, index, direction, node->start,
+				       node->last - node->start + 1, true);
+	} else {
+		dma_sync_sgtable_for_device(iovm_map->dev, &iovm_map->table, direction);
 	}
+out:
+	heap_dirty_ranges_reset(buffer);
 	mutex_unlock(&buffer->lock);
 
 	return 0;
@@ -278,51 +560,24 @@ static void dma_sync_sg_partial(struct dma_buf *dmabuf, enum dma_data_direction
 				unsigned int offset, unsigned int len, unsigned long flag)
 {
 	struct samsung_dma_buffer *buffer = dmabuf->priv;
-	struct device *dev = dma_heap_get_dev(buffer->heap->dma_heap);
-	struct dma_iovm_map *iovm_map;
-	struct sg_table *sgt = NULL;
-	struct scatterlist *sg;
-	int i;
-	unsigned int size;
+	struct heap_sg_index *index;
+	bool noncoherent;
 
-	if (dma_heap_skip_cache_ops(buffer->flags))
+	if (dma_heap_skip_cache_ops(buffer->flags) || !len)
 		return;
 
 	mutex_lock(&buffer->lock);
-	list_for_each_entry(iovm_map, &buffer->attachments, list) {
-		if (iovm_map->mapcnt && !dev_is_dma_coherent(iovm_map->dev)) {
-			sgt = &iovm_map->table;
-			break;
-		}
-	}
-	mutex_unlock(&buffer->lock);
-
-	if (!sgt)
-		return;
-
-	for_each_sgtable_sg(sgt, sg, i) {
-		dma_addr_t dma_addr;
-
-		if (offset >= sg->length) {
-			offset -= sg->length;
-			continue;
-		}
+	if (flag & DMA_BUF_SYNC_END)
+		heap_dirty_range_clear(buffer, offset, offset + len - 1);
+	else if (direction != DMA_FROM_DEVICE)
+		heap_dirty_range_add(buffer, offset, offset + len - 1);
 
-		size = min_t(unsigned int, len, sg->length - offset);
-		len -= size;
-
-		dma_addr = phys_to_dma(dev, sg_phys(sg));
-
-		if (flag & DMA_BUF_SYNC_END)
-			dma_sync_single_range_for_device(dev, dma_addr, offset, size, direction);
-		else
-			dma_sync_single_range_for_cpu(dev, dma_addr, offset, size, direction);
-
-		offset = 0;
+	noncoherent = !!dma_find_noncoherent_map(buffer);
+	index = noncoherent ? heap_sg_index_get(buffer) : NULL;
+	mutex_unlock(&buffer->lock);
 
-		if (!len)
-			break;
-	}
+	if (noncoherent)
+		dma_sync_range(buffer, index, direction, offset, len, flag & DMA_BUF_SYNC_END);
 }
 
 static int samsung_heap_dma_buf_begin_cpu_access_partial(struct dma_buf *dmabuf,
@@ -454,6 +709,8 @@ static void samsung_heap_dma_buf_release(struct dma_buf *dmabuf)
 	struct samsung_dma_buffer *buffer = dmabuf->priv;
 
 	dma_iova_release(dmabuf);
+	heap_dirty_ranges_reset(buffer);
+	kvfree(buffer->sg_index);
 
 	samsung_track_buffer_destroyed(buffer);
 	buffer->heap->release(buffer);
@@ -21,6 +21,8 @@
 #include <linux/platform_device.h>
 #include <linux/iommu.h>
 #include <linux/device.h>
+#include <linux/rbtree.h>
+#include <linux/xarray.h>
 
 /* This header is in ACK under drivers/dma-buf/heaps. */
 #include <heaps/deferred-free-helper.h>
@@ -40,9 +42,18 @@ static inline void dma_heap_dec_inuse(unsigned long pages)
 	atomic64_sub(pages, &inuse_pages);
 }
 
+struct heap_sg_index;
+
 struct samsung_dma_buffer {
 	struct samsung_dma_heap *heap;
 	struct list_head attachments;
+	/* dma_iovm_map index for lockless lookup, see heap_dma_buf.c */
+	struct xarray iovm_maps;
+	/* cpu written ranges and the sg offset index, see heap_dma_buf.c */
+	struct rb_root_cached dirty_ranges;
+	unsigned int nr_dirty_ranges;
+	bool dirty_all;
+	struct heap_sg_index *sg_index;
 	/* Manage buffer resource of attachments and vaddr, vmap_cnt */
 	struct mutex lock;
 	unsigned long len;
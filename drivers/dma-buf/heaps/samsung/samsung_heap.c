@@ -13,9 +13,11 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/scatterlist.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/trusty/trusty.h>
 #include <linux/of.h>
+#include <linux/workqueue.h>
 
 #include "samsung-dma-heap.h"
 
@@ -38,9 +40,74 @@ void samsung_track_buffer_destroyed(struct samsung_dma_buffer *buffer)
 	trace_dma_heap_stat(buffer->ino, -buffer->len, total);
 }
 
+/*
+ * The cache flush of large buffers is split into chunks of the scatterlist
+ * that are flushed on the other cpus in parallel.
+ */
+#define HEAP_FLUSH_PARALLEL_SIZE	SZ_16M
+#define HEAP_FLUSH_MAX_WORKS		8
+
+struct heap_flush_work {
+	struct work_struct work;
+	struct device *dev;
+	struct scatterlist *sgl;
+	unsigned int nents;
+};
+
+static void heap_flush_sg(struct device *dev, struct scatterlist *sgl, unsigned int nents)
+{
+	if (dma_map_sg(dev, sgl, nents, DMA_TO_DEVICE))
+		dma_unmap_sg(dev, sgl, nents, DMA_TO_DEVICE);
+}
+
+static void heap_flush_work_fn(struct work_struct *work)
+{
+	struct heap_flush_work *fw = container_of(work, struct heap_flush_work, work);
+
+	heap_flush_sg(fw->dev, fw->sgl, fw->nents);
+}
+
+static void heap_cache_flush_parallel(struct device *dev, struct sg_table *sgt,
+				      unsigned long len, unsigned int nr_works)
+{
+	struct heap_flush_work works[HEAP_FLUSH_MAX_WORKS] = { };
+	unsigned long chunk = DIV_ROUND_UP(len, nr_works), size = 0;
+	struct scatterlist *sg;
+	unsigned int i, nr = 0;
+
+	for_each_sgtable_sg(sgt, sg, i) {
+		if (!works[nr].nents)
+			works[nr].sgl = sg;
+		works[nr].nents++;
+		size += sg->length;
+		if (size >= chunk && nr < nr_works - 1) {
+			nr++;
+			size = 0;
+		}
+	}
+	if (works[nr].nents)
+		nr++;
+
+	/* the first chunk is flushed by the caller while the others are queued */
+	for (i = 1; i < nr; i++) {
+		works[i].dev = dev;
+		INIT_WORK_ONSTACK(&works[i].work, heap_flush_work_fn);
+		queue_work(system_unbound_wq, &works[i].work);
+	}
+
+	heap_flush_sg(dev, works[0].sgl, works[0].nents);
+
+	for (i = 1; i < nr; i++) {
+		flush_work(&works[i].work);
+		destroy_work_on_stack(&works[i].work);
+	}
+}
+
 void heap_cache_flush(struct samsung_dma_buffer *buffer)
 {
 	struct device *dev = dma_heap_get_dev(buffer->heap->dma_heap);
+	struct sg_table *sgt = &buffer->sg_table;
+	unsigned int nr_works;
 
 	if (!dma_heap_skip_cache_ops(buffer->flags))
 		return;
@@ -52,8 +119,14 @@ void heap_cache_flush(struct samsung_dma_buffer *buffer)
 	 * protected from non-secure access to prevent the dirty write-back
 	 * to the protected area.
 	 */
-	dma_map_sgtable(dev, &buffer->sg_table, DMA_TO_DEVICE, 0);
-	dma_unmap_sgtable(dev, &buffer->sg_table, DMA_TO_DEVICE, 0);
+	nr_works = min3(num_online_cpus(), HEAP_FLUSH_MAX_WORKS, sgt->orig_nents);
+	if (buffer->len >= HEAP_FLUSH_PARALLEL_SIZE && nr_works > 1) {
+		heap_cache_flush_parallel(dev, sgt, buffer->len, nr_works);
+		return;
+	}
+
+	dma_map_sgtable(dev, sgt, DMA_TO_DEVICE, 0);
+	dma_unmap_sgtable(dev, sgt, DMA_TO_DEVICE, 0);
 }
 
 void heap_sgtable_pages_clean(struct sg_table *sgt)
@@ -107,6 +180,8 @@ struct samsung_dma_buffer *samsung_dma_buffer_alloc(struct samsung_dma_heap *sam
 	}
 
 	INIT_LIST_HEAD(&buffer->attachments);
+	xa_init(&buffer->iovm_maps);
+	buffer->dirty_ranges = RB_ROOT_CACHED;
 	mutex_init(&buffer->lock);
 	buffer->heap = samsung_dma_heap;
 	buffer->len = size;
@@ -16,17 +16,22 @@
 #include <linux/dma-heap.h>
 #include <linux/err.h>
 #include <linux/highmem.h>
+#include <linux/kthread.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/sched/topology.h>
 #include <linux/scatterlist.h>
+#include <linux/shrinker.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/of.h>
+#include <linux/wait.h>
 #include <soc/google/meminfo.h>
 
 #include <heaps/page_pool.h>
 
 #include "samsung-dma-heap.h"
+#include "dmabuf_heap_trace.h"
 
 #define HIGH_ORDER_GFP  (((GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN \
 				| __GFP_NORETRY) & ~__GFP_RECLAIM) \
@@ -43,6 +48,31 @@ static const unsigned int orders[] = {9, 8, 4, 0};
 #define NUM_ORDERS ARRAY_SIZE(orders)
 struct dmabuf_page_pool *pools[NUM_ORDERS];
 
+/*
+ * Freed pages are zeroed by a low priority thread on the little cores instead
+ * of the freeing context, and the same thread refills the pools with zeroed
+ * pages up to pool_wmark once the allocations drain a pool below the half of
+ * it. The pool only holds zeroed pages so the allocator never zeroes a page
+ * it takes from the pool.
+ *
+ * The refill keeps memory in the pools that nobody asked for, so it's off
+ * (0) by default and left to the devices that want zeroed pages at hand.
+ */
+static unsigned int pool_wmark[NUM_ORDERS];
+module_param_array(pool_wmark, uint, NULL, 0644);
+MODULE_PARM_DESC(pool_wmark, "the number of zeroed pages of each order (2MB, 1MB, 64K, 4K) kept in the system heap pool");
+
+/* the refill shouldn't reclaim memory to keep the pool */
+#define REFILL_GFP(idx) ((order_flags[idx] | __GFP_NOWARN | __GFP_NORETRY) & ~__GFP_RECLAIM)
+
+static struct task_struct *zero_task;
+static DECLARE_WAIT_QUEUE_HEAD(zero_wait);
+static DEFINE_SPINLOCK(zero_lock);
+static struct list_head dirty_pages[NUM_ORDERS];
+/* the number of pages of each order on dirty_pages, protected by zero_lock */
+static unsigned long dirty_count[NUM_ORDERS];
+static bool refill_pending;
+
 static unsigned long dma_heap_system_inuse_pages(void)
 {
 	return atomic64_read(&inuse_pages);
@@ -53,12 +83,30 @@ static unsigned long dma_heap_system_pool_pages(void)
 	int i;
 	unsigned long pages = 0;
 
-	for (i = 0; i < NUM_ORDERS; i++)
+	for (i = 0; i < NUM_ORDERS; i++) {
 		pages += dmabuf_page_pool_get_size(pools[i]) / PAGE_SIZE;
+		pages += READ_ONCE(dirty_count[i]) << orders[i];
+	}
 
 	return pages;
 }
 
+static int order_to_pool_idx(unsigned int order)
+{
+	int pool_idx;
+
+	for (pool_idx = 0; pool_idx < NUM_ORDERS; pool_idx++) {
+		if (order == orders[pool_idx])
+			break;
+	}
+	return pool_idx;
+}
+
+static unsigned long pool_count(int pool_idx)
+{
+	return dmabuf_page_pool_get_size(pools[pool_idx]) >> (PAGE_SHIFT + orders[pool_idx]);
+}
+
 static struct page *alloc_largest_available(unsigned long size,
 					    unsigned int max_order)
 {
@@ -80,31 +128,234 @@ static struct page *alloc_largest_available(unsigned long size,
 	return NULL;
 }
 
+/*
+ * Allocate up to @nr order-0 pages at once to @list. The pages are taken from
+ * the pool first and the rest are allocated in bulk rather than one by one.
+ * Returns the number of pages allocated.
+ */
+static unsigned long alloc_order0_bulk(unsigned long nr, struct list_head *list)
+{
+	int pool_idx = NUM_ORDERS - 1;
+	unsigned long pooled, i;
+	struct page *page;
+
+	pooled = min(nr, pool_count(pool_idx));
+	for (i = 0; i < pooled; i++) {
+		page = dmabuf_page_pool_alloc(pools[pool_idx]);
+		if (!page)
+			break;
+		list_add_tail(&page->lru, list);
+	}
+
+	/* the gfp flags of the order-0 pool include __GFP_ZERO */
+	if (i < nr)
+		i += alloc_pages_bulk_list(order_flags[pool_idx], nr - i, list);
+
+	dma_heap_inc_inuse(i);
+	return i;
+}
+
+static void zero_and_pool_page(struct page *page, int pool_idx)
+{
+	int i, numpages = 1 << orders[pool_idx];
+
+	for (i = 0; i < numpages; i++)
+		clear_highpage(page + i);
+
+	dmabuf_page_pool_free(pools[pool_idx], page);
+}
+
 /*
  * free @page directly without caching it to page pool if @discard is true
  * since it's not likely to be reused since the pool is draining now(e.g.,
- * memory pressure) so page zeroing is pointess.
+ * memory pressure) so page zeroing is pointess. Otherwise, @page is zeroed by
+ * the zeroing thread before it goes to the pool. The caller should call
+ * system_heap_zero_kick() after freeing the pages.
  */
 static void free_dma_heap_page(struct page *page, bool discard)
 {
 	unsigned int order = compound_order(page);
+	int pool_idx = order_to_pool_idx(order);
 
 	if (discard) {
 		__free_pages(page, order);
+	} else if (!zero_task) {
+		zero_and_pool_page(page, pool_idx);
 	} else {
-		int pool_idx;
-		int i, numpages = 1 << order;
+		spin_lock(&zero_lock);
+		list_add_tail(&page->lru, &dirty_pages[pool_idx]);
+		dirty_count[pool_idx]++;
+		spin_unlock(&zero_lock);
+	}
+	dma_heap_dec_inuse(1 << order);
+}
+
+/* Wake up the zeroing thread if there are freed pages or a pool to refill */
+static void system_heap_zero_kick(void)
+{
+	int i;
 
-		for (i = 0; i < numpages; i++)
-			clear_highpage(page + i);
+	if (!zero_task)
+		return;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (pool_count(i) < READ_ONCE(pool_wmark[i]) / 2) {
+			WRITE_ONCE(refill_pending, true);
+			break;
+		}
+	}
+
+	wake_up(&zero_wait);
+}
+
+static bool system_heap_zero_pending(void)
+{
+	int i;
+
+	if (READ_ONCE(refill_pending))
+		return true;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (!list_empty_careful(&dirty_pages[i]))
+			return true;
+	}
+	return false;
+}
+
+static void system_heap_zero_dirty(void)
+{
+	struct page *page, *tmp_page;
+	LIST_HEAD(pages);
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		spin_lock(&zero_lock);
+		list_splice_init(&dirty_pages[i], &pages);
+		dirty_count[i] = 0;
+		spin_unlock(&zero_lock);
+
+		list_for_each_entry_safe(page, tmp_page, &pages, lru) {
+			list_del(&page->lru);
+			zero_and_pool_page(page, i);
+			cond_resched();
+		}
+	}
+}
 
-		for (pool_idx = 0; pool_idx < NUM_ORDERS; pool_idx++) {
-			if (order == orders[pool_idx])
+static void system_heap_refill(void)
+{
+	struct page *page;
+	int i;
+
+	WRITE_ONCE(refill_pending, false);
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		while (pool_count(i) < READ_ONCE(pool_wmark[i])) {
+			/* freed pages are cheaper to reuse than new ones */
+			if (kthread_should_stop() || !list_empty_careful(&dirty_pages[i]))
+				return;
+
+			/* the gfp flags of the pools include __GFP_ZERO */
+			page = alloc_pages(REFILL_GFP(i), orders[i]);
+			if (!page)
 				break;
+
+			dmabuf_page_pool_free(pools[i], page);
+			cond_resched();
 		}
-		dmabuf_page_pool_free(pools[pool_idx], page);
 	}
-	dma_heap_dec_inuse(1 << order);
+}
+
+/*
+ * The thread isn't freezable, so the pages freed before suspend don't stay on
+ * the dirty lists until resume.
+ */
+static int system_heap_zero_thread(void *data)
+{
+	set_user_nice(current, MAX_NICE);
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(zero_wait,
+					 system_heap_zero_pending() || kthread_should_stop());
+
+		system_heap_zero_dirty();
+		system_heap_refill();
+	}
+
+	return 0;
+}
+
+/*
+ * The pool shrinker can't see the pages waiting for zeroing, so they are freed
+ * here without being zeroed under memory pressure.
+ */
+static unsigned long system_heap_dirty_count(struct shrinker *shrinker,
+					     struct shrink_control *sc)
+{
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		count += READ_ONCE(dirty_count[i]) << orders[i];
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long system_heap_dirty_scan(struct shrinker *shrinker,
+					    struct shrink_control *sc)
+{
+	struct page *page;
+	unsigned long freed = 0;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS && freed < sc->nr_to_scan; i++) {
+		while (freed < sc->nr_to_scan) {
+			spin_lock(&zero_lock);
+			page = list_first_entry_or_null(&dirty_pages[i], struct page, lru);
+			if (page) {
+				list_del(&page->lru);
+				dirty_count[i]--;
+			}
+			spin_unlock(&zero_lock);
+
+			if (!page)
+				break;
+
+			__free_pages(page, orders[i]);
+			freed += 1 << orders[i];
+		}
+	}
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker system_heap_dirty_shrinker = {
+	.count_objects = system_heap_dirty_count,
+	.scan_objects = system_heap_dirty_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/* Bind @task to the cpus having the lowest capacity */
+static void system_heap_bind_little(struct task_struct *task)
+{
+	unsigned long cap, min_cap = ULONG_MAX;
+	cpumask_var_t mask;
+	int cpu;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	for_each_possible_cpu(cpu)
+		min_cap = min(min_cap, arch_scale_cpu_capacity(cpu));
+
+	for_each_possible_cpu(cpu) {
+		cap = arch_scale_cpu_capacity(cpu);
+		if (cap == min_cap)
+			cpumask_set_cpu(cpu, mask);
+	}
+
+	set_cpus_allowed_ptr(task, mask);
+	free_cpumask_var(mask);
 }
 
 static struct dma_buf *system_heap_allocate(struct dma_heap *heap, unsigned long len,
@@ -116,9 +367,10 @@ static struct dma_buf *system_heap_allocate(struct dma_heap *heap, unsigned long
 	struct dma_buf *dmabuf;
 	struct list_head pages;
 	struct page *page, *tmp_page;
-	unsigned long size_remaining;
+	unsigned long size_remaining, nr;
 	unsigned int max_order = orders[0];
 	int i, ret = -ENOMEM;
+	ktime_t start, alloced, flushed;
 
 	if (dma_heap_flags_video_aligned(samsung_dma_heap->flags))
 		len = dma_heap_add_video_padding(len);
@@ -130,6 +382,7 @@ static struct dma_buf *system_heap_allocate(struct dma_heap *heap, unsigned long
 	}
 
 	size_remaining = len;
+	start = ktime_get();
 
 	INIT_LIST_HEAD(&pages);
 	i = 0;
@@ -152,7 +405,15 @@ static struct dma_buf *system_heap_allocate(struct dma_heap *heap, unsigned long
 		size_remaining -= page_size(page);
 		max_order = compound_order(page);
 		i++;
+
+		/* all the remaining pages are order-0 once an order-0 page is used */
+		if (!max_order && size_remaining) {
+			nr = alloc_order0_bulk(size_remaining >> PAGE_SHIFT, &pages);
+			size_remaining -= nr << PAGE_SHIFT;
+			i += nr;
+		}
 	}
+	alloced = ktime_get();
 
 	buffer = samsung_dma_buffer_alloc(samsung_dma_heap, len, i);
 	if (IS_ERR(buffer)) {
@@ -168,6 +429,7 @@ static struct dma_buf *system_heap_allocate(struct dma_heap *heap, unsigned long
 	}
 
 	heap_cache_flush(buffer);
+	flushed = ktime_get();
 
 	dmabuf = samsung_export_dmabuf(buffer, fd_flags);
 	if (IS_ERR(dmabuf)) {
@@ -175,6 +437,11 @@ static struct dma_buf *system_heap_allocate(struct dma_heap *heap, unsigned long
 		goto free_export;
 	}
 
+	trace_dma_heap_system_alloc(len, i, ktime_to_ns(ktime_sub(alloced, start)),
+				    ktime_to_ns(ktime_sub(flushed, alloced)),
+				    ktime_to_ns(ktime_sub(ktime_get(), flushed)));
+	system_heap_zero_kick();
+
 	return dmabuf;
 
 free_export:
@@ -182,8 +449,11 @@ free_export:
 		free_dma_heap_page(sg_page(sg), false);
 	samsung_dma_buffer_free(buffer);
 free_buffer:
-	list_for_each_entry_safe(page, tmp_page, &pages, lru)
+	list_for_each_entry_safe(page, tmp_page, &pages, lru) {
+		list_del(&page->lru);
 		free_dma_heap_page(page, false);
+	}
+	system_heap_zero_kick();
 
 	return ERR_PTR(ret);
 }
@@ -218,6 +488,7 @@ static void system_heap_free(struct deferred_freelist_item *item, enum df_reason
 	for_each_sgtable_sg(table, sg, i)
 		free_dma_heap_page(sg_page(sg), reason != DF_NORMAL);
 	samsung_dma_buffer_free(buffer);
+	system_heap_zero_kick();
 }
 
 static void system_heap_release(struct samsung_dma_buffer *buffer)
@@ -285,6 +556,21 @@ int __init system_dma_heap_init(void)
 		}
 	}
 
+	for (i = 0; i < NUM_ORDERS; i++)
+		INIT_LIST_HEAD(&dirty_pages[i]);
+
+	/* pages are zeroed synchronously on free without the thread */
+	zero_task = kthread_create(system_heap_zero_thread, NULL, "dma_heap_zero");
+	if (IS_ERR(zero_task)) {
+		pr_err("%s: failed to create the zeroing thread\n", __func__);
+		zero_task = NULL;
+	} else {
+		system_heap_bind_little(zero_task);
+		wake_up_process(zero_task);
+		if (register_shrinker(&system_heap_dirty_shrinker, "dma_heap_dirty"))
+			pr_err("%s: failed to register the dirty page shrinker\n", __func__);
+	}
+
 	register_meminfo(&dma_heap_meminfo);
 	register_meminfo(&dma_heap_pool_meminfo);
 
@@ -294,4 +580,13 @@ int __init system_dma_heap_init(void)
 void system_dma_heap_exit(void)
 {
 	platform_driver_unregister(&system_heap_driver);
+
+	if (zero_task) {
+		struct task_struct *task = zero_task;
+
+		WRITE_ONCE(zero_task, NULL);
+		kthread_stop(task);
+		unregister_shrinker(&system_heap_dirty_shrinker);
+		system_heap_zero_dirty();
+	}
 }
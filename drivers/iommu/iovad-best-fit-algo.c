@@ -41,6 +41,38 @@ static void __iova_insert_rbtree(struct rb_root *root, struct iova *iova, struct
 	rb_insert_color(&iova->node, root);
 }
 
+/*
+ * Returns the lowest node at or above @limit_pfn, the anchor if there is
+ * none. The nodes above it can't bound a gap under the limit, so the walk
+ * starts from it instead of from the anchor. That only helps when the limit
+ * is below some IOVAs; the walk is still linear in the number of IOVAs
+ * under the limit, which is all of them in the common case.
+ */
+static struct rb_node *__iova_find_limit(struct iova_domain *iovad, unsigned long limit_pfn)
+{
+	struct rb_node *node = iovad->rbroot.rb_node;
+	struct rb_node *found = &iovad->anchor.node;
+
+	while (node) {
+		if (__to_iova(node)->pfn_lo >= limit_pfn) {
+			found = node;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * The walk is linear in the number of IOVAs under the limit. A gap index
+ * such as a tree augmented with the largest gap per subtree would make it
+ * logarithmic, but the domain rbtree belongs to the core IOVA code, which
+ * frees IOVAs with plain rb_erase and inserts reserved ones without a hook.
+ * An index kept here would miss those changes and pick other gaps than
+ * the walk does, so the best fit is always searched in the domain rbtree.
+ */
 static int __alloc_and_insert_iova_best_fit(struct iova_domain *iovad, unsigned long size,
 					    unsigned long limit_pfn, struct iova *new,
 					    bool size_aligned)
@@ -60,14 +92,18 @@ static int __alloc_and_insert_iova_best_fit(struct iova_domain *iovad, unsigned
 		align_mask <<= shift;
 	}
 
-	/* Walk the tree backwards */
+	/* Walk the tree backwards from the limit */
 	spin_lock_irqsave(&iovad->iova_rbtree_lock, flags);
-	curr = &iovad->anchor.node;
+	curr = __iova_find_limit(iovad, limit_pfn);
 	prev = rb_prev(curr);
 	for (; prev; curr = prev, prev = rb_prev(curr)) {
 		curr_iova = rb_entry(curr, struct iova, node);
 		prev_iova = rb_entry(prev, struct iova, node);
 
+		/* No gap below can fit the size */
+		if (curr_iova->pfn_lo - iovad->start_pfn < size)
+			break;
+
 		limit_pfn = min(limit_pfn, curr_iova->pfn_lo);
 		new_pfn = (limit_pfn - size) & align_mask;
 		gap = curr_iova->pfn_lo - prev_iova->pfn_hi - 1;
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Stress test of the best fit IOVA allocation
+ *
+ * Writing the number of allocations to measure into the run parameter
+ * fills a domain with 1k, 10k and 50k live IOVAs of 1 to 16 pages, frees
+ * every other one, and then allocates while keeping the number of live
+ * IOVAs. Each allocation is timed and its placement is checked against
+ * the best fit found by an independent forward scan of the domain: the
+ * smallest gap that fits, the highest one among equal gaps. The latency
+ * and the number of misplaced or overlapping IOVAs per step are printed
+ * to the kernel log.
+ *
+ * E.g.,
+ * echo 1000 > /sys/module/iovad_best_fit_test/parameters/run
+ */
+
+#define pr_fmt(fmt) "IOVAD BEST FIT TEST: " fmt
+
+#include <linux/iova.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/prandom.h>
+#include <linux/slab.h>
+
+#define TEST_START_PFN		1UL
+/* 4GB of 4KB pages is well above 50k IOVAs of 16 pages at most */
+#define TEST_LIMIT_PFN		((1UL << 20) - 1)
+#define TEST_MAX_PAGES		16
+
+static const unsigned int test_live[] = { 1000, 10000, 50000 };
+
+/* Returns the pfn the best fit should place @size at, 0 if none */
+static unsigned long test_best_fit(struct iova_domain *iovad, unsigned long size)
+{
+	unsigned long align_mask = ~0UL << fls_long(size - 1);
+	unsigned long base = iovad->start_pfn, limit, pfn, gap;
+	unsigned long best_pfn = 0, best_gap = ~0UL;
+	struct rb_node *node;
+	struct iova *iova;
+
+	for (node = rb_first(&iovad->rbroot); node; node = rb_next(node)) {
+		iova = rb_entry(node, struct iova, node);
+		gap = iova->pfn_lo - base;
+		limit = min(TEST_LIMIT_PFN + 1, iova->pfn_lo);
+		if (limit >= size) {
+			pfn = (limit - size) & align_mask;
+			/* the higher of equal gaps */
+			if (pfn >= base && gap <= best_gap) {
+				best_gap = gap;
+				best_pfn = pfn;
+			}
+		}
+		/* the gap below the first IOVA from the limit is the last one */
+		if (iova->pfn_lo > TEST_LIMIT_PFN)
+			break;
+		base = iova->pfn_hi + 1;
+	}
+
+	return best_pfn;
+}
+
+/* Returns the number of overlapping or unordered IOVAs in the domain */
+static unsigned int test_check_domain(struct iova_domain *iovad)
+{
+	struct rb_node *node;
+	struct iova *prev = NULL, *iova;
+	unsigned int errors = 0;
+
+	for (node = rb_first(&iovad->rbroot); node; node = rb_next(node)) {
+		iova = rb_entry(node, struct iova, node);
+		if (prev && prev->pfn_hi >= iova->pfn_lo)
+			errors++;
+		prev = iova;
+	}
+
+	return errors;
+}
+
+static int test_run_one(unsigned int live, unsigned int nr_measure)
+{
+	struct iova_domain *iovad;
+	struct iova **iovas;
+	struct rnd_state rnd;
+	unsigned int i, idx, misplaced = 0, failed = 0;
+	u64 total_ns = 0, max_ns = 0;
+	int ret = 0;
+
+	iovad = kzalloc(sizeof(*iovad), GFP_KERNEL);
+	iovas = kvcalloc(live, sizeof(*iovas), GFP_KERNEL);
+	if (!iovad || !iovas) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	init_iova_domain(iovad, PAGE_SIZE, TEST_START_PFN);
+	/* as iommu_iovad_init_alloc_algo does for "iommu-best-fit-algo" */
+	iovad->android_vendor_data1 = 1;
+	prandom_seed_state(&rnd, live);
+
+	/* Fill the domain and leave holes of various sizes */
+	for (i = 0; i < live; i++) {
+		iovas[i] = alloc_iova(iovad, prandom_u32_state(&rnd) % TEST_MAX_PAGES + 1,
+				      TEST_LIMIT_PFN, true);
+		if (!iovas[i]) {
+			ret = -ENOSPC;
+			goto out_put;
+		}
+		cond_resched();
+	}
+	for (i = 0; i < live; i += 2) {
+		__free_iova(iovad, iovas[i]);
+		iovas[i] = NULL;
+	}
+
+	/* Each allocation replaces a random live or freed one */
+	for (i = 0; i < nr_measure; i++) {
+		unsigned long size = prandom_u32_state(&rnd) % TEST_MAX_PAGES + 1;
+		unsigned long expected;
+		struct iova *iova;
+		ktime_t start;
+		u64 ns;
+
+		idx = prandom_u32_state(&rnd) % live;
+		if (iovas[idx]) {
+			__free_iova(iovad, iovas[idx]);
+			iovas[idx] = NULL;
+		}
+
+		expected = test_best_fit(iovad, size);
+		start = ktime_get();
+		iova = alloc_iova(iovad, size, TEST_LIMIT_PFN, true);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		total_ns += ns;
+		max_ns = max(max_ns, ns);
+		if (!iova)
+			failed++;
+		else if (iova->pfn_lo != expected)
+			misplaced++;
+		iovas[idx] = iova;
+		cond_resched();
+	}
+
+	pr_info("live=%u allocs=%u avg_ns=%llu max_ns=%llu misplaced=%u failed=%u overlaps=%u\n",
+		live, nr_measure, div_u64(total_ns, nr_measure), max_ns, misplaced, failed,
+		test_check_domain(iovad));
+	if (misplaced || failed)
+		ret = -EIO;
+
+out_put:
+	for (i = 0; i < live; i++)
+		if (iovas[i])
+			__free_iova(iovad, iovas[i]);
+	put_iova_domain(iovad);
+out_free:
+	kvfree(iovas);
+	kfree(iovad);
+
+	return ret;
+}
+
+static int test_run_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int nr_measure, i;
+	int ret;
+
+	ret = kstrtouint(val, 0, &nr_measure);
+	if (ret)
+		return ret;
+	if (!nr_measure)
+		return -EINVAL;
+
+	ret = iova_cache_get();
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ARRAY_SIZE(test_live); i++) {
+		ret = test_run_one(test_live[i], nr_measure);
+		if (ret) {
+			pr_err("%u live IOVAs failed: %d\n", test_live[i], ret);
+			break;
+		}
+	}
+
+	iova_cache_put();
+	return ret;
+}
+
+static const struct kernel_param_ops test_run_ops = {
+	.set = test_run_set,
+};
+
+/* Runs serialize on the module's parameter lock */
+module_param_cb(run, &test_run_ops, NULL, 0200);
+MODULE_PARM_DESC(run, "number of allocations to measure per step");
+
+MODULE_SOFTDEP("pre: iovad-best-fit-algo");
+MODULE_DESCRIPTION("Stress test of the best fit IOVA allocation");
+MODULE_LICENSE("GPL");
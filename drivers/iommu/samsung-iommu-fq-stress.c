@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Stress test of DMA map and unmap on a device behind a SysMMU
+ *
+ * Writing the maximum number of CPUs into the fq_stress_run parameter of
+ * the SysMMU driver maps and unmaps scatterlists of 1 to 32 pages for
+ * fq_stress_dev on 1, 2, ... up to that many online CPUs for
+ * fq_stress_duration_ms each, in the strict or the lazy (flush queue) mode
+ * the domain is in. The domain is in the lazy mode if the kernel is booted
+ * with iommu.strict=0.
+ *
+ * Each new mapping is checked in the page table. The page table can't show
+ * a stale TLB entry though, so every unmapped IOVA range is also recorded
+ * with the number of TLB invalidations the SysMMUs of the device had issued
+ * before the unmap. An IOVA must not be handed out again before its TLB
+ * entries are invalidated, so when a new mapping overlaps a recorded range,
+ * the SysMMUs must have issued an invalidation since. The map and unmap rate,
+ * the latency and the number of page table mismatches and of IOVAs reused
+ * without an invalidation per CPU count are printed to the kernel log.
+ *
+ * E.g.,
+ * echo 17000000.example > /sys/module/samsung_iommu/parameters/fq_stress_dev
+ * echo 8 > /sys/module/samsung_iommu/parameters/fq_stress_run
+ */
+
+#define pr_fmt(fmt) "SysMMU FQ stress: " fmt
+
+#include <linux/cpumask.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/iommu.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
+#include <linux/prandom.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "samsung-iommu-fq-stress.h"
+
+#define FQ_STRESS_MAX_PAGES	32
+#define FQ_STRESS_LIVE		16
+#define FQ_STRESS_UNMAPPED	256
+
+static char *fq_stress_dev;
+module_param(fq_stress_dev, charp, 0644);
+MODULE_PARM_DESC(fq_stress_dev, "name of the platform device behind the SysMMU to map for");
+
+static unsigned int fq_stress_duration_ms = 1000;
+module_param(fq_stress_duration_ms, uint, 0644);
+MODULE_PARM_DESC(fq_stress_duration_ms, "map and unmap duration per CPU count");
+
+struct fq_stress_map {
+	struct scatterlist sgl[FQ_STRESS_MAX_PAGES];
+	unsigned int nents;
+	dma_addr_t start;
+	dma_addr_t end;
+};
+
+/* An unmapped IOVA range and the invalidations issued before the unmap */
+struct fq_stress_unmapped {
+	dma_addr_t start;
+	dma_addr_t end;
+	u64 inv_count;
+};
+
+struct fq_stress {
+	struct device *dev;
+	struct iommu_domain *domain;
+	ktime_t deadline;
+	spinlock_t lock; /* Protects .unmapped and .next */
+	struct fq_stress_unmapped unmapped[FQ_STRESS_UNMAPPED];
+	unsigned int next;
+};
+
+struct fq_stress_work {
+	struct work_struct work;
+	struct fq_stress *stress;
+	u64 seed;
+	unsigned long ops;
+	u64 total_ns;
+	u64 max_ns;
+	unsigned long mismatches;
+	unsigned long stale;
+	int err;
+};
+
+static u64 fq_stress_inv_count(struct fq_stress *stress)
+{
+	u64 count = 0;
+
+	WARN_ON(samsung_sysmmu_inv_count(stress->dev, &count));
+	return count;
+}
+
+static void fq_stress_unmap(struct fq_stress *stress, struct fq_stress_map *map)
+{
+	struct fq_stress_unmapped *unmapped;
+	unsigned long flags;
+	u64 inv_count;
+
+	if (!map->nents)
+		return;
+
+	/* Any invalidation of the range comes after this */
+	inv_count = fq_stress_inv_count(stress);
+	dma_unmap_sg(stress->dev, map->sgl, map->nents, DMA_BIDIRECTIONAL);
+	map->nents = 0;
+
+	spin_lock_irqsave(&stress->lock, flags);
+	unmapped = &stress->unmapped[stress->next++ % FQ_STRESS_UNMAPPED];
+	unmapped->start = map->start;
+	unmapped->end = map->end;
+	unmapped->inv_count = inv_count;
+	spin_unlock_irqrestore(&stress->lock, flags);
+}
+
+/* Returns the number of recorded ranges @map reuses without an invalidation */
+static unsigned int fq_stress_check_reuse(struct fq_stress *stress, struct fq_stress_map *map)
+{
+	struct fq_stress_unmapped *unmapped;
+	unsigned int i, stale = 0;
+	unsigned long flags;
+	u64 inv_count;
+
+	inv_count = fq_stress_inv_count(stress);
+
+	spin_lock_irqsave(&stress->lock, flags);
+	for (i = 0; i < FQ_STRESS_UNMAPPED; i++) {
+		unmapped = &stress->unmapped[i];
+		if (unmapped->start >= map->end || unmapped->end <= map->start)
+			continue;
+		if (inv_count <= unmapped->inv_count)
+			stale++;
+		/* The range is live again */
+		unmapped->start = 0;
+		unmapped->end = 0;
+	}
+	spin_unlock_irqrestore(&stress->lock, flags);
+
+	return stale;
+}
+
+/* Maps @nents of the pages and returns false if the page table disagrees */
+static bool fq_stress_map(struct fq_stress_work *sw, struct fq_stress_map *map,
+			  struct page **pages, unsigned int nents)
+{
+	struct fq_stress *stress = sw->stress;
+	struct scatterlist *sg;
+	unsigned int i;
+	int count;
+
+	sg_init_table(map->sgl, nents);
+	for_each_sg(map->sgl, sg, nents, i)
+		sg_set_page(sg, pages[i], PAGE_SIZE, 0);
+
+	count = dma_map_sg(stress->dev, map->sgl, nents, DMA_BIDIRECTIONAL);
+	if (!count)
+		return false;
+	map->nents = nents;
+
+	map->start = sg_dma_address(map->sgl);
+	map->end = map->start;
+	for_each_sg(map->sgl, sg, count, i) {
+		map->start = min(map->start, sg_dma_address(sg));
+		map->end = max(map->end, sg_dma_address(sg) + sg_dma_len(sg));
+	}
+	sw->stale += fq_stress_check_reuse(stress, map);
+
+	return iommu_iova_to_phys(stress->domain, sg_dma_address(map->sgl)) ==
+	       page_to_phys(pages[0]);
+}
+
+static void fq_stress_work_fn(struct work_struct *work)
+{
+	struct fq_stress_work *sw = container_of(work, typeof(*sw), work);
+	struct page *pages[FQ_STRESS_MAX_PAGES] = {};
+	struct fq_stress_map *maps;
+	struct rnd_state rnd;
+	unsigned int i;
+
+	maps = kcalloc(FQ_STRESS_LIVE, sizeof(*maps), GFP_KERNEL);
+	if (!maps) {
+		sw->err = -ENOMEM;
+		return;
+	}
+
+	for (i = 0; i < FQ_STRESS_MAX_PAGES; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			sw->err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	prandom_seed_state(&rnd, sw->seed);
+	while (ktime_before(ktime_get(), sw->stress->deadline)) {
+		struct fq_stress_map *map = &maps[prandom_u32_state(&rnd) % FQ_STRESS_LIVE];
+		unsigned int nents = prandom_u32_state(&rnd) % FQ_STRESS_MAX_PAGES + 1;
+		ktime_t start;
+		u64 ns;
+
+		start = ktime_get();
+		fq_stress_unmap(sw->stress, map);
+		if (!fq_stress_map(sw, map, pages, nents))
+			sw->mismatches++;
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		sw->total_ns += ns;
+		sw->max_ns = max(sw->max_ns, ns);
+		sw->ops++;
+	}
+
+out:
+	for (i = 0; i < FQ_STRESS_LIVE; i++)
+		fq_stress_unmap(sw->stress, &maps[i]);
+	for (i = 0; i < FQ_STRESS_MAX_PAGES; i++)
+		if (pages[i])
+			__free_page(pages[i]);
+	kfree(maps);
+}
+
+static int fq_stress_run_cpus(struct fq_stress *stress, struct workqueue_struct *wq,
+			      struct fq_stress_work *works, unsigned int nr_cpus)
+{
+	unsigned long ops = 0, mismatches = 0, stale = 0;
+	u64 total_ns = 0, max_ns = 0;
+	unsigned int i = 0;
+	int cpu, err = 0;
+
+	memset(works, 0, nr_cpus * sizeof(*works));
+	stress->deadline = ktime_add_ms(ktime_get(), fq_stress_duration_ms);
+
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		if (i == nr_cpus)
+			break;
+		INIT_WORK(&works[i].work, fq_stress_work_fn);
+		works[i].stress = stress;
+		works[i].seed = cpu;
+		queue_work_on(cpu, wq, &works[i].work);
+		i++;
+	}
+	cpus_read_unlock();
+
+	for (i = 0; i < nr_cpus; i++) {
+		flush_work(&works[i].work);
+		if (works[i].err)
+			err = works[i].err;
+		ops += works[i].ops;
+		total_ns += works[i].total_ns;
+		max_ns = max(max_ns, works[i].max_ns);
+		mismatches += works[i].mismatches;
+		stale += works[i].stale;
+	}
+	if (err)
+		return err;
+
+	ops = max(ops, 1UL);
+	pr_info("cpus=%u maps/s=%llu avg_ns=%llu max_ns=%llu mismatches=%lu stale=%lu\n",
+		nr_cpus, div_u64((u64)ops * MSEC_PER_SEC, max(fq_stress_duration_ms, 1U)),
+		div64_u64(total_ns, ops), max_ns, mismatches, stale);
+
+	return (mismatches || stale) ? -EIO : 0;
+}
+
+static int fq_stress_run(unsigned int max_cpus)
+{
+	struct workqueue_struct *wq;
+	struct fq_stress_work *works;
+	struct fq_stress *stress;
+	unsigned int nr_cpus;
+	u64 inv_count;
+	int err;
+
+	max_cpus = min(max_cpus, num_online_cpus());
+	if (!max_cpus || !fq_stress_dev)
+		return -EINVAL;
+
+	stress = kzalloc(sizeof(*stress), GFP_KERNEL);
+	works = kcalloc(max_cpus, sizeof(*works), GFP_KERNEL);
+	wq = alloc_workqueue("sysmmu_fq_stress", WQ_HIGHPRI | WQ_CPU_INTENSIVE, 0);
+	if (!stress || !works || !wq) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+	spin_lock_init(&stress->lock);
+
+	stress->dev = bus_find_device_by_name(&platform_bus_type, NULL, fq_stress_dev);
+	if (!stress->dev) {
+		pr_err("cannot find %s\n", fq_stress_dev);
+		err = -ENODEV;
+		goto out_free;
+	}
+
+	stress->domain = iommu_get_domain_for_dev(stress->dev);
+	if (!stress->domain || !(stress->domain->type & __IOMMU_DOMAIN_DMA_API) ||
+	    samsung_sysmmu_inv_count(stress->dev, &inv_count)) {
+		pr_err("%s isn't behind a SysMMU DMA domain of this driver\n", fq_stress_dev);
+		err = -ENODEV;
+		goto out_put;
+	}
+
+	/* Invalidations are only issued, and counted, while the SysMMUs are on */
+	err = pm_runtime_resume_and_get(stress->dev);
+	if (err)
+		goto out_put;
+
+	pr_info("%s in the %s mode\n", fq_stress_dev,
+		stress->domain->type == IOMMU_DOMAIN_DMA_FQ ? "lazy" : "strict");
+
+	for (nr_cpus = 1; nr_cpus <= max_cpus; nr_cpus++) {
+		err = fq_stress_run_cpus(stress, wq, works, nr_cpus);
+		if (err) {
+			pr_err("run failed on %u cpus: %d\n", nr_cpus, err);
+			break;
+		}
+	}
+
+	pm_runtime_put(stress->dev);
+out_put:
+	put_device(stress->dev);
+out_free:
+	if (wq)
+		destroy_workqueue(wq);
+	kfree(works);
+	kfree(stress);
+	return err;
+}
+
+static int fq_stress_run_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int max_cpus;
+	int ret;
+
+	ret = kstrtouint(val, 0, &max_cpus);
+	if (ret)
+		return ret;
+
+	return fq_stress_run(max_cpus);
+}
+
+static const struct kernel_param_ops fq_stress_run_ops = {
+	.set = fq_stress_run_set,
+};
+
+/* Runs serialize on the module's parameter lock */
+module_param_cb(fq_stress_run, &fq_stress_run_ops, NULL, 0200);
+MODULE_PARM_DESC(fq_stress_run, "maximum number of CPUs to map and unmap on");
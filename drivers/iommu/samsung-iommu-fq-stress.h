@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef __SAMSUNG_IOMMU_FQ_STRESS_H
+#define __SAMSUNG_IOMMU_FQ_STRESS_H
+
+#include <linux/device.h>
+
+/* Provided by the SysMMU driver the stress test is linked into */
+int samsung_sysmmu_inv_count(struct device *dev, u64 *count);
+
+#endif /* __SAMSUNG_IOMMU_FQ_STRESS_H */
@@ -9,11 +9,13 @@
 #include <linux/of_platform.h>
 #include <linux/platform_device.h>
 #include <linux/pm_runtime.h>
+#include <linux/sizes.h>
 #include <linux/dma-mapping.h>
 #include <linux/sched/clock.h>
 #include <linux/slab.h>
 
 #include "samsung-iommu-v9.h"
+#include "samsung-iommu-fq-stress.h"
 #include <soc/google/debug-snapshot.h>
 #include <soc/google/pkvm-s2mpu.h>
 
@@ -43,6 +45,9 @@
 #define DEFAULT_STREAM_NONE	~0U
 #define UNUSED_STREAM_INDEX	~0U
 
+#define SYSMMU_FQ_RANGE_INV_MAX	SZ_64M
+#define SYSMMU_FQ_MAX_RANGES	8
+
 #define MMU_STREAM_CFG_MASK(reg)		((reg) & (GENMASK(31, 16) | GENMASK(8, 8) | \
 						 GENMASK(6, 0)))
 #define MMU_STREAM_MATCH_CFG_MASK(reg)		((reg) & (GENMASK(9, 8) | GENMASK(0, 0)))
@@ -50,6 +55,11 @@
 static struct iommu_ops samsung_sysmmu_ops;
 static struct platform_driver samsung_sysmmu_driver_v9;
 
+struct sysmmu_fq_range {
+	unsigned long start;
+	unsigned long end;
+};
+
 struct samsung_sysmmu_domain {
 	struct iommu_domain domain;
 	struct iommu_group *group;
@@ -59,6 +69,14 @@ struct samsung_sysmmu_domain {
 	sysmmu_pte_t *page_table;
 	atomic_t *lv2entcnt;
 	spinlock_t pgtablelock;	/* spinlock to access pagetable	*/
+	/* ranges unmapped in the flush queue mode, invalidated on flush_iotlb_all */
+	spinlock_t fq_lock;
+	struct sysmmu_fq_range fq_range[SYSMMU_FQ_MAX_RANGES];
+	unsigned int fq_nr;	/* number of disjoint ranges in fq_range */
+	unsigned int fq_unmaps;	/* number of unmaps merged into fq_range */
+	atomic_t sync_unmaps;	/* number of unmaps gathered for iotlb_sync */
+	unsigned long fq_size;	/* total size of fq_range */
+	bool fq_all;		/* too many or too large ranges, invalidate all */
 	bool ap_read_implies_write;
 	bool ap_permissive;
 };
@@ -300,6 +318,7 @@ static struct iommu_domain *samsung_sysmmu_domain_alloc(unsigned int type)
 
 	if (type != IOMMU_DOMAIN_UNMANAGED &&
 	    type != IOMMU_DOMAIN_DMA &&
+	    type != IOMMU_DOMAIN_DMA_FQ &&
 	    type != IOMMU_DOMAIN_IDENTITY) {
 		pr_err("invalid domain type %u\n", type);
 		return NULL;
@@ -321,6 +340,7 @@ static struct iommu_domain *samsung_sysmmu_domain_alloc(unsigned int type)
 	pgtable_flush(domain->page_table, domain->page_table + NUM_LV1ENTRIES);
 
 	spin_lock_init(&domain->pgtablelock);
+	spin_lock_init(&domain->fq_lock);
 
 	return &domain->domain;
 
@@ -632,10 +652,20 @@ static int lv1set_section(struct samsung_sysmmu_domain *domain,
 	return 0;
 }
 
-static int lv2set_page(struct samsung_sysmmu_domain *domain, sysmmu_pte_t *pent, phys_addr_t paddr,
-		       size_t size, int prot, atomic_t *pgcnt)
+/*
+ * Fills @count pages of @size in a second level table in one pass. The
+ * table is flushed by iotlb_sync_map.
+ */
+static int lv2set_pages(struct samsung_sysmmu_domain *domain, sysmmu_pte_t *pent,
+			phys_addr_t paddr, size_t size, size_t count, int prot,
+			atomic_t *pgcnt, size_t *mapped)
 {
 	int attr = !!(prot & IOMMU_CACHE) ? SLPD_SHAREABLE_FLAG : 0;
+	unsigned int flag = size == SPAGE_SIZE ? SPAGE_FLAG : LPAGE_FLAG;
+	unsigned int nent = size == SPAGE_SIZE ? 1 : SPAGES_PER_LPAGE;
+	unsigned int i;
+	size_t done;
+	int ret = 0;
 
 	if (prot & IOMMU_READ || domain->ap_permissive) {
 		attr |= SLPD_AP_READ;
@@ -645,70 +675,137 @@ static int lv2set_page(struct samsung_sysmmu_domain *domain, sysmmu_pte_t *pent,
 	if (prot & IOMMU_WRITE || domain->ap_permissive)
 		attr |= SLPD_AP_WRITE;
 
-	if (size == SPAGE_SIZE) {
-		if (WARN_ON(!lv2ent_unmapped(pent)))
-			return -EADDRINUSE;
-
-		*pent = make_sysmmu_pte(paddr, SPAGE_FLAG, attr);
-		atomic_inc(pgcnt);
-	} else {	/* size == LPAGE_SIZE */
-		unsigned long i;
-
-		for (i = 0; i < SPAGES_PER_LPAGE; i++, pent++) {
+	for (done = 0; done < count; done++, paddr += size) {
+		for (i = 0; i < nent; i++, pent++) {
 			if (WARN_ON(!lv2ent_unmapped(pent))) {
 				clear_page_table(pent - i, i);
-				return -EADDRINUSE;
+				ret = -EADDRINUSE;
+				goto out;
 			}
 
-			*pent = make_sysmmu_pte(paddr, LPAGE_FLAG, attr);
+			*pent = make_sysmmu_pte(paddr, flag, attr);
 		}
-		atomic_add(SPAGES_PER_LPAGE, pgcnt);
 	}
 
-	return 0;
+out:
+	atomic_add(done * nent, pgcnt);
+	*mapped += done * size;
+
+	return ret;
 }
 
-static int samsung_sysmmu_map(struct iommu_domain *dom, unsigned long l_iova, phys_addr_t paddr,
-			      size_t size, int prot, gfp_t unused)
+static int samsung_sysmmu_map_pages(struct iommu_domain *dom, unsigned long l_iova,
+				    phys_addr_t paddr, size_t pgsize, size_t pgcount,
+				    int prot, gfp_t unused, size_t *mapped)
 {
 	struct samsung_sysmmu_domain *domain = to_sysmmu_domain(dom);
 	sysmmu_iova_t iova = (sysmmu_iova_t)l_iova;
-	atomic_t *lv2entcnt = &domain->lv2entcnt[lv1ent_offset(iova)];
-	sysmmu_pte_t *entry;
-	int ret = -ENOMEM;
+	sysmmu_pte_t *sent, *pent;
+	atomic_t *lv2entcnt;
+	size_t count;
+	int ret = 0;
 
 	/* Do not use IO coherency if iOMMU_PRIV exists */
 	if (!!(prot & IOMMU_PRIV))
 		prot &= ~IOMMU_CACHE;
 
-	entry = section_entry(domain->page_table, iova);
+	while (pgcount) {
+		sent = section_entry(domain->page_table, iova);
+		lv2entcnt = &domain->lv2entcnt[lv1ent_offset(iova)];
 
-	if (size == SECT_SIZE) {
-		ret = lv1set_section(domain, entry, iova, paddr, prot, lv2entcnt);
-	} else {
-		sysmmu_pte_t *pent;
+		if (pgsize == SECT_SIZE) {
+			ret = lv1set_section(domain, sent, iova, paddr, prot, lv2entcnt);
+			if (ret)
+				break;
+			count = 1;
+			*mapped += SECT_SIZE;
+		} else {
+			/* the pages up to the end of the second level table */
+			count = (((iova + SECT_SIZE) & SECT_MASK) - iova) / pgsize;
+			count = min(count, pgcount);
+
+			pent = alloc_lv2entry(domain, sent, iova, lv2entcnt);
+			if (IS_ERR(pent)) {
+				ret = PTR_ERR(pent);
+				break;
+			}
 
-		pent = alloc_lv2entry(domain, entry, iova, lv2entcnt);
+			ret = lv2set_pages(domain, pent, paddr, pgsize, count, prot,
+					   lv2entcnt, mapped);
+			if (ret)
+				break;
+		}
 
-		if (IS_ERR(pent))
-			ret = PTR_ERR(pent);
-		else
-			ret = lv2set_page(domain, pent, paddr, size, prot, lv2entcnt);
+		iova += count * pgsize;
+		paddr += count * pgsize;
+		pgcount -= count;
 	}
 
 	if (ret)
-		pr_err("failed to map %#zx @ %#llx, ret:%d\n", size, iova, ret);
+		pr_err("failed to map %zu pages of %#zx @ %#llx, ret:%d\n",
+		       pgcount, pgsize, iova, ret);
 
 	return ret;
 }
 
+/*
+ * In the flush queue mode, the IOVA isn't reused until the next flush_iotlb_all,
+ * so the unmapped ranges are kept until the flush. Overlapping or adjacent ranges
+ * are merged and the flush invalidates all if the ranges don't fit.
+ */
+static void samsung_sysmmu_fq_add_range(struct samsung_sysmmu_domain *domain,
+					unsigned long iova, size_t size)
+{
+	unsigned long start = iova, end = iova + size - 1;
+	struct sysmmu_fq_range *range;
+	unsigned long flags;
+	unsigned int i = 0;
+
+	spin_lock_irqsave(&domain->fq_lock, flags);
+	domain->fq_unmaps++;
+	if (domain->fq_all)
+		goto out;
+
+	while (i < domain->fq_nr) {
+		range = &domain->fq_range[i];
+		if (range->start > end + 1 || range->end + 1 < start) {
+			i++;
+			continue;
+		}
+		start = min(start, range->start);
+		end = max(end, range->end);
+		domain->fq_size -= range->end - range->start + 1;
+		*range = domain->fq_range[--domain->fq_nr];
+	}
+
+	if (domain->fq_nr == SYSMMU_FQ_MAX_RANGES ||
+	    domain->fq_size + (end - start + 1) > SYSMMU_FQ_RANGE_INV_MAX) {
+		domain->fq_all = true;
+		goto out;
+	}
+
+	range = &domain->fq_range[domain->fq_nr++];
+	range->start = start;
+	range->end = end;
+	domain->fq_size += end - start + 1;
+out:
+	spin_unlock_irqrestore(&domain->fq_lock, flags);
+}
+
 static inline void samsung_sysmmu_iotlb_gather_add_joint_range(struct iommu_domain *domain,
 					       struct iommu_iotlb_gather *gather,
 					       unsigned long iova, size_t size)
 {
+	if (iommu_iotlb_gather_queued(gather)) {
+		samsung_sysmmu_fq_add_range(to_sysmmu_domain(domain), iova, size);
+		return;
+	}
+
 	if (iommu_iotlb_gather_is_disjoint(gather, iova, size))
 		iommu_iotlb_sync(domain, gather);
 	iommu_iotlb_gather_add_range(gather, iova, size);
+	/* after the sync of a disjoint gather, it belongs to the next one */
+	atomic_inc(&to_sysmmu_domain(domain)->sync_unmaps);
 }
 
 static size_t samsung_sysmmu_unmap(struct iommu_domain *dom, unsigned long l_iova, size_t size,
@@ -853,18 +950,83 @@ size_t samsung_sysmmu_unmap_pages(struct iommu_domain *dom, unsigned long iova_o
 	return size;
 }
 
+static void __samsung_sysmmu_invalidate_range(struct samsung_sysmmu_domain *domain,
+					      unsigned long start, unsigned long end,
+					      unsigned int ranges)
+{
+	unsigned long flags;
+	struct sysmmu_drvdata *drvdata;
+
+	if (domain->vm_sysmmu) {
+		/* Domain is used as PASID domain */
+		drvdata = domain->vm_sysmmu;
+		spin_lock_irqsave(&drvdata->lock, flags);
+		if (drvdata->attached_count && drvdata->rpm_count > 0) {
+			__sysmmu_invalidate_vid(drvdata, domain->vid, start, end);
+			drvdata->range_inv_cnt++;
+			drvdata->inv_range_cnt += ranges;
+		}
+		spin_unlock_irqrestore(&drvdata->lock, flags);
+	} else if (domain->group) {
+		/* Domain is used as regular domain */
+		/*
+		 * domain->group might be NULL if iotlb_sync is called
+		 * before attach_dev. Just ignore it.
+		 */
+		struct list_head *sysmmu_list = iommu_group_get_iommudata(domain->group);
+
+		list_for_each_entry(drvdata, sysmmu_list, list) {
+			spin_lock_irqsave(&drvdata->lock, flags);
+			if (drvdata->attached_count && drvdata->rpm_count > 0) {
+				__sysmmu_invalidate(drvdata, start, end);
+				drvdata->range_inv_cnt++;
+				drvdata->inv_range_cnt += ranges;
+			}
+			spin_unlock_irqrestore(&drvdata->lock, flags);
+		}
+	}
+}
+
 static void samsung_sysmmu_flush_iotlb_all(struct iommu_domain *dom)
 {
 	unsigned long flags;
 	struct samsung_sysmmu_domain *domain = to_sysmmu_domain(dom);
 	struct sysmmu_drvdata *drvdata;
+	struct sysmmu_fq_range range[SYSMMU_FQ_MAX_RANGES];
+	unsigned int i, nr = 0, ranges;
+
+	spin_lock_irqsave(&domain->fq_lock, flags);
+	ranges = domain->fq_unmaps;
+	if (dom->type == IOMMU_DOMAIN_DMA_FQ && !domain->fq_all) {
+		nr = domain->fq_nr;
+		memcpy(range, domain->fq_range, nr * sizeof(*range));
+	}
+	domain->fq_nr = 0;
+	domain->fq_unmaps = 0;
+	domain->fq_size = 0;
+	domain->fq_all = false;
+	spin_unlock_irqrestore(&domain->fq_lock, flags);
+
+	/*
+	 * Only the flush queue leaves queued ranges, and every other unmap of the
+	 * domain is invalidated by iotlb_sync. Any other flush invalidates all.
+	 */
+	if (nr) {
+		for (i = 0; i < nr; i++)
+			__samsung_sysmmu_invalidate_range(domain, range[i].start, range[i].end,
+							  i ? 0 : ranges);
+		return;
+	}
 
 	if (domain->vm_sysmmu) {
 		/* Domain is used as PASID domain */
 		drvdata = domain->vm_sysmmu;
 		spin_lock_irqsave(&drvdata->lock, flags);
-		if (drvdata->attached_count && drvdata->rpm_count > 0)
+		if (drvdata->attached_count && drvdata->rpm_count > 0) {
 			__sysmmu_invalidate_all_vid(drvdata, domain->vid);
+			drvdata->all_inv_cnt++;
+			drvdata->inv_range_cnt += ranges;
+		}
 		spin_unlock_irqrestore(&drvdata->lock, flags);
 	} else if (domain->group) {
 		/* Domain is used as regular domain */
@@ -876,8 +1038,11 @@ static void samsung_sysmmu_flush_iotlb_all(struct iommu_domain *dom)
 
 		list_for_each_entry(drvdata, sysmmu_list, list) {
 			spin_lock_irqsave(&drvdata->lock, flags);
-			if (drvdata->attached_count && drvdata->rpm_count > 0)
+			if (drvdata->attached_count && drvdata->rpm_count > 0) {
 				__sysmmu_invalidate_all(drvdata);
+				drvdata->all_inv_cnt++;
+				drvdata->inv_range_cnt += ranges;
+			}
 			spin_unlock_irqrestore(&drvdata->lock, flags);
 		}
 	}
@@ -913,32 +1078,11 @@ next_section:
 
 static void samsung_sysmmu_iotlb_sync(struct iommu_domain *dom, struct iommu_iotlb_gather *gather)
 {
-	unsigned long flags;
 	struct samsung_sysmmu_domain *domain = to_sysmmu_domain(dom);
-	struct sysmmu_drvdata *drvdata;
 
-	if (domain->vm_sysmmu) {
-		/* Domain is used as PASID domain */
-		drvdata = domain->vm_sysmmu;
-		spin_lock_irqsave(&drvdata->lock, flags);
-		if (drvdata->attached_count && drvdata->rpm_count > 0)
-			__sysmmu_invalidate_vid(drvdata, domain->vid, gather->start, gather->end);
-		spin_unlock_irqrestore(&drvdata->lock, flags);
-	} else if (domain->group) {
-		/* Domain is used as regular domain */
-		/*
-		 * domain->group might be NULL if iotlb_sync is called
-		 * before attach_dev. Just ignore it.
-		 */
-		struct list_head *sysmmu_list = iommu_group_get_iommudata(domain->group);
-
-		list_for_each_entry(drvdata, sysmmu_list, list) {
-			spin_lock_irqsave(&drvdata->lock, flags);
-			if (drvdata->attached_count && drvdata->rpm_count > 0)
-				__sysmmu_invalidate(drvdata, gather->start, gather->end);
-			spin_unlock_irqrestore(&drvdata->lock, flags);
-		}
-	}
+	/* counted per unmap as in the flush queue mode, whichever sync ends up with it */
+	__samsung_sysmmu_invalidate_range(domain, gather->start, gather->end,
+					  atomic_xchg(&domain->sync_unmaps, 0));
 }
 
 static phys_addr_t samsung_sysmmu_iova_to_phys(struct iommu_domain *dom, dma_addr_t d_iova)
@@ -1376,7 +1520,7 @@ static struct iommu_ops samsung_sysmmu_ops = {
 		.attach_dev             = samsung_sysmmu_attach_dev,
 		.detach_dev             = samsung_sysmmu_detach_dev,
 		.set_dev_pasid		= samsung_sysmmu_set_dev_pasid,
-		.map                    = samsung_sysmmu_map,
+		.map_pages              = samsung_sysmmu_map_pages,
 		.unmap                  = samsung_sysmmu_unmap,
 		.unmap_pages            = samsung_sysmmu_unmap_pages,
 		.flush_iotlb_all        = samsung_sysmmu_flush_iotlb_all,
@@ -1548,6 +1692,57 @@ static int sysmmu_parse_dt(struct device *sysmmu, struct sysmmu_drvdata *data)
 	return ret;
 }
 
+#if IS_ENABLED(CONFIG_SAMSUNG_IOMMU_FQ_STRESS)
+/* Sum of the range invalidations and invalidate-alls of the SysMMUs of @dev */
+int samsung_sysmmu_inv_count(struct device *dev, u64 *count)
+{
+	struct iommu_fwspec *fwspec = dev_iommu_fwspec_get(dev);
+	struct sysmmu_clientdata *client;
+	struct sysmmu_drvdata *drvdata;
+	unsigned long flags;
+	int i;
+
+	if (!fwspec || fwspec->ops != &samsung_sysmmu_ops)
+		return -ENODEV;
+
+	*count = 0;
+	client = dev_iommu_priv_get(dev);
+	for (i = 0; i < (int)client->sysmmu_count; i++) {
+		drvdata = client->sysmmus[i];
+
+		spin_lock_irqsave(&drvdata->lock, flags);
+		*count += drvdata->range_inv_cnt + drvdata->all_inv_cnt;
+		spin_unlock_irqrestore(&drvdata->lock, flags);
+	}
+
+	return 0;
+}
+#endif
+
+/* range invalidations, invalidate-alls and the unmaps they covered */
+static ssize_t tlb_inv_stat_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct iommu_device *iommu = dev_to_iommu_device(dev);
+	struct sysmmu_drvdata *data = container_of(iommu, struct sysmmu_drvdata, iommu);
+	u64 range_inv, all_inv, ranges;
+	unsigned long flags;
+
+	spin_lock_irqsave(&data->lock, flags);
+	range_inv = data->range_inv_cnt;
+	all_inv = data->all_inv_cnt;
+	ranges = data->inv_range_cnt;
+	spin_unlock_irqrestore(&data->lock, flags);
+
+	return sysfs_emit(buf, "%llu %llu %llu\n", range_inv, all_inv, ranges);
+}
+static DEVICE_ATTR_RO(tlb_inv_stat);
+
+static struct attribute *sysmmu_attrs[] = {
+	&dev_attr_tlb_inv_stat.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(sysmmu);
+
 static int samsung_sysmmu_init_global(void)
 {
 	int ret = 0;
@@ -1644,7 +1839,7 @@ static int samsung_sysmmu_device_probe(struct platform_device *pdev)
 	if (ret)
 		goto err_get_hw_info;
 
-	ret = iommu_device_sysfs_add(&data->iommu, data->dev, NULL, dev_name(dev));
+	ret = iommu_device_sysfs_add(&data->iommu, data->dev, sysmmu_groups, dev_name(dev));
 	if (ret) {
 		dev_err(dev, "failed to register iommu in sysfs\n");
 		goto err_get_hw_info;
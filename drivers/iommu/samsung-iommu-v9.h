@@ -182,6 +182,10 @@ struct sysmmu_drvdata {
 	bool ap_permissive;
 	struct stream_props *props;
 	unsigned int panic_action;
+	/* TLB invalidations issued and the unmaps they covered */
+	u64 range_inv_cnt;
+	u64 all_inv_cnt;
+	u64 inv_range_cnt;
 };
 
 struct sysmmu_clientdata {
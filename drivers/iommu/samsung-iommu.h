@@ -54,6 +54,10 @@ struct sysmmu_drvdata {
 	bool async_fault_mode;
 	bool hide_page_fault;
 	unsigned int panic_action;
+	/* TLB invalidations issued and the unmaps they covered */
+	u64 range_inv_cnt;
+	u64 all_inv_cnt;
+	u64 inv_range_cnt;
 };
 
 struct sysmmu_clientdata {
@@ -674,6 +674,7 @@ static int mfc_core_probe(struct platform_device *pdev)
 
 	atomic_set(&core->qos_req_cur, 0);
 	mutex_init(&core->qos_mutex);
+	mfc_core_qos_ctrl_init(core);
 
 	mfc_core_info("[QoS] control: mfc_freq(%d), mo(%d), bw(%d)\n",
 			core->core_pdata->mfc_freq_control,
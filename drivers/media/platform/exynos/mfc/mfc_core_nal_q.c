@@ -178,6 +178,7 @@ void mfc_core_nal_q_clock_on(struct mfc_core *core, nal_queue_handle *nal_q_hand
 		mfc_core_pm_clock_on(core);
 
 	nal_q_handle->nal_q_clk_cnt++;
+	mfc_perf_nal_q_in(core, ctx_num);
 
 	core_ctx = core->core_ctx[ctx_num];
 	if (!core_ctx) {
@@ -219,6 +220,7 @@ void mfc_core_nal_q_clock_off(struct mfc_core *core, nal_queue_handle *nal_q_han
 	}
 
 	nal_q_handle->nal_q_clk_cnt--;
+	mfc_perf_nal_q_out(core, ctx_num);
 
 	core_ctx = core->core_ctx[ctx_num];
 	if (!core_ctx) {
@@ -254,6 +256,7 @@ void mfc_core_nal_q_cleanup_clock(struct mfc_core *core)
 	spin_lock_irqsave(&core->nal_q_handle->lock, flags);
 
 	core->nal_q_handle->nal_q_clk_cnt = 0;
+	mfc_perf_nal_q_reset(core);
 
 	spin_unlock_irqrestore(&core->nal_q_handle->lock, flags);
 
@@ -562,7 +562,7 @@ int mfc_core_instance_deinit(struct mfc_core *core, struct mfc_ctx *ctx)
 	core->core_ctx[core_ctx->num] = 0;
 	kfree(core_ctx);
 
-	mfc_perf_print();
+	mfc_perf_print(core, ctx->num);
 
 	return 0;
 
@@ -116,6 +116,21 @@ void mfc_core_perf_boost_disable(struct mfc_core *core)
 	}
 }
 
+static void __mfc_qos_ctrl_reset(struct mfc_core *core)
+{
+	struct mfc_qos_ctrl *ctrl = &core->qos_ctrl;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctrl->lock, flags);
+	memset(ctrl->hw_us, 0, sizeof(ctrl->hw_us));
+	memset(ctrl->load, 0, sizeof(ctrl->load));
+	ctrl->total_load = 0;
+	ctrl->up_cnt = 0;
+	ctrl->down_cnt = 0;
+	ctrl->offset = 0;
+	spin_unlock_irqrestore(&ctrl->lock, flags);
+}
+
 static void __mfc_qos_operate(struct mfc_core *core, int opr_type, int table_type, int idx)
 {
 	struct mfc_core_platdata *pdata = core->core_pdata;
@@ -251,6 +266,7 @@ static void __mfc_qos_operate(struct mfc_core *core, int opr_type, int table_typ
 		}
 #endif
 
+		__mfc_qos_ctrl_reset(core);
 		atomic_set(&core->qos_req_cur, 0);
 		MFC_TRACE_CORE("QoS remove\n");
 		mfc_core_debug(2, "[QoS] QoS remove\n");
@@ -272,6 +288,170 @@ static void __mfc_qos_operate(struct mfc_core *core, int opr_type, int table_typ
 	}
 }
 
+/*
+ * Returns the QoS table index to be applied instead of @idx chosen by the
+ * MB estimation. The offset of the closed-loop control is kept while the
+ * same table is used.
+ */
+static int __mfc_qos_ctrl_get_idx(struct mfc_core *core, int table_type,
+		int idx, int num_qos_steps)
+{
+	struct mfc_qos_ctrl *ctrl = &core->qos_ctrl;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctrl->lock, flags);
+	if (ctrl->table_type != table_type || !qos_ctrl_enable)
+		ctrl->offset = 0;
+	ctrl->table_type = table_type;
+	ctrl->num_steps = num_qos_steps;
+	ctrl->base_idx = idx;
+	ctrl->offset = clamp(ctrl->offset, -idx, num_qos_steps - 1 - idx);
+	idx += ctrl->offset;
+	spin_unlock_irqrestore(&ctrl->lock, flags);
+
+	return idx;
+}
+
+static void __mfc_qos_ctrl_del(struct mfc_core *core, int ctx_num)
+{
+	struct mfc_qos_ctrl *ctrl = &core->qos_ctrl;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctrl->lock, flags);
+	ctrl->total_load -= ctrl->load[ctx_num];
+	ctrl->load[ctx_num] = 0;
+	ctrl->hw_us[ctx_num] = 0;
+	spin_unlock_irqrestore(&ctrl->lock, flags);
+}
+
+static void __mfc_qos_ctrl_worker(struct work_struct *work)
+{
+	struct mfc_core *core = container_of(work, struct mfc_core, qos_ctrl.work);
+	struct mfc_qos_ctrl *ctrl = &core->qos_ctrl;
+	unsigned long flags;
+	int table_type, idx, offset;
+	u32 load;
+
+	mutex_lock(&core->qos_mutex);
+	if (perf_boost_mode || !atomic_read(&core->qos_req_cur)) {
+		mutex_unlock(&core->qos_mutex);
+		return;
+	}
+
+	spin_lock_irqsave(&ctrl->lock, flags);
+	table_type = ctrl->table_type;
+	offset = ctrl->offset;
+	idx = ctrl->base_idx + offset;
+	load = ctrl->total_load;
+	spin_unlock_irqrestore(&ctrl->lock, flags);
+
+	if (atomic_read(&core->qos_req_cur) != (idx + 1)) {
+		MFC_TRACE_CORE("QoS ctrl - load: %u%%, table[%d] offset %d\n",
+				load, idx, offset);
+		mfc_core_debug(2, "[QoS][CTRL] load: %u%%, table[%d] offset %d\n",
+				load, idx, offset);
+		__mfc_qos_operate(core, MFC_QOS_UPDATE, table_type, idx);
+	}
+	mutex_unlock(&core->qos_mutex);
+}
+
+void mfc_core_qos_ctrl_init(struct mfc_core *core)
+{
+	spin_lock_init(&core->qos_ctrl.lock);
+	INIT_WORK(&core->qos_ctrl.work, __mfc_qos_ctrl_worker);
+}
+
+/*
+ * Called from the interrupt handler with the H/W time of a frame of
+ * @ctx_num. The load is the H/W time over the frame period given by the
+ * framerate of the instance, summed over the instances on the core.
+ * It steps up quickly not to drop frames and steps down slowly.
+ */
+void mfc_core_qos_ctrl_feedback(struct mfc_core *core, int ctx_num, u32 hw_ns)
+{
+	struct mfc_qos_ctrl *ctrl = &core->qos_ctrl;
+	struct mfc_core_ctx *core_ctx = core->core_ctx[ctx_num];
+	unsigned long flags;
+	u32 hw_us = hw_ns / NSEC_PER_USEC;
+	u32 load;
+	int offset;
+	bool update = false;
+
+	if (!qos_ctrl_enable || perf_boost_mode || !core_ctx ||
+			!atomic_read(&core->qos_req_cur))
+		return;
+
+	spin_lock_irqsave(&ctrl->lock, flags);
+	if (ctrl->hw_us[ctx_num])
+		hw_us = (ctrl->hw_us[ctx_num] * 3 + hw_us) / 4;
+	ctrl->hw_us[ctx_num] = hw_us;
+
+	/* framerate is fps * 1000, so the load in percent */
+	load = div_u64((u64)hw_us * core_ctx->ctx->framerate, 10000000);
+	ctrl->total_load += load - ctrl->load[ctx_num];
+	ctrl->load[ctx_num] = load;
+
+	offset = ctrl->offset;
+	if (ctrl->total_load >= qos_ctrl_up_load) {
+		ctrl->down_cnt = 0;
+		if (++ctrl->up_cnt >= qos_ctrl_up_frames) {
+			ctrl->up_cnt = 0;
+			offset++;
+		}
+	} else if (ctrl->total_load <= qos_ctrl_down_load) {
+		ctrl->up_cnt = 0;
+		if (++ctrl->down_cnt >= qos_ctrl_down_frames) {
+			ctrl->down_cnt = 0;
+			offset--;
+		}
+	} else {
+		ctrl->up_cnt = 0;
+		ctrl->down_cnt = 0;
+	}
+
+	offset = clamp(offset, -ctrl->base_idx,
+			ctrl->num_steps - 1 - ctrl->base_idx);
+	if (offset != ctrl->offset) {
+		if (offset > ctrl->offset)
+			ctrl->step_up++;
+		else
+			ctrl->step_down++;
+		ctrl->offset = offset;
+		update = true;
+	}
+	spin_unlock_irqrestore(&ctrl->lock, flags);
+
+	if (update)
+		queue_work(core->mfc_idle_wq, &ctrl->work);
+}
+
+void mfc_core_qos_ctrl_show(struct seq_file *s, struct mfc_core *core)
+{
+	struct mfc_qos_ctrl *ctrl = &core->qos_ctrl;
+	struct mfc_qos_ctrl state;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&ctrl->lock, flags);
+	state = *ctrl;
+	spin_unlock_irqrestore(&ctrl->lock, flags);
+
+	seq_printf(s, ">>> MFC core-%d QoS control (%s)\n", core->id,
+			qos_ctrl_enable ? "on" : "off");
+	seq_printf(s, " %s table[%d] + offset %d = table[%d] (current: %d)\n",
+			state.table_type ? "enc" : "default", state.base_idx,
+			state.offset, state.base_idx + state.offset,
+			atomic_read(&core->qos_req_cur) - 1);
+	seq_printf(s, " load: %u%% (up: %u%% x%u, down: %u%% x%u), step up: %lu, down: %lu\n",
+			state.total_load, qos_ctrl_up_load, qos_ctrl_up_frames,
+			qos_ctrl_down_load, qos_ctrl_down_frames,
+			state.step_up, state.step_down);
+	for (i = 0; i < MFC_NUM_CONTEXTS; i++)
+		if (state.hw_us[i])
+			seq_printf(s, " [ctx:%2d] hw: %u us, load: %u%%\n",
+					i, state.hw_us[i], state.load[i]);
+}
+
 #ifdef CONFIG_MFC_USE_BTS
 static void __mfc_qos_set(struct mfc_core *core, struct mfc_ctx *ctx,
 		struct bts_bw *curr_mfc_bw, int table_type, int i)
@@ -293,6 +473,8 @@ static void __mfc_qos_set(struct mfc_core *core, struct mfc_ctx *ctx,
 		qos_table = pdata->default_qos_table;
 	}
 
+	i = __mfc_qos_ctrl_get_idx(core, table_type, i, num_qos_steps);
+
 	mfc_debug(2, "[QoS] %s table[%d] covered mb %d ~ %d (mfc: %d, int:%d, mif:%d)\n",
 			table_type ? "enc" : "default", i, qos_table[i].threshold_mb,
 			i == num_qos_steps - 1 ? pdata->max_mb : qos_table[i + 1].threshold_mb,
@@ -808,8 +990,10 @@ void mfc_core_qos_off(struct mfc_core *core, struct mfc_ctx *ctx)
 		mfc_bw.write += mfc_bw_ctx.write;
 #endif
 	}
-	if (found)
+	if (found) {
 		list_del(&core->core_ctx[ctx->num]->qos_list);
+		__mfc_qos_ctrl_del(core, ctx->num);
+	}
 
 	if (dec_found) {
 		/* default table */
@@ -13,6 +13,8 @@
 #ifndef __MFC_CORE_QOS_H
 #define __MFC_CORE_QOS_H __FILE__
 
+#include <linux/seq_file.h>
+
 #include "mfc_common.h"
 
 #define MB_COUNT_PER_UHD_FRAME		32400
@@ -24,17 +26,34 @@
 #define MFC_QOS_TABLE_TYPE_DEFAULT	0
 #define MFC_QOS_TABLE_TYPE_ENCODER	1
 
+/*
+ * qos_ctrl_enable: step the QoS table by the measured H/W time
+ * qos_ctrl_up_load: load (%) to step up after qos_ctrl_up_frames frames
+ * qos_ctrl_down_load: load (%) to step down after qos_ctrl_down_frames frames
+ */
+extern unsigned int qos_ctrl_enable;
+extern unsigned int qos_ctrl_up_load;
+extern unsigned int qos_ctrl_down_load;
+extern unsigned int qos_ctrl_up_frames;
+extern unsigned int qos_ctrl_down_frames;
+
 #ifdef CONFIG_MFC_USE_BUS_DEVFREQ
 #define MFC_THROUGHPUT_OFFSET	(PM_QOS_MFC_THROUGHPUT)
 void mfc_core_perf_boost_enable(struct mfc_core *core);
 void mfc_core_perf_boost_disable(struct mfc_core *core);
 void mfc_core_qos_on(struct mfc_core *core, struct mfc_ctx *ctx);
 void mfc_core_qos_off(struct mfc_core *core, struct mfc_ctx *ctx);
+void mfc_core_qos_ctrl_init(struct mfc_core *core);
+void mfc_core_qos_ctrl_feedback(struct mfc_core *core, int ctx_num, u32 hw_ns);
+void mfc_core_qos_ctrl_show(struct seq_file *s, struct mfc_core *core);
 #else
 #define mfc_core_perf_boost_enable(core)	do {} while (0)
 #define mfc_core_perf_boost_disable(core)	do {} while (0)
 #define mfc_core_qos_on(core, ctx)		do {} while (0)
 #define mfc_core_qos_off(core, ctx)		do {} while (0)
+#define mfc_core_qos_ctrl_init(core)		do {} while (0)
+#define mfc_core_qos_ctrl_feedback(core, ctx_num, hw_ns)	do {} while (0)
+#define mfc_core_qos_ctrl_show(s, core)		do {} while (0)
 #endif
 
 void mfc_core_qos_idle_worker(struct work_struct *work);
@@ -19,6 +19,7 @@
 #include "mfc_core_cmd.h"
 #include "mfc_core_hw_reg_api.h"
 #include "mfc_core_enc_param.h"
+#include "mfc_perf_measure.h"
 
 #include "mfc_queue.h"
 #include "mfc_utils.h"
@@ -396,6 +397,7 @@ int mfc_core_run_dec_frame(struct mfc_core *core, struct mfc_ctx *ctx)
 	mfc_clean_core_ctx_int_flags(core_ctx);
 
 	last_frame = __mfc_check_last_frame(core_ctx, src_mb);
+	mfc_perf_measure_src(core, src_mb);
 	ret = mfc_core_cmd_dec_one_frame(core, ctx, last_frame, src_index);
 
 	return ret;
@@ -574,6 +576,7 @@ int mfc_core_run_enc_frame(struct mfc_core *core, struct mfc_ctx *ctx)
 	mfc_core_set_enc_config_qp(core, ctx);
 	mfc_core_set_enc_ts_delta(core, ctx);
 
+	mfc_perf_measure_src(core, src_mb);
 	mfc_core_cmd_enc_one_frame(core, ctx, last_frame);
 
 	return 0;
@@ -34,6 +34,7 @@
 #include <soc/google/bts.h>
 #endif
 #include <linux/videodev2.h>
+#include <linux/hashtable.h>
 #if IS_ENABLED(CONFIG_EXYNOS_ITMON)
 #include <soc/google/exynos-itmon.h>
 #endif
@@ -463,6 +464,15 @@ struct mfc_debug {
  * struct mfc_buf - MFC buffer
  *
  */
+/* index of mfc_buf by the plane 0 address of each image in the buffer */
+struct mfc_buf_addr_node {
+	struct hlist_node node;
+	dma_addr_t addr;
+	/* position in the queue, smaller is closer to the head */
+	s64 seq;
+	struct mfc_buf *mfc_buf;
+};
+
 struct mfc_buf {
 	struct vb2_v4l2_buffer vb;
 	struct list_head list;
@@ -479,11 +489,21 @@ struct mfc_buf {
 	int num_valid_bufs;
 	unsigned char *vir_addr;
 	u32 flag;
+	/* time queued by the user, for the performance measurement */
+	ktime_t queued;
+	struct mfc_buf_addr_node addr_nodes[MAX_NUM_IMAGES_IN_VB];
+	int num_addr_nodes;
 };
 
+#define MFC_BUF_ADDR_HASH_BITS	6
+
 struct mfc_buf_queue {
 	struct list_head head;
 	unsigned int count;
+	DECLARE_HASHTABLE(addr_hash, MFC_BUF_ADDR_HASH_BITS);
+	/* seq of the buffers added at the head and the tail last */
+	s64 head_seq;
+	s64 tail_seq;
 };
 
 struct mfc_bits {
@@ -1164,16 +1184,87 @@ struct _otf_handle {
 };
 /********************************************************************/
 
-struct mfc_perf {
-	void __iomem *regs_base0;
-	void __iomem *regs_base1;
+#define MFC_PERF_RECORD_MAX		256
+#define MFC_PERF_NAL_Q_MAX		NAL_Q_QUEUE_SIZE
+
+enum mfc_perf_type {
+	MFC_PERF_NAL_START	= 0,
+	MFC_PERF_NAL_Q		= 1,
+};
+
+/* A frame processed by the H/W, written lock-free by the ISR */
+struct mfc_perf_record {
+	u64 time_ns;
+	/* index of the record once written, or -1 while being written */
+	int seq;
+	int ctx_num;
+	enum mfc_perf_type type;
+	/* NAL_START to interrupt, or NAL-Q enqueue to dequeue */
+	u32 hw_ns;
+	/* source buffer queued to NAL_START */
+	u32 queue_ns;
+	/* previous interrupt to NAL_START */
+	u32 gap_ns;
+	int mfc_freq;
+};
+
+struct mfc_perf_ctx {
+	unsigned long frames;
+	u64 hw_ns_sum;
+	u32 hw_ns_max;
+	u64 queue_ns_sum;
+	u32 queue_ns_max;
+	u64 nal_q_ns_sum;
+	u32 nal_q_ns_max;
+	unsigned long nal_q_frames;
+	/* frames per second x100, measured every second */
+	unsigned int fps;
+	unsigned int fps_frames;
+	ktime_t fps_start;
+};
 
-	struct timespec64 begin;
-	struct timespec64 end;
+struct mfc_perf {
+	ktime_t begin;
+	ktime_t end;
+	ktime_t src_queued;
 
 	int new_start;
 	int count;
 	int drv_margin;
+	int ctx_num;
+
+	/* enqueue time of the NAL-Q frames in flight */
+	ktime_t nal_q_begin[MFC_PERF_NAL_Q_MAX];
+	ktime_t nal_q_last_out;
+	unsigned int nal_q_head;
+	unsigned int nal_q_tail;
+
+	atomic_t record_idx;
+	struct mfc_perf_record records[MFC_PERF_RECORD_MAX];
+	struct mfc_perf_ctx ctx[MFC_NUM_CONTEXTS];
+};
+
+/*
+ * Closed-loop QoS control
+ * The filtered H/W time of each instance is weighted by its framerate to
+ * get the load of the core in percent of the time available. The QoS
+ * table index picked from the MB estimation (@base_idx) is stepped by
+ * @offset when the load stays out of the thresholds.
+ */
+struct mfc_qos_ctrl {
+	spinlock_t lock;
+	struct work_struct work;
+	u32 hw_us[MFC_NUM_CONTEXTS];
+	u32 load[MFC_NUM_CONTEXTS];
+	u32 total_load;
+	unsigned int up_cnt;
+	unsigned int down_cnt;
+	int table_type;
+	int num_steps;
+	int base_idx;
+	int offset;
+	unsigned long step_up;
+	unsigned long step_down;
 };
 
 extern struct mfc_dump_ops mfc_dump_ops;
@@ -1468,6 +1559,7 @@ struct mfc_core {
 	struct mutex qos_mutex;
 	int mfc_freq_by_bps;
 	int last_mfc_freq;
+	struct mfc_qos_ctrl qos_ctrl;
 #if IS_ENABLED(CONFIG_EXYNOS_BTS)
 	struct bts_bw mfc_bw;
 	unsigned int prev_bts_scen_idx;
@@ -2390,6 +2482,11 @@ struct mfc_core_ctx {
 	/* QoS */
 	struct list_head qos_list;
 
+	/* EDF scheduling */
+	ktime_t deadline;
+	unsigned long sched_cnt;
+	unsigned long sched_miss;
+
 	/* Extra Buffers */
 	int codec_buffer_allocated;
 	int scratch_buffer_allocated;
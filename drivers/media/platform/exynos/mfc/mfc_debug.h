@@ -41,6 +41,7 @@ extern unsigned int logging_option;
 extern unsigned int feature_option;
 extern unsigned int regression_option;
 extern unsigned int core_balance;
+extern unsigned int sched_edf;
 extern unsigned int sbwc_disable;
 extern unsigned int sscd_report;
 extern unsigned int hdr_dump;
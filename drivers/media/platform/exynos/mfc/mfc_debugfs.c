@@ -14,12 +14,15 @@
 #include <linux/seq_file.h>
 
 #include "mfc_core_pm.h"
+#include "mfc_core_qos.h"
 
 #include "mfc_debugfs.h"
 #include "mfc_sync.h"
 #include "mfc_meminfo.h"
+#include "mfc_perf_measure.h"
 
 #include "mfc_queue.h"
+#include "mfc_sched_stress.h"
 
 unsigned int debug_level;
 unsigned int debug_ts;
@@ -48,6 +51,12 @@ unsigned int sbwc_disable;
 unsigned int sscd_report;
 unsigned int hdr_dump;
 unsigned int idle_suspend_enable = 0;
+unsigned int sched_edf;
+unsigned int qos_ctrl_enable;
+unsigned int qos_ctrl_up_load = 85;
+unsigned int qos_ctrl_down_load = 50;
+unsigned int qos_ctrl_up_frames = 3;
+unsigned int qos_ctrl_down_frames = 30;
 
 static int __mfc_info_show(struct seq_file *s, void *unused)
 {
@@ -116,12 +125,13 @@ static int __mfc_info_show(struct seq_file *s, void *unused)
 		for (i = 0; i < MFC_NUM_CONTEXTS; i++) {
 			core_ctx = core->core_ctx[i];
 			if (core_ctx) {
-				seq_printf(s, "    [CORECTX:%d] state: %d, queue(src: %d, dst: %d)\n",
+				seq_printf(s, "    [CORECTX:%d] state: %d, queue(src: %d, dst: %d), deadline miss: %lu/%lu\n",
 					i, core_ctx->state,
 					mfc_get_queue_count(&core_ctx->buf_queue_lock,
 						&core_ctx->src_buf_queue),
 					mfc_get_queue_count(&core_ctx->buf_queue_lock,
-						&core_ctx->dst_buf_queue));
+						&core_ctx->dst_buf_queue),
+					core_ctx->sched_miss, core_ctx->sched_cnt);
 			}
 		}
 	}
@@ -384,6 +394,30 @@ static int __mfc_meminfo_show(struct seq_file *s, void *unused)
 	return 0;
 }
 
+static int __mfc_perf_show(struct seq_file *s, void *unused)
+{
+	struct mfc_dev *dev = s->private;
+	int i;
+
+	for (i = 0; i < dev->num_core; i++)
+		if (dev->core[i])
+			mfc_perf_show(s, dev->core[i]);
+
+	return 0;
+}
+
+static int __mfc_qos_ctrl_show(struct seq_file *s, void *unused)
+{
+	struct mfc_dev *dev = s->private;
+	int i;
+
+	for (i = 0; i < dev->num_core; i++)
+		if (dev->core[i])
+			mfc_core_qos_ctrl_show(s, dev->core[i]);
+
+	return 0;
+}
+
 static int __mfc_info_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, __mfc_info_show, inode->i_private);
@@ -465,6 +499,30 @@ static const struct file_operations mfc_meminfo_fops = {
 	.release = single_release,
 };
 
+static int __mfc_perf_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, __mfc_perf_show, inode->i_private);
+}
+
+static const struct file_operations perf_fops = {
+	.open = __mfc_perf_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __mfc_qos_ctrl_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, __mfc_qos_ctrl_show, inode->i_private);
+}
+
+static const struct file_operations qos_ctrl_fops = {
+	.open = __mfc_qos_ctrl_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static const struct file_operations regression_result_fops = {
 	.open = __mfc_regression_result_open,
 	.read = seq_read,
@@ -514,6 +572,8 @@ void mfc_init_debugfs(struct mfc_dev *dev)
 			0644, debugfs->root, &otf_dump);
 	debugfs_create_u32("perf_measure_option",
 			0644, debugfs->root, &perf_measure_option);
+	debugfs_create_file("perf",
+			0444, debugfs->root, dev, &perf_fops);
 	debugfs_create_u32("sfr_dump",
 			0644, debugfs->root, &sfr_dump);
 	debugfs_create_u32("llc_disable",
@@ -526,6 +586,18 @@ void mfc_init_debugfs(struct mfc_dev *dev)
 			0644, debugfs->root, &slc_partial_height_ratio);
 	debugfs_create_u32("perf_boost_mode",
 			0644, debugfs->root, &perf_boost_mode);
+	debugfs_create_u32("qos_ctrl_enable",
+			0644, debugfs->root, &qos_ctrl_enable);
+	debugfs_create_u32("qos_ctrl_up_load",
+			0644, debugfs->root, &qos_ctrl_up_load);
+	debugfs_create_u32("qos_ctrl_down_load",
+			0644, debugfs->root, &qos_ctrl_down_load);
+	debugfs_create_u32("qos_ctrl_up_frames",
+			0644, debugfs->root, &qos_ctrl_up_frames);
+	debugfs_create_u32("qos_ctrl_down_frames",
+			0644, debugfs->root, &qos_ctrl_down_frames);
+	debugfs_create_file("qos_ctrl",
+			0444, debugfs->root, dev, &qos_ctrl_fops);
 	debugfs_create_u32("drm_predict_disable",
 			0644, debugfs->root, &drm_predict_disable);
 	debugfs_create_file("meminfo",
@@ -536,6 +608,9 @@ void mfc_init_debugfs(struct mfc_dev *dev)
 			0644, debugfs->root, &feature_option);
 	debugfs_create_u32("core_balance",
 			0644, debugfs->root, &core_balance);
+	debugfs_create_u32("sched_edf",
+			0644, debugfs->root, &sched_edf);
+	mfc_sched_stress_init_debugfs(dev);
 	debugfs_create_u32("memlog_level",
 			0644, debugfs->root, &memlog_level);
 	debugfs_create_u32("logging_option",
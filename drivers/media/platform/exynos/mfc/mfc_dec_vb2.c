@@ -337,6 +337,7 @@ static void mfc_dec_buf_queue(struct vb2_buffer *vb)
 			stream_vir = vb2_plane_vaddr(vb, 0);
 
 		buf->vir_addr = stream_vir;
+		buf->queued = ktime_get();
 
 		mfc_add_tail_buf(ctx, &ctx->src_buf_ready_queue, buf);
 
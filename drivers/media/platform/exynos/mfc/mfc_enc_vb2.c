@@ -411,6 +411,7 @@ static void mfc_enc_buf_queue(struct vb2_buffer *vb)
 		for (i = 0; i < ctx->src_fmt->mem_planes; i++)
 			mfc_debug(2, "[BUFINFO] ctx[%d] add src index: %d, addr[%d]: 0x%08llx\n",
 					ctx->num, vb->index, i, buf->addr[0][i]);
+		buf->queued = ktime_get();
 		mfc_add_tail_buf(ctx, &ctx->src_buf_ready_queue, buf);
 
 		if (debug_ts == 1)
@@ -10,17 +10,251 @@
  * (at your option) any later version.
  */
 
+#include <linux/log2.h>
+#include <trace/events/mfc.h>
+
 #include "mfc_perf_measure.h"
 
-#ifndef PERF_MEASURE
+/*
+ * Every frame processed by the H/W is recorded in the per-core ring of
+ * MFC_PERF_RECORD_MAX records. The writer claims a slot by the atomic
+ * index so the ISR never waits for the reader; the reader skips the slot
+ * being overwritten by checking its sequence. The index wraps around, so
+ * it is used as unsigned and MFC_PERF_RECORD_MAX is a power of two.
+ */
+#define MFC_PERF_RECORD_SLOT(idx)	((idx) & (MFC_PERF_RECORD_MAX - 1))
+
+static void __mfc_perf_record(struct mfc_core *core, int ctx_num,
+		enum mfc_perf_type type, ktime_t now, u32 hw_ns,
+		u32 queue_ns, u32 gap_ns)
+{
+	struct mfc_perf *perf = &core->perf;
+	struct mfc_perf_record *record;
+	unsigned int idx;
+
+	idx = (unsigned int)atomic_inc_return(&perf->record_idx);
+	record = &perf->records[MFC_PERF_RECORD_SLOT(idx)];
+
+	WRITE_ONCE(record->seq, -1);
+	smp_wmb();
+	record->time_ns = ktime_to_ns(now);
+	record->ctx_num = ctx_num;
+	record->type = type;
+	record->hw_ns = hw_ns;
+	record->queue_ns = queue_ns;
+	record->gap_ns = gap_ns;
+	record->mfc_freq = core->last_mfc_freq;
+	smp_store_release(&record->seq, idx);
+
+	trace_mfc_perf_frame(core->id, ctx_num, type, hw_ns, queue_ns, gap_ns,
+			core->last_mfc_freq);
+}
+
+static void __mfc_perf_count_frame(struct mfc_perf_ctx *pctx, ktime_t now)
+{
+	s64 elapsed;
+
+	pctx->frames++;
+	pctx->fps_frames++;
+
+	elapsed = ktime_to_ns(ktime_sub(now, pctx->fps_start));
+	if (elapsed < NSEC_PER_SEC)
+		return;
+
+	if (pctx->fps_start)
+		pctx->fps = div64_s64((s64)pctx->fps_frames * NSEC_PER_SEC * 100,
+				elapsed);
+	pctx->fps_frames = 0;
+	pctx->fps_start = now;
+}
+
+void mfc_perf_register(struct mfc_core *core)
+{
+	BUILD_BUG_ON(!is_power_of_2(MFC_PERF_RECORD_MAX));
+
+	memset(&core->perf, 0, sizeof(core->perf));
+	atomic_set(&core->perf.record_idx, -1);
+}
+
+void mfc_perf_init(struct mfc_core *core)
+{
+	core->perf.new_start = 0;
+	core->perf.count = 0;
+	core->perf.drv_margin = 0;
+	core->perf.src_queued = 0;
+	core->perf.nal_q_head = 0;
+	core->perf.nal_q_tail = 0;
+
+	mfc_core_debug(2, "[PERF] MFC frequency : %ld\n",
+			clk_get_rate(core->pm.clock));
+}
+
+void __mfc_measure_src(struct mfc_core *core, struct mfc_buf *mfc_buf)
+{
+	core->perf.src_queued = mfc_buf->queued;
+}
+
+void __mfc_measure_on(struct mfc_core *core)
+{
+	struct mfc_perf *perf = &core->perf;
+	ktime_t now = ktime_get();
+
+	perf->ctx_num = core->curr_core_ctx;
+	perf->begin = now;
+	perf->new_start = 1;
+	perf->count++;
+}
+
+void __mfc_measure_off(struct mfc_core *core)
+{
+	struct mfc_perf *perf = &core->perf;
+	struct mfc_perf_ctx *pctx = &perf->ctx[perf->ctx_num];
+	ktime_t now = ktime_get();
+	u32 hw_ns, queue_ns = 0, gap_ns = 0;
+
+	hw_ns = ktime_to_ns(ktime_sub(now, perf->begin));
+	if (perf->src_queued)
+		queue_ns = ktime_to_ns(ktime_sub(perf->begin, perf->src_queued));
+	if (perf->drv_margin)
+		gap_ns = ktime_to_ns(ktime_sub(perf->begin, perf->end));
+
+	pctx->hw_ns_sum += hw_ns;
+	pctx->hw_ns_max = max(pctx->hw_ns_max, hw_ns);
+	pctx->queue_ns_sum += queue_ns;
+	pctx->queue_ns_max = max(pctx->queue_ns_max, queue_ns);
+	__mfc_perf_count_frame(pctx, now);
+
+	__mfc_perf_record(core, perf->ctx_num, MFC_PERF_NAL_START, now,
+			hw_ns, queue_ns, gap_ns);
+	mfc_core_qos_ctrl_feedback(core, perf->ctx_num, hw_ns);
+
+	perf->src_queued = 0;
+	perf->end = now;
+	perf->drv_margin = 1;
+	perf->new_start = 0;
+}
+
+/*
+ * Called under the NAL-Q lock. The begin time is 0 if the measurement is off.
+ * NAL-Q can't hold more frames than MFC_PERF_NAL_Q_MAX, so an overflow means
+ * the ends of the pending frames were lost and they can't be paired anymore.
+ */
+void __mfc_measure_nal_q_in(struct mfc_core *core, int ctx_num)
+{
+	struct mfc_perf *perf = &core->perf;
+
+	if (perf->nal_q_tail - perf->nal_q_head >= MFC_PERF_NAL_Q_MAX)
+		perf->nal_q_head = perf->nal_q_tail;
+
+	perf->nal_q_begin[perf->nal_q_tail++ % MFC_PERF_NAL_Q_MAX] =
+		mfc_perf_measure_enabled() ? ktime_get() : 0;
+}
+
+/*
+ * Called under the NAL-Q lock, NAL-Q dequeues the frames in order.
+ * The H/W starts a frame when it is queued or when the previous one is
+ * done, whichever is later, so that is the H/W time of the frame.
+ */
+void __mfc_measure_nal_q_out(struct mfc_core *core, int ctx_num)
+{
+	struct mfc_perf *perf = &core->perf;
+	struct mfc_perf_ctx *pctx = &perf->ctx[ctx_num];
+	ktime_t now;
+	ktime_t begin;
+	u32 nal_q_ns;
+
+	begin = perf->nal_q_begin[perf->nal_q_head++ % MFC_PERF_NAL_Q_MAX];
+	if (!begin || !mfc_perf_measure_enabled())
+		return;
+
+	now = ktime_get();
+	nal_q_ns = ktime_to_ns(ktime_sub(now, begin));
+	if (ktime_after(perf->nal_q_last_out, begin))
+		begin = perf->nal_q_last_out;
+	perf->nal_q_last_out = now;
+
+	pctx->nal_q_ns_sum += nal_q_ns;
+	pctx->nal_q_ns_max = max(pctx->nal_q_ns_max, nal_q_ns);
+	pctx->nal_q_frames++;
+	__mfc_perf_count_frame(pctx, now);
+
+	__mfc_perf_record(core, ctx_num, MFC_PERF_NAL_Q, now, nal_q_ns, 0, 0);
+	mfc_core_qos_ctrl_feedback(core, ctx_num, ktime_to_ns(ktime_sub(now, begin)));
+}
+
+static void __mfc_perf_ctx_show(struct seq_file *s, struct mfc_core *core,
+		int ctx_num)
+{
+	struct mfc_perf_ctx *pctx = &core->perf.ctx[ctx_num];
+	unsigned long nal_start = pctx->frames - pctx->nal_q_frames;
+
+	seq_printf(s, " [ctx:%2d] frames: %lu (nal_q: %lu), fps: %u.%02u\n",
+			ctx_num, pctx->frames, pctx->nal_q_frames,
+			pctx->fps / 100, pctx->fps % 100);
+	seq_printf(s, "          hw(us) avg: %llu max: %u, queue(us) avg: %llu max: %u\n",
+			nal_start ? div64_u64(pctx->hw_ns_sum, nal_start) / NSEC_PER_USEC : 0,
+			pctx->hw_ns_max / NSEC_PER_USEC,
+			nal_start ? div64_u64(pctx->queue_ns_sum, nal_start) / NSEC_PER_USEC : 0,
+			pctx->queue_ns_max / NSEC_PER_USEC);
+	if (pctx->nal_q_frames)
+		seq_printf(s, "          nal_q(us) avg: %llu max: %u\n",
+				div64_u64(pctx->nal_q_ns_sum, pctx->nal_q_frames) / NSEC_PER_USEC,
+				pctx->nal_q_ns_max / NSEC_PER_USEC);
+}
+
+void mfc_perf_show(struct seq_file *s, struct mfc_core *core)
+{
+	struct mfc_perf *perf = &core->perf;
+	struct mfc_perf_record record;
+	unsigned int idx, last;
+	int i;
+
+	seq_printf(s, ">>> MFC core-%d performance (measure: %s)\n", core->id,
+			mfc_perf_measure_enabled() ? "on" : "off");
+
+	for (i = 0; i < MFC_NUM_CONTEXTS; i++)
+		if (perf->ctx[i].frames)
+			__mfc_perf_ctx_show(s, core, i);
+
+	seq_puts(s, " time(ns)             ctx type      hw(us)  queue(us)    gap(us) freq(kHz)\n");
+	/* slots not written yet for the index are skipped by the sequence */
+	last = (unsigned int)atomic_read(&perf->record_idx);
+	for (i = 0; i < MFC_PERF_RECORD_MAX; i++) {
+		struct mfc_perf_record *r;
+
+		idx = last - MFC_PERF_RECORD_MAX + 1 + i;
+		r = &perf->records[MFC_PERF_RECORD_SLOT(idx)];
+		if (smp_load_acquire(&r->seq) != (int)idx)
+			continue;
+		record = *r;
+		smp_rmb();
+		if (READ_ONCE(r->seq) != (int)idx)
+			continue;
+
+		seq_printf(s, " %-20llu %3d %-6s %10u %10u %10u %9d\n",
+				record.time_ns, record.ctx_num,
+				record.type == MFC_PERF_NAL_Q ? "nal_q" : "nal",
+				record.hw_ns / NSEC_PER_USEC,
+				record.queue_ns / NSEC_PER_USEC,
+				record.gap_ns / NSEC_PER_USEC, record.mfc_freq);
+	}
+}
 
-void mfc_perf_register(struct mfc_core *core) {}
-void __mfc_measure_init(void) {}
-void __mfc_measure_on(struct mfc_core *core) {}
-void __mfc_measure_off(struct mfc_core *core) {}
-void __mfc_measure_store(struct mfc_core *core, int diff) {}
-void mfc_perf_print(void) {}
+void mfc_perf_print(struct mfc_core *core, int ctx_num)
+{
+	struct mfc_perf_ctx *pctx = &core->perf.ctx[ctx_num];
+	unsigned long nal_start = pctx->frames - pctx->nal_q_frames;
 
-#else
+	if ((perf_measure_option & MFC_PERF_MEASURE_PRINT) && pctx->frames)
+		mfc_core_info("[PERF][c:%d] frames: %lu (nal_q: %lu), fps: %u.%02u, hw avg: %llu us, max: %u us, queue avg: %llu us, nal_q avg: %llu us\n",
+				ctx_num, pctx->frames, pctx->nal_q_frames,
+				pctx->fps / 100, pctx->fps % 100,
+				nal_start ? div64_u64(pctx->hw_ns_sum, nal_start) / NSEC_PER_USEC : 0,
+				pctx->hw_ns_max / NSEC_PER_USEC,
+				nal_start ? div64_u64(pctx->queue_ns_sum, nal_start) / NSEC_PER_USEC : 0,
+				pctx->nal_q_frames ?
+				div64_u64(pctx->nal_q_ns_sum, pctx->nal_q_frames) / NSEC_PER_USEC : 0);
 
-#endif
+	/* The next instance of the same number starts from scratch */
+	memset(pctx, 0, sizeof(*pctx));
+}
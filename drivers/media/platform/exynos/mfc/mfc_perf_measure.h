@@ -14,26 +14,84 @@
 #define __MFC_PERF_MEASURE_H __FILE__
 
 #include <linux/clk.h>
+#include <linux/seq_file.h>
 
+#include "mfc_core_qos.h"
 #include "mfc_core_reg_api.h"
 
 #include <trace/hooks/systrace.h>
 
+extern unsigned int perf_measure_option;
+
+/*
+ * perf_measure_option
+ * BIT(0): record the H/W run time, queueing delay and NAL-Q residency
+ * BIT(1): print the summary of the instance when it is closed
+ */
+#define MFC_PERF_MEASURE_EN	(1 << 0)
+#define MFC_PERF_MEASURE_PRINT	(1 << 1)
+
+/* The closed-loop QoS control is fed by the measurement */
+static inline bool mfc_perf_measure_enabled(void)
+{
+	return (perf_measure_option & MFC_PERF_MEASURE_EN) || qos_ctrl_enable;
+}
+
 void mfc_perf_register(struct mfc_core *core);
-void __mfc_measure_init(void);
+void mfc_perf_init(struct mfc_core *core);
 void __mfc_measure_on(struct mfc_core *core);
 void __mfc_measure_off(struct mfc_core *core);
-void __mfc_measure_store(struct mfc_core *core, int diff);
-void mfc_perf_print(void);
+void __mfc_measure_src(struct mfc_core *core, struct mfc_buf *mfc_buf);
+void __mfc_measure_nal_q_in(struct mfc_core *core, int ctx_num);
+void __mfc_measure_nal_q_out(struct mfc_core *core, int ctx_num);
+void mfc_perf_print(struct mfc_core *core, int ctx_num);
+void mfc_perf_show(struct seq_file *s, struct mfc_core *core);
+
+static inline void mfc_perf_cancel_drv_margin(struct mfc_core *core)
+{
+	core->perf.drv_margin = 0;
+}
+
+static inline void mfc_perf_measure_src(struct mfc_core *core,
+		struct mfc_buf *mfc_buf)
+{
+	if (mfc_perf_measure_enabled())
+		__mfc_measure_src(core, mfc_buf);
+}
+
+static inline void mfc_perf_measure_on(struct mfc_core *core)
+{
+	if (mfc_perf_measure_enabled())
+		__mfc_measure_on(core);
+}
 
-//#define PERF_MEASURE
+static inline void mfc_perf_measure_off(struct mfc_core *core)
+{
+	if (core->perf.new_start)
+		__mfc_measure_off(core);
+}
 
-#ifndef PERF_MEASURE
+/*
+ * Every NAL-Q frame in and out is paired even while the measurement is off,
+ * so that the begin time of a frame is always matched with its own end.
+ */
+static inline void mfc_perf_nal_q_in(struct mfc_core *core, int ctx_num)
+{
+	__mfc_measure_nal_q_in(core, ctx_num);
+}
+
+static inline void mfc_perf_nal_q_out(struct mfc_core *core, int ctx_num)
+{
+	if (core->perf.nal_q_head != core->perf.nal_q_tail)
+		__mfc_measure_nal_q_out(core, ctx_num);
+}
+
+/* Called under the NAL-Q lock when the frames in NAL-Q are dropped */
+static inline void mfc_perf_nal_q_reset(struct mfc_core *core)
+{
+	core->perf.nal_q_head = core->perf.nal_q_tail;
+}
 
-static inline void mfc_perf_init(struct mfc_core *core) {}
-static inline void mfc_perf_cancel_drv_margin(struct mfc_core *core) {}
-static inline void mfc_perf_measure_on(struct mfc_core *core) {}
-static inline void mfc_perf_measure_off(struct mfc_core *core) {}
 static inline void mfc_perf_trace(struct mfc_ctx *ctx, char* tag, int counter)
 {
 	char trace_name[32];
@@ -57,77 +115,4 @@ static inline void mfc_perf_core_trace(char* tag, int counter)
 	__ATRACE_INT_PID(0, trace_name, counter);
 }
 
-#else
-
-extern unsigned int perf_measure_option;
-
-static inline void mfc_perf_init(struct mfc_core *core)
-{
-	core->perf.new_start = 0;
-	core->perf.count = 0;
-	core->perf.drv_margin = 0;
-
-	__mfc_measure_init();
-
-	mfc_core_info("MFC frequency : %ld\n", clk_get_rate(core->pm.clock));
-}
-
-static inline void mfc_perf_cancel_drv_margin(struct mfc_core *core)
-{
-	core->perf.drv_margin = 0;
-}
-
-static inline void mfc_perf_measure_on(struct mfc_core *core)
-{
-	int diff;
-
-	if (core->perf.drv_margin) {
-		ktime_get_ts64(&core->perf.end);
-
-		diff = (core->perf.end.tv_sec * NSEC_PER_SEC + core->perf.end.tv_nsec)
-			- (core->perf.begin.tv_sec * NSEC_PER_SEC + core->perf.begin.tv_nsec);
-
-		mfc_core_info("IRQ -> NAL_START time(ms) = %03d.%06d\n",
-			diff / NSEC_PER_MSEC, diff % NSEC_PER_MSEC);
-
-		core->perf.drv_margin = 0;
-	}
-
-	ktime_get_ts64(&core->perf.begin);
-
-	__mfc_measure_on(core);
-
-	core->perf.new_start = 1;
-	core->perf.count++;
-}
-
-static inline void mfc_perf_measure_off(struct mfc_core *core)
-{
-	unsigned int diff;
-
-	if ((core->perf.new_start) && (core->perf.count > 0)) {
-		__mfc_measure_off(core);
-
-		ktime_get_ts64(&core->perf.end);
-
-		diff = (core->perf.end.tv_sec * NSEC_PER_SEC + core->perf.end.tv_nsec)
-			- (core->perf.begin.tv_sec * NSEC_PER_SEC + core->perf.begin.tv_nsec);
-
-		__mfc_measure_store(core, diff / NSEC_PER_SEC);
-
-		mfc_core_debug(3, "uDECtype :%d, uENCtype :%d, codectype :%d\n",
-				mfc_core_get_dec_frame_type(),
-				mfc_core_get_enc_slice_type(),
-				MFC_CORE_READL(MFC_REG_CODEC_TYPE));
-
-		core->perf.drv_margin = 1;
-
-		ktime_get_ts64(&core->perf.begin);
-	}
-
-	core->perf.new_start = 0;
-}
-
-#endif
-
 #endif /* __MFC_PERF_MEASURE_H */
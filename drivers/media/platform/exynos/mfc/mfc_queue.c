@@ -15,6 +15,65 @@
 #include "mfc_utils.h"
 #include "mfc_mem.h"
 
+/*
+ * Every buffer in a queue is indexed by the plane 0 address of each image
+ * in it, so that the ISR finds the buffer of the address reported by F/W
+ * without walking the queue. All the list operations on the queue should
+ * go through __mfc_queue_add and __mfc_queue_del under the buf_queue_lock
+ * to keep the index. Buffers can share an address, so each node has the
+ * position of its buffer in the queue and the lookup returns the first
+ * one in the queue order like a walk of the list would.
+ */
+static void __mfc_queue_add(struct mfc_buf_queue *queue, struct mfc_buf *mfc_buf,
+		enum mfc_queue_top_type top)
+{
+	struct mfc_buf_addr_node *node;
+	s64 seq;
+	int i;
+
+	if (top == MFC_QUEUE_ADD_TOP) {
+		list_add(&mfc_buf->list, &queue->head);
+		seq = --queue->head_seq;
+	} else {
+		list_add_tail(&mfc_buf->list, &queue->head);
+		seq = ++queue->tail_seq;
+	}
+	queue->count++;
+
+	mfc_buf->num_addr_nodes = max(mfc_buf->num_valid_bufs, 1);
+	for (i = 0; i < mfc_buf->num_addr_nodes; i++) {
+		node = &mfc_buf->addr_nodes[i];
+		node->addr = mfc_buf->addr[i][0];
+		node->seq = seq;
+		node->mfc_buf = mfc_buf;
+		hash_add(queue->addr_hash, &node->node, node->addr);
+	}
+}
+
+static void __mfc_queue_del(struct mfc_buf_queue *queue, struct mfc_buf *mfc_buf)
+{
+	int i;
+
+	list_del(&mfc_buf->list);
+	queue->count--;
+
+	for (i = 0; i < mfc_buf->num_addr_nodes; i++)
+		hash_del(&mfc_buf->addr_nodes[i].node);
+	mfc_buf->num_addr_nodes = 0;
+}
+
+static struct mfc_buf *__mfc_queue_find(struct mfc_buf_queue *queue, dma_addr_t addr)
+{
+	struct mfc_buf_addr_node *node, *first = NULL;
+
+	hash_for_each_possible(queue->addr_hash, node, node, addr) {
+		if (node->addr == addr && (!first || node->seq < first->seq))
+			first = node;
+	}
+
+	return first ? first->mfc_buf : NULL;
+}
+
 void mfc_add_tail_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *queue,
 		struct mfc_buf *mfc_buf)
 {
@@ -28,8 +87,7 @@ void mfc_add_tail_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *queue,
 	spin_lock_irqsave(&ctx->buf_queue_lock, flags);
 
 	mfc_buf->used = 0;
-	list_add_tail(&mfc_buf->list, &queue->head);
-	queue->count++;
+	__mfc_queue_add(queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 }
@@ -110,8 +168,7 @@ struct mfc_buf *mfc_get_del_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *queue
 
 	mfc_debug(2, "addr[0]: 0x%08llx\n", mfc_buf->addr[0][0]);
 
-	list_del(&mfc_buf->list);
-	queue->count--;
+	__mfc_queue_del(queue, mfc_buf);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 	return mfc_buf;
@@ -152,8 +209,7 @@ struct mfc_buf *mfc_get_del_if_consumed(struct mfc_ctx *ctx, struct mfc_buf_queu
 		/* do not delete from queue */
 		*deleted = 0;
 	} else {
-		list_del(&mfc_buf->list);
-		queue->count--;
+		__mfc_queue_del(queue, mfc_buf);
 
 		*deleted = 1;
 	}
@@ -187,15 +243,8 @@ struct mfc_buf *mfc_get_move_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *to_q
 
 	mfc_debug(2, "addr[0]: 0x%08llx\n", mfc_buf->addr[0][0]);
 
-	list_del(&mfc_buf->list);
-	from_queue->count--;
-
-	if (top == MFC_QUEUE_ADD_TOP)
-		list_add(&mfc_buf->list, &to_queue->head);
-	else
-		list_add_tail(&mfc_buf->list, &to_queue->head);
-
-	to_queue->count++;
+	__mfc_queue_del(from_queue, mfc_buf);
+	__mfc_queue_add(to_queue, mfc_buf, top);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 	return mfc_buf;
@@ -220,11 +269,8 @@ struct mfc_buf *mfc_get_move_buf_used(struct mfc_ctx *ctx,
 	if (mfc_buf->used) {
 		mfc_debug(2, "addr[0]: 0x%08llx\n", mfc_buf->addr[0][0]);
 
-		list_del(&mfc_buf->list);
-		from_queue->count--;
-
-		list_add_tail(&mfc_buf->list, &to_queue->head);
-		to_queue->count++;
+		__mfc_queue_del(from_queue, mfc_buf);
+		__mfc_queue_add(to_queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 
 		spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 		return mfc_buf;
@@ -249,26 +295,22 @@ struct mfc_buf *mfc_get_move_buf_addr(struct mfc_ctx *ctx,
 		return NULL;
 	}
 
-	list_for_each_entry(mfc_buf, &from_queue->head, list) {
-		if (mfc_buf->addr[0][0] == addr) {
-			if (used_flag & (1UL << mfc_buf->dpb_index)) {
-				mfc_debug(2, "[DPB] addr[0]: 0x%08llx still referenced\n",
-						mfc_buf->addr[0][0]);
-				spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-				return NULL;
-			}
-
-			mfc_debug(2, "[DPB] addr[0]: 0x%08llx\n", mfc_buf->addr[0][0]);
+	mfc_buf = __mfc_queue_find(from_queue, addr);
+	if (mfc_buf) {
+		if (used_flag & (1UL << mfc_buf->dpb_index)) {
+			mfc_debug(2, "[DPB] addr[0]: 0x%08llx still referenced\n",
+					mfc_buf->addr[0][0]);
+			spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
+			return NULL;
+		}
 
-			list_del(&mfc_buf->list);
-			from_queue->count--;
+		mfc_debug(2, "[DPB] addr[0]: 0x%08llx\n", mfc_buf->addr[0][0]);
 
-			list_add_tail(&mfc_buf->list, &to_queue->head);
-			to_queue->count++;
+		__mfc_queue_del(from_queue, mfc_buf);
+		__mfc_queue_add(to_queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 
-			spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-			return mfc_buf;
-		}
+		spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
+		return mfc_buf;
 	}
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
@@ -290,11 +332,8 @@ struct mfc_buf *mfc_get_move_buf_index(struct mfc_ctx *ctx,
 			mfc_debug(2, "[DPB] buf[%d][%d] addr[0]: 0x%08llx\n",
 					mfc_buf->vb.vb2_buf.index, mfc_buf->dpb_index, mfc_buf->addr[0][0]);
 
-			list_del(&mfc_buf->list);
-			from_queue->count--;
-
-			list_add_tail(&mfc_buf->list, &to_queue->head);
-			to_queue->count++;
+			__mfc_queue_del(from_queue, mfc_buf);
+			__mfc_queue_add(to_queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 
 			spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 			return mfc_buf;
@@ -348,83 +387,31 @@ struct mfc_buf *mfc_find_first_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *qu
 struct mfc_buf *mfc_find_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *queue, dma_addr_t addr)
 {
 	unsigned long flags;
-	struct mfc_buf *mfc_buf = NULL;
-	dma_addr_t mb_addr;
-	int i;
+	struct mfc_buf *mfc_buf;
 
 	spin_lock_irqsave(&ctx->buf_queue_lock, flags);
 
 	mfc_debug(4, "Looking for this address: 0x%08llx\n", addr);
-	list_for_each_entry(mfc_buf, &queue->head, list) {
-		if (mfc_buf->num_valid_bufs > 0) {
-			for (i = 0; i < mfc_buf->num_valid_bufs; i++) {
-				mb_addr = mfc_buf->addr[i][0];
-				mfc_debug(4, "[BUFCON] batch[%d] addr[0]: 0x%08llx\n", i, mb_addr);
-				if (addr == mb_addr) {
-					spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-					return mfc_buf;
-				}
-			}
-		} else {
-			mb_addr = mfc_buf->addr[0][0];
-			mfc_debug(4, "addr[0]: 0x%08llx\n", mb_addr);
-
-			if (addr == mb_addr) {
-				spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-				return mfc_buf;
-			}
-		}
-	}
+	mfc_buf = __mfc_queue_find(queue, addr);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-	return NULL;
+	return mfc_buf;
 }
 
 struct mfc_buf *mfc_find_del_buf(struct mfc_ctx *ctx, struct mfc_buf_queue *queue, dma_addr_t addr)
 {
 	unsigned long flags;
-	struct mfc_buf *mfc_buf = NULL;
-	dma_addr_t mb_addr;
-	int found = 0, i;
+	struct mfc_buf *mfc_buf;
 
 	spin_lock_irqsave(&ctx->buf_queue_lock, flags);
 
 	mfc_debug(4, "Looking for this address: 0x%08llx\n", addr);
-	list_for_each_entry(mfc_buf, &queue->head, list) {
-		if (mfc_buf->num_valid_bufs > 0) {
-			for (i = 0; i < mfc_buf->num_valid_bufs; i++) {
-				mb_addr = mfc_buf->addr[i][0];
-				mfc_debug(4, "batch buf[%d] plane[0] addr: 0x%08llx\n", i, mb_addr);
-
-				if (addr == mb_addr) {
-					found = 1;
-					break;
-				}
-			}
+	mfc_buf = __mfc_queue_find(queue, addr);
+	if (mfc_buf)
+		__mfc_queue_del(queue, mfc_buf);
 
-			if (found)
-				break;
-		} else {
-			mb_addr = mfc_buf->addr[0][0];
-			mfc_debug(4, "addr[0]: 0x%08llx\n", mb_addr);
-
-			if (addr == mb_addr) {
-				found = 1;
-				break;
-			}
-		}
-	}
-
-	if (found == 1) {
-		list_del(&mfc_buf->list);
-		queue->count--;
-
-		spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-		return mfc_buf;
-	} else {
-		spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
-		return NULL;
-	}
+	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
+	return mfc_buf;
 }
 
 void mfc_move_buf_all(struct mfc_ctx *ctx, struct mfc_buf_queue *to_queue,
@@ -439,26 +426,19 @@ void mfc_move_buf_all(struct mfc_ctx *ctx, struct mfc_buf_queue *to_queue,
 		while (!list_empty(&from_queue->head)) {
 			mfc_buf = list_entry(from_queue->head.prev, struct mfc_buf, list);
 
-			list_del(&mfc_buf->list);
-			from_queue->count--;
-
-			list_add(&mfc_buf->list, &to_queue->head);
-			to_queue->count++;
+			__mfc_queue_del(from_queue, mfc_buf);
+			__mfc_queue_add(to_queue, mfc_buf, MFC_QUEUE_ADD_TOP);
 		}
 	} else {
 		while (!list_empty(&from_queue->head)) {
 			mfc_buf = list_entry(from_queue->head.next, struct mfc_buf, list);
 
-			list_del(&mfc_buf->list);
-			from_queue->count--;
-
-			list_add_tail(&mfc_buf->list, &to_queue->head);
-			to_queue->count++;
+			__mfc_queue_del(from_queue, mfc_buf);
+			__mfc_queue_add(to_queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 		}
 	}
 
-	INIT_LIST_HEAD(&from_queue->head);
-	from_queue->count = 0;
+	mfc_init_queue(from_queue);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 }
@@ -478,12 +458,10 @@ void mfc_cleanup_queue(spinlock_t *plock, struct mfc_buf_queue *queue)
 			vb2_set_plane_payload(&mfc_buf->vb.vb2_buf, i, 0);
 
 		vb2_buffer_done(&mfc_buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
-		list_del(&mfc_buf->list);
-		queue->count--;
+		__mfc_queue_del(queue, mfc_buf);
 	}
 
-	INIT_LIST_HEAD(&queue->head);
-	queue->count = 0;
+	mfc_init_queue(queue);
 
 	spin_unlock_irqrestore(plock, flags);
 }
@@ -508,12 +486,10 @@ void mfc_cleanup_enc_src_queue(struct mfc_core_ctx *core_ctx)
 		}
 
 		vb2_buffer_done(&mfc_buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
-		list_del(&mfc_buf->list);
-		queue->count--;
+		__mfc_queue_del(queue, mfc_buf);
 	}
 
-	INIT_LIST_HEAD(&queue->head);
-	queue->count = 0;
+	mfc_init_queue(queue);
 	ctx->batch_mode = 0;
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
@@ -535,12 +511,10 @@ void mfc_cleanup_enc_dst_queue(struct mfc_ctx *ctx)
 			vb2_set_plane_payload(&mfc_buf->vb.vb2_buf, i, 0);
 
 		vb2_buffer_done(&mfc_buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
-		list_del(&mfc_buf->list);
-		queue->count--;
+		__mfc_queue_del(queue, mfc_buf);
 	}
 
-	INIT_LIST_HEAD(&queue->head);
-	queue->count = 0;
+	mfc_init_queue(queue);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 }
@@ -686,11 +660,9 @@ struct mfc_buf *mfc_search_move_dpb_nal_q(struct mfc_core_ctx *core_ctx)
 		if ((dec->dynamic_used & (1UL << mfc_buf->dpb_index)) == 0) {
 			mfc_buf->used = 1;
 
-			list_del(&mfc_buf->list);
-			ctx->dst_buf_queue.count--;
-
-			list_add_tail(&mfc_buf->list, &ctx->dst_buf_nal_queue.head);
-			ctx->dst_buf_nal_queue.count++;
+			__mfc_queue_del(&ctx->dst_buf_queue, mfc_buf);
+			__mfc_queue_add(&ctx->dst_buf_nal_queue, mfc_buf,
+					MFC_QUEUE_ADD_BOTTOM);
 
 			spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
 			return mfc_buf;
@@ -883,8 +855,7 @@ void mfc_store_dpb(struct mfc_ctx *ctx, struct vb2_buffer *vb)
 
 		spin_lock_irqsave(&ctx->buf_queue_lock, flags);
 
-		list_add_tail(&mfc_buf->list, &ctx->dst_buf_err_queue.head);
-		ctx->dst_buf_err_queue.count++;
+		__mfc_queue_add(&ctx->dst_buf_err_queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 		mfc_debug(2, "[DPB] DPB[%d][%d] fd: %d will be not used %pad %s %s (%d)\n",
 				mfc_buf->vb.vb2_buf.index, index,
 				mfc_buf->vb.planes[0].m.fd, &mfc_buf->addr[0][0],
@@ -914,8 +885,7 @@ void mfc_store_dpb(struct mfc_ctx *ctx, struct vb2_buffer *vb)
 
 	spin_lock_irqsave(&ctx->buf_queue_lock, flags);
 
-	list_add_tail(&mfc_buf->list, &ctx->dst_buf_queue.head);
-	ctx->dst_buf_queue.count++;
+	__mfc_queue_add(&ctx->dst_buf_queue, mfc_buf, MFC_QUEUE_ADD_BOTTOM);
 	set_bit(index, &dec->queued_dpb);
 
 	spin_unlock_irqrestore(&ctx->buf_queue_lock, flags);
@@ -945,11 +915,8 @@ void mfc_cleanup_nal_queue(struct mfc_core_ctx *core_ctx)
 			src_mb->next_index = src_mb->done_index;
 		}
 
-		list_del(&src_mb->list);
-		ctx->src_buf_nal_queue.count--;
-
-		list_add(&src_mb->list, &core_ctx->src_buf_queue.head);
-		core_ctx->src_buf_queue.count++;
+		__mfc_queue_del(&ctx->src_buf_nal_queue, src_mb);
+		__mfc_queue_add(&core_ctx->src_buf_queue, src_mb, MFC_QUEUE_ADD_TOP);
 
 		mfc_debug(2, "[NALQ] cleanup, src_buf_nal_queue -> src_buf_queue, index:%d\n",
 				src_mb->vb.vb2_buf.index);
@@ -959,11 +926,8 @@ void mfc_cleanup_nal_queue(struct mfc_core_ctx *core_ctx)
 		dst_mb = list_entry(ctx->dst_buf_nal_queue.head.prev, struct mfc_buf, list);
 
 		dst_mb->used = 0;
-		list_del(&dst_mb->list);
-		ctx->dst_buf_nal_queue.count--;
-
-		list_add(&dst_mb->list, &ctx->dst_buf_queue.head);
-		ctx->dst_buf_queue.count++;
+		__mfc_queue_del(&ctx->dst_buf_nal_queue, dst_mb);
+		__mfc_queue_add(&ctx->dst_buf_queue, dst_mb, MFC_QUEUE_ADD_TOP);
 
 		mfc_debug(2, "[NALQ] cleanup, dst_buf_nal_queue -> dst_buf_queue, index:[%d][%d]\n",
 				dst_mb->vb.vb2_buf.index, dst_mb->dpb_index);
@@ -86,10 +86,29 @@ static inline int mfc_is_queue_count_smaller(spinlock_t *plock, struct mfc_buf_q
 	return ret;
 }
 
+/* Returns the time the first buffer of @queue was queued, 0 if it is empty */
+static inline ktime_t mfc_get_queue_first_time(spinlock_t *plock, struct mfc_buf_queue *queue)
+{
+	struct mfc_buf *mfc_buf;
+	unsigned long flags;
+	ktime_t ret = 0;
+
+	spin_lock_irqsave(plock, flags);
+	mfc_buf = list_first_entry_or_null(&queue->head, struct mfc_buf, list);
+	if (mfc_buf)
+		ret = mfc_buf->queued;
+	spin_unlock_irqrestore(plock, flags);
+
+	return ret;
+}
+
 static inline void mfc_init_queue(struct mfc_buf_queue *queue)
 {
 	INIT_LIST_HEAD(&queue->head);
 	queue->count = 0;
+	hash_init(queue->addr_hash);
+	queue->head_seq = 0;
+	queue->tail_seq = 0;
 }
 
 static inline void mfc_create_queue(struct mfc_buf_queue *queue)
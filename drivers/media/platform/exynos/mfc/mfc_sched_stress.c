@@ -0,0 +1,299 @@
+/*
+ * drivers/media/platform/exynos/mfc/mfc_sched_stress.c
+ *
+ * Copyright (c) 2023 Samsung Electronics Co., Ltd.
+ *		http://www.samsung.com/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Stress of the context scheduling. Writing "<rt> <bg> [fps] [hw_us]" to
+ * the sched_stress debugfs file runs <rt> real-time instances at [fps]
+ * (30 by default) and <bg> non real-time instances that always have a
+ * frame to run, on a core of a simulated clock where every frame takes
+ * [hw_us] (5000 by default) of H/W time. It is run with the round-robin
+ * and with the sched_edf picker of mfc_sync.c, and reading the file shows
+ * the deadline miss rate of each class.
+ *
+ * Real instances are opened through the V4L2 file operations with user
+ * buffers and bitstreams, so the instances here are the core contexts
+ * the pickers look at, with the deadlines from mfc_sched_deadline.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "mfc_sched_stress.h"
+
+#include "mfc_sync.h"
+
+#define MFC_SCHED_STRESS_DURATION_MS	10000
+#define MFC_SCHED_STRESS_PENDING	16
+
+enum mfc_sched_stress_class {
+	MFC_SCHED_STRESS_RT,
+	MFC_SCHED_STRESS_BG,
+	MFC_SCHED_STRESS_CLASSES,
+};
+
+enum mfc_sched_stress_policy {
+	MFC_SCHED_STRESS_RR,
+	MFC_SCHED_STRESS_EDF,
+	MFC_SCHED_STRESS_POLICIES,
+};
+
+struct mfc_sched_stress_ctx {
+	enum mfc_real_time rt;
+	unsigned long framerate;
+	u64 period;
+	u64 next_arrival;
+	u64 pending[MFC_SCHED_STRESS_PENDING];
+	int head;
+	int count;
+};
+
+struct mfc_sched_stress_result {
+	unsigned long frames;
+	unsigned long missed;
+};
+
+static DEFINE_MUTEX(mfc_sched_stress_lock);
+static struct mfc_sched_stress_result
+	mfc_sched_stress_results[MFC_SCHED_STRESS_POLICIES][MFC_SCHED_STRESS_CLASSES];
+static unsigned int mfc_sched_stress_args[4];
+
+static void __mfc_sched_stress_arrive(struct mfc_sched_stress_ctx *sctx,
+		struct mfc_sched_stress_result *res, u64 now)
+{
+	if (sctx->rt == MFC_NON_RT) {
+		/* a transcode has the next frame as soon as one is done */
+		if (!sctx->count) {
+			sctx->pending[sctx->head] = now;
+			sctx->count = 1;
+		}
+		return;
+	}
+
+	while (sctx->next_arrival <= now) {
+		if (sctx->count == MFC_SCHED_STRESS_PENDING) {
+			/* dropped by the user, counted as missed */
+			res->frames++;
+			res->missed++;
+		} else {
+			sctx->pending[(sctx->head + sctx->count) %
+				MFC_SCHED_STRESS_PENDING] = sctx->next_arrival;
+			sctx->count++;
+		}
+		sctx->next_arrival += sctx->period;
+	}
+}
+
+/* Same as the round-robin of mfc_core_get_new_ctx */
+static int __mfc_sched_stress_get_rr_ctx(struct mfc_core *core)
+{
+	int index, i;
+
+	for (i = 1; i <= MFC_NUM_CONTEXTS; i++) {
+		index = (core->curr_core_ctx + i) % MFC_NUM_CONTEXTS;
+		if (test_bit(index, &core->work_bits.bits))
+			return index;
+	}
+
+	return -EAGAIN;
+}
+
+static void __mfc_sched_stress_run(struct mfc_core *core,
+		struct mfc_sched_stress_ctx *sctx, int num_ctx, u64 hw_ns,
+		enum mfc_sched_stress_policy policy)
+{
+	struct mfc_sched_stress_result *res = mfc_sched_stress_results[policy];
+	u64 end = (u64)MFC_SCHED_STRESS_DURATION_MS * NSEC_PER_MSEC;
+	u64 now = 0, next;
+	unsigned long flags;
+	int i, index, class;
+
+	for (i = 0; i < num_ctx; i++) {
+		sctx[i].next_arrival = 0;
+		sctx[i].head = 0;
+		sctx[i].count = 0;
+	}
+	core->curr_core_ctx = 0;
+
+	while (now < end) {
+		spin_lock_irqsave(&core->work_bits.lock, flags);
+		core->work_bits.bits = 0;
+		for (i = 0; i < num_ctx; i++) {
+			class = sctx[i].rt == MFC_NON_RT ?
+				MFC_SCHED_STRESS_BG : MFC_SCHED_STRESS_RT;
+			__mfc_sched_stress_arrive(&sctx[i], &res[class], now);
+			if (!sctx[i].count)
+				continue;
+
+			core->core_ctx[i]->deadline = mfc_sched_deadline(
+					ns_to_ktime(sctx[i].pending[sctx[i].head]),
+					sctx[i].framerate, sctx[i].rt);
+			set_bit(i, &core->work_bits.bits);
+		}
+
+		if (policy == MFC_SCHED_STRESS_EDF)
+			index = mfc_core_get_edf_ctx(core, MFC_NO_INSTANCE_SET);
+		else
+			index = __mfc_sched_stress_get_rr_ctx(core);
+		spin_unlock_irqrestore(&core->work_bits.lock, flags);
+
+		if (index < 0) {
+			/* idle until the next frame arrives */
+			next = end;
+			for (i = 0; i < num_ctx; i++)
+				if (sctx[i].rt != MFC_NON_RT)
+					next = min(next, sctx[i].next_arrival);
+			now = next;
+			continue;
+		}
+
+		now += hw_ns;
+		class = sctx[index].rt == MFC_NON_RT ?
+			MFC_SCHED_STRESS_BG : MFC_SCHED_STRESS_RT;
+		res[class].frames++;
+		if (now > ktime_to_ns(core->core_ctx[index]->deadline))
+			res[class].missed++;
+		sctx[index].head = (sctx[index].head + 1) % MFC_SCHED_STRESS_PENDING;
+		sctx[index].count--;
+		core->curr_core_ctx = index;
+
+		cond_resched();
+	}
+}
+
+static int __mfc_sched_stress(unsigned int num_rt, unsigned int num_bg,
+		unsigned int fps, unsigned int hw_us)
+{
+	struct mfc_sched_stress_ctx *sctx;
+	struct mfc_core *core;
+	int num_ctx = num_rt + num_bg;
+	int i, ret = 0;
+
+	if (!num_ctx || num_ctx > MFC_NUM_CONTEXTS || !fps || !hw_us)
+		return -EINVAL;
+
+	core = kvzalloc(sizeof(*core), GFP_KERNEL);
+	sctx = kcalloc(num_ctx, sizeof(*sctx), GFP_KERNEL);
+	if (!core || !sctx) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock_init(&core->work_bits.lock);
+	for (i = 0; i < num_ctx; i++) {
+		core->core_ctx[i] = kvzalloc(sizeof(*core->core_ctx[i]), GFP_KERNEL);
+		if (!core->core_ctx[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		/* interleave the classes not to favor either by the index */
+		if (i % 2 ? num_bg : !num_rt) {
+			sctx[i].rt = MFC_NON_RT;
+			num_bg--;
+		} else {
+			sctx[i].rt = MFC_RT;
+			num_rt--;
+		}
+		sctx[i].framerate = fps * 1000;
+		sctx[i].period = div_u64(NSEC_PER_SEC, fps);
+	}
+
+	memset(mfc_sched_stress_results, 0, sizeof(mfc_sched_stress_results));
+	for (i = 0; i < MFC_SCHED_STRESS_POLICIES; i++)
+		__mfc_sched_stress_run(core, sctx, num_ctx,
+				(u64)hw_us * NSEC_PER_USEC, i);
+
+out:
+	if (core)
+		for (i = 0; i < num_ctx; i++)
+			kvfree(core->core_ctx[i]);
+	kvfree(core);
+	kfree(sctx);
+
+	return ret;
+}
+
+static int __mfc_sched_stress_show(struct seq_file *s, void *unused)
+{
+	static const char * const policy_name[] = { "rr", "edf" };
+	static const char * const class_name[] = { "rt", "bg" };
+	struct mfc_sched_stress_result *res;
+	int i, j;
+
+	mutex_lock(&mfc_sched_stress_lock);
+	seq_printf(s, "rt: %u, bg: %u, fps: %u, hw: %u us\n",
+			mfc_sched_stress_args[0], mfc_sched_stress_args[1],
+			mfc_sched_stress_args[2], mfc_sched_stress_args[3]);
+	seq_puts(s, " policy class     frames     missed  miss(%)\n");
+	for (i = 0; i < MFC_SCHED_STRESS_POLICIES; i++) {
+		for (j = 0; j < MFC_SCHED_STRESS_CLASSES; j++) {
+			res = &mfc_sched_stress_results[i][j];
+			if (!res->frames)
+				continue;
+			seq_printf(s, " %-6s %-5s %10lu %10lu %8lu\n",
+					policy_name[i], class_name[j],
+					res->frames, res->missed,
+					res->missed * 100 / res->frames);
+		}
+	}
+	mutex_unlock(&mfc_sched_stress_lock);
+
+	return 0;
+}
+
+static int __mfc_sched_stress_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, __mfc_sched_stress_show, inode->i_private);
+}
+
+static ssize_t __mfc_sched_stress_write(struct file *file,
+		const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	unsigned int args[4] = { 0, 0, 30, 5000 };
+	char buf[64];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%u %u %u %u", &args[0], &args[1], &args[2], &args[3]) < 2)
+		return -EINVAL;
+
+	mutex_lock(&mfc_sched_stress_lock);
+	ret = __mfc_sched_stress(args[0], args[1], args[2], args[3]);
+	if (!ret)
+		memcpy(mfc_sched_stress_args, args, sizeof(args));
+	mutex_unlock(&mfc_sched_stress_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations sched_stress_fops = {
+	.open = __mfc_sched_stress_open,
+	.read = seq_read,
+	.write = __mfc_sched_stress_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void mfc_sched_stress_init_debugfs(struct mfc_dev *dev)
+{
+	debugfs_create_file("sched_stress",
+			0644, dev->debugfs.root, dev, &sched_stress_fops);
+}
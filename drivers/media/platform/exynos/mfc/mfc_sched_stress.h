@@ -0,0 +1,24 @@
+/*
+ * drivers/media/platform/exynos/mfc/mfc_sched_stress.h
+ *
+ * Copyright (c) 2023 Samsung Electronics Co., Ltd.
+ *		http://www.samsung.com/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __MFC_SCHED_STRESS_H
+#define __MFC_SCHED_STRESS_H __FILE__
+
+#include "mfc_common.h"
+
+#if IS_ENABLED(CONFIG_MFC_SCHED_STRESS)
+void mfc_sched_stress_init_debugfs(struct mfc_dev *dev);
+#else
+static inline void mfc_sched_stress_init_debugfs(struct mfc_dev *dev) {}
+#endif
+
+#endif /* __MFC_SCHED_STRESS_H */
@@ -16,8 +16,12 @@
 
 #include "mfc_core_hw_reg_api.h"
 
+#include "mfc_qos.h"
 #include "mfc_queue.h"
 
+/* Slack of the non real-time instances not to starve them */
+#define MFC_SCHED_NON_RT_SLACK_MS	500
+
 #define R2H_BIT(x)	(((x) > 0) ? (1 << ((x) - 1)) : 0)
 
 static inline unsigned int __mfc_r2h_bit_mask(int cmd)
@@ -284,9 +288,85 @@ void mfc_wake_up_core_ctx(struct mfc_core_ctx *core_ctx, unsigned int reason,
 	wake_up(&core_ctx->cmd_wq);
 }
 
+/*
+ * sched_edf: the ready instance of the earliest deadline runs first.
+ * The deadline is the frame period after the first source buffer was
+ * queued. Low-priority and constrained real-time instances get twice the
+ * period and non real-time ones a fixed slack, so a real-time instance
+ * doesn't wait behind a background one and the others still progress.
+ */
+ktime_t mfc_sched_deadline(ktime_t queued, unsigned long framerate,
+		enum mfc_real_time rt)
+{
+	u64 period;
+
+	if (!framerate)
+		framerate = MFC_MIN_FPS;
+
+	/* framerate is fps * 1000 */
+	period = div64_u64(NSEC_PER_SEC * 1000ULL, framerate);
+	switch (rt) {
+	case MFC_RT:
+		break;
+	case MFC_RT_LOW:
+	case MFC_RT_CON:
+		period *= 2;
+		break;
+	default:
+		period = MFC_SCHED_NON_RT_SLACK_MS * NSEC_PER_MSEC;
+		break;
+	}
+
+	return ktime_add_ns(queued, period);
+}
+
+static ktime_t __mfc_ctx_deadline(struct mfc_core_ctx *core_ctx)
+{
+	struct mfc_ctx *ctx = core_ctx->ctx;
+	ktime_t queued;
+
+	queued = mfc_get_queue_first_time(&ctx->buf_queue_lock,
+			&core_ctx->src_buf_queue);
+	if (!queued)
+		queued = ktime_get();
+
+	return mfc_sched_deadline(queued, ctx->framerate, ctx->rt);
+}
+
+/*
+ * Should be called with work_bits.lock. Returns the ready context of the
+ * earliest deadline except @skip, the one after the current context first
+ * among the same deadlines.
+ */
+int mfc_core_get_edf_ctx(struct mfc_core *core, int skip)
+{
+	struct mfc_core_ctx *core_ctx;
+	ktime_t deadline = KTIME_MAX;
+	int index, ctx_index = -EAGAIN;
+	int i;
+
+	for (i = 1; i <= MFC_NUM_CONTEXTS; i++) {
+		index = (core->curr_core_ctx + i) % MFC_NUM_CONTEXTS;
+		if (index == skip || !test_bit(index, &core->work_bits.bits))
+			continue;
+
+		core_ctx = core->core_ctx[index];
+		if (!core_ctx)
+			continue;
+
+		if (ctx_index < 0 || ktime_before(core_ctx->deadline, deadline)) {
+			deadline = core_ctx->deadline;
+			ctx_index = index;
+		}
+	}
+
+	return ctx_index;
+}
+
 int mfc_core_get_new_ctx(struct mfc_core *core)
 {
 	struct mfc_dev *dev = core->dev;
+	struct mfc_core_ctx *core_ctx;
 	unsigned long wflags;
 	int new_ctx_index = 0;
 	int cnt = 0;
@@ -311,6 +391,18 @@ int mfc_core_get_new_ctx(struct mfc_core *core)
 			}
 		}
 
+		if (sched_edf) {
+			new_ctx_index = mfc_core_get_edf_ctx(core, MFC_NO_INSTANCE_SET);
+			if (new_ctx_index >= 0) {
+				core_ctx = core->core_ctx[new_ctx_index];
+				core_ctx->sched_cnt++;
+				if (ktime_after(ktime_get(), core_ctx->deadline))
+					core_ctx->sched_miss++;
+			}
+			spin_unlock_irqrestore(&core->work_bits.lock, wflags);
+			return new_ctx_index;
+		}
+
 		new_ctx_index = (core->curr_core_ctx + 1) % MFC_NUM_CONTEXTS;
 		while (!test_bit(new_ctx_index, &core->work_bits.bits)) {
 			new_ctx_index = (new_ctx_index + 1) % MFC_NUM_CONTEXTS;
@@ -338,6 +430,12 @@ int mfc_core_get_next_ctx(struct mfc_core *core)
 	mfc_core_debug(2, "Current context: %d (bits %08lx)\n",
 			core->curr_core_ctx, core->work_bits.bits);
 
+	if (sched_edf) {
+		next_ctx_index = mfc_core_get_edf_ctx(core, curr_ctx_index);
+		spin_unlock_irqrestore(&core->work_bits.lock, wflags);
+		return next_ctx_index;
+	}
+
 	while (!test_bit(next_ctx_index, &core->work_bits.bits)) {
 		next_ctx_index = (next_ctx_index + 1) % MFC_NUM_CONTEXTS;
 		if (next_ctx_index == curr_ctx_index) {
@@ -359,6 +457,7 @@ int __mfc_dec_ctx_ready_set_bit(struct mfc_core_ctx *core_ctx,
 	int src_buf_queue_greater_than_0 = 0;
 	int dst_buf_queue_check_available = 0;
 	unsigned long flags;
+	ktime_t deadline = 0;
 	int is_ready = 0;
 
 	mfc_debug(1, "[MFC-%d][c:%d] src = %d(ready = %d), dst = %d, src_nal = %d, dst_nal = %d, state = %d, capstat = %d, waitstat = %d\n",
@@ -383,6 +482,9 @@ int __mfc_dec_ctx_ready_set_bit(struct mfc_core_ctx *core_ctx,
 	if (core->shutdown)
 		return 0;
 
+	if (sched_edf)
+		deadline = __mfc_ctx_deadline(core_ctx);
+
 	/* The ready condition check and set work_bit should be synchronized */
 	spin_lock_irqsave(&data->lock, flags);
 
@@ -429,6 +531,10 @@ int __mfc_dec_ctx_ready_set_bit(struct mfc_core_ctx *core_ctx,
 		}
 	}
 
+	/* The deadline moves to the next frame while the ctx stays ready */
+	if (is_ready && deadline)
+		core_ctx->deadline = deadline;
+
 	spin_unlock_irqrestore(&data->lock, flags);
 
 	return is_ready;
@@ -444,6 +550,7 @@ static int __mfc_enc_ctx_ready_set_bit(struct mfc_core_ctx *core_ctx,
 	int src_buf_queue_greater_than_0 = 0;
 	int dst_buf_queue_greater_than_0 = 0;
 	unsigned long flags;
+	ktime_t deadline = 0;
 	int is_ready = 0;
 
 	mfc_debug(1, "[MFC-%d][c:%d] src = %d(ready = %d), dst = %d, src_nal = %d, dst_nal = %d, state = %d, capstat = %d, waitstat = %d\n",
@@ -469,6 +576,9 @@ static int __mfc_enc_ctx_ready_set_bit(struct mfc_core_ctx *core_ctx,
 	if (core->shutdown)
 		return 0;
 
+	if (sched_edf)
+		deadline = __mfc_ctx_deadline(core_ctx);
+
 	/* The ready condition check and set work_bit should be synchronized */
 	spin_lock_irqsave(&data->lock, flags);
 
@@ -515,6 +625,10 @@ static int __mfc_enc_ctx_ready_set_bit(struct mfc_core_ctx *core_ctx,
 		}
 	}
 
+	/* The deadline moves to the next frame while the ctx stays ready */
+	if (is_ready && deadline)
+		core_ctx->deadline = deadline;
+
 	spin_unlock_irqrestore(&data->lock, flags);
 
 	return is_ready;
@@ -48,6 +48,9 @@ void mfc_wake_up_core(struct mfc_core *core, unsigned int reason,
 void mfc_wake_up_core_ctx(struct mfc_core_ctx *core_ctx, unsigned int reason,
 		unsigned int err);
 
+ktime_t mfc_sched_deadline(ktime_t queued, unsigned long framerate,
+		enum mfc_real_time rt);
+int mfc_core_get_edf_ctx(struct mfc_core *core, int skip);
 int mfc_core_get_new_ctx(struct mfc_core *core);
 int mfc_core_get_next_ctx(struct mfc_core *core);
 
@@ -120,6 +120,17 @@ struct eh_device {
 	/* keep pending request */
 	struct eh_sw_fifo sw_fifo;
 	atomic64_t nr_stall;
+	/*
+	 * eh_compress_page_nowait refuses requests once the HW fifo is
+	 * full and sw_fifo holds this many requests. Defaults to
+	 * EH_FALLBACK_THRESHOLD (512) requests, capped by sw_fifo_size,
+	 * and 0 makes every such request fall back to the CPU.
+	 */
+	unsigned int fallback_threshold;
+	/* how many requests eh_compress_page_nowait refused */
+	atomic64_t nr_fallback;
+	/* how many decompressions copied the source to the bounce buffer */
+	atomic64_t nr_bounce;
 #ifdef CONFIG_SOC_ZUMA
 	int ip_index;
 #endif
@@ -44,6 +44,7 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
@@ -117,6 +118,8 @@ static DECLARE_WAIT_QUEUE_HEAD(eh_compress_wait);
 static unsigned int eh_default_fifo_size = 512;
 
 #define EH_SW_FIFO_SIZE	(1 << 16)
+/* about one HW fifo of requests may wait in sw_fifo before falling back */
+#define EH_FALLBACK_THRESHOLD	512
 
 #define first_to_eh_request(head) (list_entry((head)->prev, \
 					      struct eh_request, list))
@@ -154,6 +157,8 @@ static int create_sw_fifo(struct eh_device *eh_dev, int fifo_size)
 	eh_dev->pool.count = i;
 	eh_dev->sw_fifo.count = 0;
 	eh_dev->sw_fifo_size = fifo_size;
+	eh_dev->fallback_threshold = min_t(unsigned int, EH_FALLBACK_THRESHOLD,
+					   fifo_size);
 
 	return 0;
 err:
@@ -254,13 +259,17 @@ static inline unsigned int fifo_complete_index(struct eh_device *eh_dev)
 	return eh_dev->complete_index & eh_dev->fifo_index_mask;
 }
 
-static inline void update_fifo_write_index(struct eh_device *eh_dev)
+/* advance the cached write index without ringing the doorbell */
+static inline void advance_fifo_write_index(struct eh_device *eh_dev)
 {
-	unsigned int next_write_idx = (eh_dev->write_index + 1) &
-				       eh_dev->fifo_color_mask;
+	eh_dev->write_index = (eh_dev->write_index + 1) &
+			       eh_dev->fifo_color_mask;
+}
 
-	eh_dev->write_index = next_write_idx;
-	eh_write_register(eh_dev, EH_REG_CDESC_WRIDX, next_write_idx);
+static inline void update_fifo_write_index(struct eh_device *eh_dev)
+{
+	advance_fifo_write_index(eh_dev);
+	eh_write_register(eh_dev, EH_REG_CDESC_WRIDX, eh_dev->write_index);
 }
 
 static inline void update_fifo_complete_index(struct eh_device *eh_dev)
@@ -486,6 +495,44 @@ static int request_to_hw_fifo(struct eh_device *eh_dev, struct page *page,
 	return 0;
 }
 
+/*
+ * Put as many of the @nr requests as the HW fifo can take and let EH know
+ * with a single write index update. Returns the number of queued requests.
+ */
+static unsigned int request_to_hw_fifo_batch(struct eh_device *eh_dev,
+					     struct page **pages, void **priv,
+					     unsigned int nr)
+{
+	unsigned int i, write_idx;
+
+	spin_lock(&eh_dev->fifo_prod_lock);
+	for (i = 0; i < nr; i++) {
+		if (fifo_full(eh_dev))
+			break;
+
+		write_idx = fifo_write_index(eh_dev);
+		eh_setup_descriptor(eh_dev, pages[i], write_idx);
+		eh_dev->completions[write_idx].priv = priv[i];
+		atomic_inc(&eh_dev->nr_request);
+		advance_fifo_write_index(eh_dev);
+	}
+
+	if (i) {
+#ifdef CONFIG_SOC_ZUMA
+		exynos_update_ip_idle_status(eh_dev->ip_index, 0);
+#endif
+		wake_up(&eh_dev->comp_wq);
+
+		/* write barrier to force writes to be visible everywhere */
+		wmb();
+		eh_write_register(eh_dev, EH_REG_CDESC_WRIDX,
+				  eh_dev->write_index);
+	}
+	spin_unlock(&eh_dev->fifo_prod_lock);
+
+	return i;
+}
+
 static void flush_sw_fifo(struct eh_device *eh_dev)
 {
 	struct eh_sw_fifo *fifo = &eh_dev->sw_fifo;
@@ -1032,6 +1079,9 @@ iounmap:
 #define EH_ATTR_RO(_name) \
 	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
 
+#define EH_ATTR_RW(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RW(_name)
+
 static ssize_t nr_stall_show(struct kobject *kobj, struct kobj_attribute *attr,
 			  char *buf)
 {
@@ -1041,6 +1091,49 @@ static ssize_t nr_stall_show(struct kobject *kobj, struct kobj_attribute *attr,
 }
 EH_ATTR_RO(nr_stall);
 
+static ssize_t nr_fallback_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct eh_device *eh_dev = container_of(kobj, struct eh_device, kobj);
+
+	return sysfs_emit(buf, "%llu\n", atomic64_read(&eh_dev->nr_fallback));
+}
+EH_ATTR_RO(nr_fallback);
+
+static ssize_t nr_bounce_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct eh_device *eh_dev = container_of(kobj, struct eh_device, kobj);
+
+	return sysfs_emit(buf, "%llu\n", atomic64_read(&eh_dev->nr_bounce));
+}
+EH_ATTR_RO(nr_bounce);
+
+static ssize_t fallback_threshold_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct eh_device *eh_dev = container_of(kobj, struct eh_device, kobj);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(eh_dev->fallback_threshold));
+}
+
+static ssize_t fallback_threshold_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t len)
+{
+	struct eh_device *eh_dev = container_of(kobj, struct eh_device, kobj);
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	if (val > eh_dev->sw_fifo_size)
+		return -EINVAL;
+
+	WRITE_ONCE(eh_dev->fallback_threshold, val);
+	return len;
+}
+EH_ATTR_RW(fallback_threshold);
+
 static ssize_t nr_run_show(struct kobject *kobj,
 		struct kobj_attribute *attr,
 		char *buf)
@@ -1072,6 +1165,9 @@ EH_ATTR_RO(sw_fifo_size);
 
 static struct attribute *eh_attrs[] = {
 	&nr_stall_attr.attr,
+	&nr_fallback_attr.attr,
+	&nr_bounce_attr.attr,
+	&fallback_threshold_attr.attr,
 	&nr_run_attr.attr,
 	&nr_compressed_attr.attr,
 	&sw_fifo_size_attr.attr,
@@ -1126,38 +1222,69 @@ static int eh_init(struct device *device, struct eh_device *eh_dev,
 	return ret;
 }
 
+/*
+ * EH can accept only aligned source buffers for decompression
+ *
+ * Compressed data buffer must be one of:
+ *   64B aligned, max 64B of data
+ *  128B aligned, max 128B of data
+ *  256B aligned, max 256B of data
+ *  512B aligned, max 512B of data
+ * 1024B aligned, max 1024B of data
+ * 2048B aligned, max 2048B of data
+ * 4096B aligned, max 4096B of data
+ *
+ * and the HW reads up to EH_DCMD_NR_BUFS buffers in order, so every
+ * buffer but the last should be full. Split the source into such
+ * buffers and returns the number of buffers, or 0 if it doesn't fit.
+ */
+static unsigned int eh_dcmd_map_bufs(void *src, unsigned int slen,
+				     unsigned long *buf_data)
+{
+	unsigned long addr = (unsigned long)src;
+	unsigned long len = slen;
+	unsigned int n = 0;
+
+	while (len) {
+		unsigned long size;
+
+		if (n == EH_DCMD_NR_BUFS)
+			return 0;
+
+		size = min(1UL << __ffs(addr), PAGE_SIZE);
+		if (size < 64)
+			return 0;
+
+		/* a smaller power of two is aligned as well */
+		if (len < size)
+			size = max(roundup_pow_of_two(len), 64UL);
+
+		buf_data[n++] = (__ffs(size) - 5) << EH_DCMD_BUF_SIZE_SHIFT |
+				virt_to_phys((void *)addr);
+		addr += size;
+		len -= min(len, size);
+	}
+
+	return n;
+}
+
 static void eh_setup_dcmd(struct eh_device *eh_dev, unsigned int index,
 			  void *src, unsigned int slen, struct page *dst_page)
 {
-	void *src_vaddr;
-	phys_addr_t src_paddr;
-	unsigned long alignment;
+	unsigned long buf_data[EH_DCMD_NR_BUFS] = { 0 };
 	unsigned long csize_data;
-	unsigned long src_data;
 	unsigned long dst_data;
 
-	/*
-	 * EH can accept only aligned source buffers for decompression
-	 *
-	 * Compressed data buffer must be one of:
-	 *   64B aligned, max 64B of data
-	 *  128B aligned, max 128B of data
-	 *  256B aligned, max 256B of data
-	 *  512B aligned, max 512B of data
-	 * 1024B aligned, max 1024B of data
-	 * 2048B aligned, max 2048B of data
-	 * 4096B aligned, max 4096B of data
-	 */
-	alignment = 1UL << __ffs((unsigned long)src);
-	if (alignment < 64 || slen > alignment) {
+	if (!eh_dcmd_map_bufs(src, slen, buf_data)) {
+		void *src_vaddr;
+
 		src_vaddr = (void *)(*per_cpu_ptr(eh_dev->bounce_buffer, index));
 		memcpy(src_vaddr, src, slen);
-		src_paddr = virt_to_phys(src_vaddr);
-		alignment = PAGE_SIZE;
-	} else {
-		src_paddr = virt_to_phys(src);
-		if (alignment > PAGE_SIZE)
-			alignment = PAGE_SIZE;
+
+		memset(buf_data, 0, sizeof(buf_data));
+		buf_data[0] = (__ffs(PAGE_SIZE) - 5) << EH_DCMD_BUF_SIZE_SHIFT |
+			      virt_to_phys(src_vaddr);
+		atomic64_inc(&eh_dev->nr_bounce);
 	}
 
 	csize_data = slen << EH_DCMD_CSIZE_SIZE_SHIFT;
@@ -1171,12 +1298,10 @@ static void eh_setup_dcmd(struct eh_device *eh_dev, unsigned int index,
 				  virt_to_phys(&eh_dev->decompr_status[index]));
 #endif
 
-	src_data = (__ffs(alignment) - 5) << EH_DCMD_BUF_SIZE_SHIFT;
-	src_data |= src_paddr;
-	eh_write_register(eh_dev, EH_REG_DCMD_BUF0(index), src_data);
-	eh_write_register(eh_dev, EH_REG_DCMD_BUF1(index), 0);
-	eh_write_register(eh_dev, EH_REG_DCMD_BUF2(index), 0);
-	eh_write_register(eh_dev, EH_REG_DCMD_BUF3(index), 0);
+	eh_write_register(eh_dev, EH_REG_DCMD_BUF0(index), buf_data[0]);
+	eh_write_register(eh_dev, EH_REG_DCMD_BUF1(index), buf_data[1]);
+	eh_write_register(eh_dev, EH_REG_DCMD_BUF2(index), buf_data[2]);
+	eh_write_register(eh_dev, EH_REG_DCMD_BUF3(index), buf_data[3]);
 
 	dst_data = page_to_phys(dst_page);
 	dst_data |= ((unsigned long)EH_DCMD_PENDING)
@@ -1205,12 +1330,56 @@ req_to_sw_fifo:
 }
 EXPORT_SYMBOL(eh_compress_page);
 
+int eh_compress_page_nowait(struct eh_device *eh_dev, struct page *page,
+			    void *priv)
+{
+	if (sw_fifo_empty(&eh_dev->sw_fifo) &&
+	    !request_to_hw_fifo(eh_dev, page, priv, true))
+		return 0;
+
+	/*
+	 * The check is racy but it's fine to exceed the threshold a bit.
+	 * The threshold is capped by sw_fifo_size so request_to_sw_fifo
+	 * shouldn't need to wait for the request pool.
+	 */
+	if (READ_ONCE(eh_dev->sw_fifo.count) <
+			READ_ONCE(eh_dev->fallback_threshold)) {
+		request_to_sw_fifo(eh_dev, page, priv);
+		return 0;
+	}
+
+	atomic64_inc(&eh_dev->nr_fallback);
+	return -EBUSY;
+}
+EXPORT_SYMBOL(eh_compress_page_nowait);
+
+int eh_compress_pages(struct eh_device *eh_dev, struct page **pages,
+		      void **priv, unsigned int nr)
+{
+	unsigned int i = 0;
+
+	/* See eh_compress_page */
+	if (sw_fifo_empty(&eh_dev->sw_fifo))
+		i = request_to_hw_fifo_batch(eh_dev, pages, priv, nr);
+
+	for (; i < nr; i++)
+		request_to_sw_fifo(eh_dev, pages[i], priv[i]);
+
+	return 0;
+}
+EXPORT_SYMBOL(eh_compress_pages);
+
 /*
  * eh_decompress_page
  *
  * Decompress a page synchronously. Uses polling for completion.
  *
  * Holds a spinlock for the entire operation, so that nothing can interrupt it.
+ *
+ * @src is handed to the HW in place if it can be split into up to
+ * EH_DCMD_NR_BUFS buffers, each a 64B..4KB power of two aligned to its
+ * size and all but the last full (see eh_dcmd_map_bufs). Otherwise it's
+ * copied to the per-cpu bounce buffer.
  */
 int eh_decompress_page(struct eh_device *eh_dev, void *src,
 		       unsigned int slen, struct page *page)
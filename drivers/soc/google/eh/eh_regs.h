@@ -280,6 +280,8 @@ struct eh_compress_desc {
 #define EH_REG_DCMD_BUF1(n)  (0x820 + ((n) * EH_DCMD_REGSET_SIZE))
 #define EH_REG_DCMD_BUF2(n)  (0x828 + ((n) * EH_DCMD_REGSET_SIZE))
 #define EH_REG_DCMD_BUF3(n)  (0x830 + ((n) * EH_DCMD_REGSET_SIZE))
+/* number of source buffers of a decompression command */
+#define EH_DCMD_NR_BUFS      4
 
 /*
  * Decompression command status from the specification
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * GCMA admission filter and adaptive sizing
+ *
+ * The accesses to the cleancache pages (stores and loads) are recorded in
+ * a count-min sketch keyed by the filekey and offset, whose counters are
+ * halved periodically so that it reflects the recent frequency only.
+ *
+ * GCMA keeps up to the target number of pages. Below the target every
+ * workingset page is admitted. Beyond it, only the pages seen recently,
+ * e.g. loaded in vain after they were evicted or rejected, are admitted,
+ * which costs an eviction.
+ *
+ * The target is adjusted by the hit ratio of the loads: it shrinks when
+ * the cached pages are rarely hit so that useless stores and evictions
+ * stop, and it grows back when they are hit.
+ */
+
+#include <linux/atomic.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/workqueue.h>
+
+#include "gcma_admit.h"
+#include "gcma_debug.h"
+
+#define GCMA_SKETCH_BITS	14
+#define GCMA_SKETCH_SIZE	(1UL << GCMA_SKETCH_BITS)
+#define GCMA_SKETCH_DEPTH	4
+#define GCMA_SKETCH_MAX		15
+/* accesses recorded before the counters are halved */
+#define GCMA_SKETCH_SAMPLE	(GCMA_SKETCH_SIZE * 8)
+
+/* recent accesses a page needs to be admitted beyond the target */
+#define GCMA_ADMIT_FREQ		2
+
+/* loads the hit ratio is measured over */
+#define GCMA_ADAPT_WINDOW	4096
+/* hit ratio in percent shrinking or growing the target */
+#define GCMA_HIT_RATIO_LOW	5
+#define GCMA_HIT_RATIO_HIGH	20
+/* the target moves by 1/16 of the total and stays above 1/8 of it */
+#define GCMA_TARGET_STEP_SHIFT	4
+#define GCMA_TARGET_MIN_SHIFT	3
+
+static u8 sketch[GCMA_SKETCH_SIZE];
+static atomic_t sketch_samples = ATOMIC_INIT(0);
+
+static atomic_long_t total_pages = ATOMIC_LONG_INIT(0);
+static atomic_long_t target_pages = ATOMIC_LONG_INIT(0);
+
+static atomic_t window_loads = ATOMIC_INIT(0);
+static atomic_t window_hits = ATOMIC_INIT(0);
+static unsigned int hit_ratio = 100;
+
+static void gcma_sketch_age(struct work_struct *work)
+{
+	unsigned long i;
+
+	for (i = 0; i < GCMA_SKETCH_SIZE; i++)
+		WRITE_ONCE(sketch[i], READ_ONCE(sketch[i]) >> 1);
+}
+
+static DECLARE_WORK(sketch_age_work, gcma_sketch_age);
+
+u64 gcma_admit_key(int hash_id, struct cleancache_filekey *key,
+		   pgoff_t offset)
+{
+	return ((u64)jhash(key, sizeof(*key), hash_id) << 32) ^ offset;
+}
+
+/*
+ * Record an access to @key and return its recent frequency. The counters
+ * are updated racy since the sketch is an estimation anyway.
+ */
+unsigned int gcma_admit_record(u64 key)
+{
+	unsigned int freq = GCMA_SKETCH_MAX;
+	int i;
+
+	for (i = 0; i < GCMA_SKETCH_DEPTH; i++) {
+		unsigned long idx = hash_64(key + i * GOLDEN_RATIO_64,
+					    GCMA_SKETCH_BITS);
+		unsigned int count = READ_ONCE(sketch[idx]);
+
+		if (count < GCMA_SKETCH_MAX)
+			WRITE_ONCE(sketch[idx], ++count);
+		freq = min(freq, count);
+	}
+
+	if (atomic_inc_return(&sketch_samples) == GCMA_SKETCH_SAMPLE) {
+		atomic_set(&sketch_samples, 0);
+		queue_work(system_unbound_wq, &sketch_age_work);
+	}
+
+	return freq;
+}
+
+/* Returns true if the new page of frequency @freq should be stored */
+bool gcma_admit_page(unsigned int freq, unsigned long cached)
+{
+	if (!admission_filter_enabled())
+		return true;
+
+	if (cached < atomic_long_read(&target_pages))
+		return true;
+
+	return freq >= GCMA_ADMIT_FREQ;
+}
+
+static void gcma_adapt_target(unsigned int ratio)
+{
+	long total = atomic_long_read(&total_pages);
+	long target = atomic_long_read(&target_pages);
+	long step = total >> GCMA_TARGET_STEP_SHIFT;
+
+	if (ratio < GCMA_HIT_RATIO_LOW)
+		target = max(target - step, total >> GCMA_TARGET_MIN_SHIFT);
+	else if (ratio > GCMA_HIT_RATIO_HIGH)
+		target = min(target + step, total);
+	else
+		return;
+
+	atomic_long_set(&target_pages, target);
+}
+
+void gcma_admit_account_load(bool hit)
+{
+	unsigned int hits;
+
+	if (hit)
+		atomic_inc(&window_hits);
+
+	if (atomic_inc_return(&window_loads) != GCMA_ADAPT_WINDOW)
+		return;
+
+	hits = atomic_xchg(&window_hits, 0);
+	atomic_set(&window_loads, 0);
+
+	WRITE_ONCE(hit_ratio, min(hits * 100 / GCMA_ADAPT_WINDOW, 100U));
+	gcma_adapt_target(READ_ONCE(hit_ratio));
+}
+
+void gcma_admit_add_pages(unsigned long nr_pages)
+{
+	atomic_long_add(nr_pages, &total_pages);
+	atomic_long_add(nr_pages, &target_pages);
+}
+
+unsigned long gcma_admit_target_pages(void)
+{
+	return atomic_long_read(&target_pages);
+}
+
+unsigned int gcma_admit_hit_ratio(void)
+{
+	return READ_ONCE(hit_ratio);
+}
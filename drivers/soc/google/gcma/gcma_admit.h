@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __GCMA_ADMIT_H__
+#define __GCMA_ADMIT_H__
+
+#include <linux/cleancache.h>
+
+u64 gcma_admit_key(int hash_id, struct cleancache_filekey *key,
+		   pgoff_t offset);
+unsigned int gcma_admit_record(u64 key);
+bool gcma_admit_page(unsigned int freq, unsigned long cached);
+void gcma_admit_account_load(bool hit);
+void gcma_admit_add_pages(unsigned long nr_pages);
+unsigned long gcma_admit_target_pages(void);
+unsigned int gcma_admit_hit_ratio(void);
+#endif
@@ -11,15 +11,19 @@
 #endif
 
 #include <linux/cleancache.h>
+#include <linux/cpuhotplug.h>
 #include <linux/slab.h>
 #include <linux/highmem.h>
 #include <linux/idr.h>
 #include <linux/hashtable.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
 #include <linux/xarray.h>
 
 #include "gcma_vh.h"
 #include "gcma_sysfs.h"
 #include "gcma_debug.h"
+#include "gcma_admit.h"
 
 #define CREATE_TRACE_POINTS
 #include "gcma_trace.h"
@@ -28,6 +32,9 @@
  * page->page_type : area id
  * page->mapping : struct gcma_inode
  * page->index : page offset from inode
+ * page->private : cpu + 1 of the per-cpu free list holding the free page,
+ *		   or GCMA_DISCARDED_AHEAD for the page discarded ahead of
+ *		   the allocation
  */
 
 static inline int get_area_id(struct page *page)
@@ -75,21 +82,92 @@ static DEFINE_IDR(gcma_fs_idr);
 #define MAX_EVICT_BATCH 64UL
 #define MAX_GCMA_AREAS 64
 
-static LIST_HEAD(gcma_lru);
-static DEFINE_SPINLOCK(lru_lock);
-
 static atomic_t nr_gcma_area = ATOMIC_INIT(0);
 
-/* represent reserved memory range */
+/*
+ * represent reserved memory range
+ *
+ * The cached pages are kept in the LRU of the area they belong to rather
+ * than a global one so that the stores and loads of the pages in different
+ * areas don't contend on the same lock.
+ */
 struct gcma_area {
 	struct list_head free_pages;
 	spinlock_t free_pages_lock;
+	struct list_head lru;
+	spinlock_t lru_lock;
 	unsigned long start_pfn;
 	unsigned long end_pfn;
-};
+} ____cacheline_aligned_in_smp;
 
 static struct gcma_area areas[MAX_GCMA_AREAS];
 
+/*
+ * Per-cpu free lists in front of the area free lists. gcma_alloc_page and
+ * gcma_free_page move the pages between the area and the per-cpu list in
+ * batches. The free pages in the per-cpu list keep PageGCMAFree and record
+ * the cpu in page->private so that the discard can isolate them.
+ *
+ * Lock order: gcma_pcp.lock -> gcma_area.free_pages_lock
+ */
+#define GCMA_PCP_BATCH	32
+#define GCMA_PCP_HIGH	(GCMA_PCP_BATCH * 2)
+
+struct gcma_pcp {
+	spinlock_t lock;
+	struct list_head pages;
+	int count;
+};
+
+static DEFINE_PER_CPU(struct gcma_pcp, gcma_pcp);
+
+/*
+ * The range discard runs with IRQs disabled for GCMA_DISCARD_BATCH pfns at
+ * most. The large range is split into up to GCMA_DISCARD_MAX_WORKERS chunks
+ * of GCMA_DISCARD_CHUNK pfns at least, which are discarded in parallel.
+ */
+#define GCMA_DISCARD_BATCH		256UL
+#define GCMA_DISCARD_CHUNK		4096UL
+#define GCMA_DISCARD_MAX_WORKERS	8
+
+#define GCMA_DISCARDED_AHEAD		(~0UL)
+#define GCMA_DISCARD_AHEAD_TIMEOUT	HZ
+
+static struct workqueue_struct *gcma_discard_wq;
+
+struct gcma_discard_work {
+	struct work_struct work;
+	struct gcma_area *area;
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+	unsigned long discarded;
+};
+
+/* range discarded by gcma_discard_range_ahead */
+struct gcma_discard_ahead {
+	struct list_head list;
+	struct work_struct work;
+	struct delayed_work expire;
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+	/* taken over by gcma_alloc_range */
+	bool claimed;
+};
+
+static LIST_HEAD(gcma_ahead_list);
+static DEFINE_SPINLOCK(gcma_ahead_lock);
+
+static void gcma_spin_lock(spinlock_t *lock, enum gcma_lock_type type)
+{
+	if (spin_trylock(lock)) {
+		count_gcma_lock(type, false);
+		return;
+	}
+
+	count_gcma_lock(type, true);
+	spin_lock(lock);
+}
+
 static int lookup_area_id(struct page *page, int start_id)
 {
 	int id, nr_area;
@@ -134,34 +212,43 @@ struct gcma_inode {
 
 static struct kmem_cache *slab_gcma_inode;
 
+static struct gcma_area *page_area(struct page *page)
+{
+	return &areas[get_area_id(page)];
+}
+
 static void add_page_to_lru(struct page *page)
 {
+	struct gcma_area *area = page_area(page);
+
 	VM_BUG_ON(!irqs_disabled());
 	VM_BUG_ON(!list_empty(&page->lru));
 
-	spin_lock(&lru_lock);
-	list_add(&page->lru, &gcma_lru);
-	spin_unlock(&lru_lock);
+	gcma_spin_lock(&area->lru_lock, GCMA_LRU_LOCK);
+	list_add(&page->lru, &area->lru);
+	spin_unlock(&area->lru_lock);
 }
 
+/*
+ * The hit page is just marked and moved to the LRU head in batch when the
+ * eviction finds it at the tail, which saves the LRU lock in the hit path.
+ */
 static void rotate_lru_page(struct page *page)
 {
-	VM_BUG_ON(!irqs_disabled());
-
-	spin_lock(&lru_lock);
-	if (!list_empty(&page->lru))
-		list_move(&page->lru, &gcma_lru);
-	spin_unlock(&lru_lock);
+	if (!PageReferenced(page))
+		SetPageReferenced(page);
 }
 
 static void delete_page_from_lru(struct page *page)
 {
+	struct gcma_area *area = page_area(page);
+
 	VM_BUG_ON(!irqs_disabled());
 
-	spin_lock(&lru_lock);
+	gcma_spin_lock(&area->lru_lock, GCMA_LRU_LOCK);
 	if (!list_empty(&page->lru))
 		list_del_init(&page->lru);
-	spin_unlock(&lru_lock);
+	spin_unlock(&area->lru_lock);
 }
 
 static void SetPageGCMAFree(struct page *page)
@@ -183,6 +270,7 @@ static void reset_gcma_page(struct page *page)
 {
 	set_inode_mapping(page, NULL);
 	set_inode_index(page, 0);
+	ClearPageReferenced(page);
 }
 
 static struct gcma_fs *find_gcma_fs(int hash_id)
@@ -308,11 +396,14 @@ int register_gcma_area(const char *name, phys_addr_t base, phys_addr_t size)
 	area = &areas[area_id];
 	INIT_LIST_HEAD(&area->free_pages);
 	spin_lock_init(&area->free_pages_lock);
+	INIT_LIST_HEAD(&area->lru);
+	spin_lock_init(&area->lru_lock);
 
 	for (i = 0; i < page_count; i++) {
 		page = pfn_to_page(pfn + i);
 		set_area_id(page, area_id);
 		reset_gcma_page(page);
+		set_page_private(page, 0);
 		SetPageGCMAFree(page);
 		list_add(&page->lru, &area->free_pages);
 	}
@@ -320,6 +411,7 @@ int register_gcma_area(const char *name, phys_addr_t base, phys_addr_t size)
 	area->start_pfn = pfn;
 	area->end_pfn = pfn + page_count - 1;
 	inc_gcma_total_pages(page_count);
+	gcma_admit_add_pages(page_count);
 
 	pr_info("Reserved memory: created GCMA memory pool at %pa, size %lu MiB for %s\n",
 		 &base, (unsigned long)size / SZ_1M, name ? : "none");
@@ -335,7 +427,7 @@ static void page_area_lock(struct page *page)
 	VM_BUG_ON(!irqs_disabled());
 
 	area = &areas[get_area_id(page)];
-	spin_lock(&area->free_pages_lock);
+	gcma_spin_lock(&area->free_pages_lock, GCMA_AREA_LOCK);
 }
 
 static void page_area_unlock(struct page *page)
@@ -346,33 +438,119 @@ static void page_area_unlock(struct page *page)
 	spin_unlock(&area->free_pages_lock);
 }
 
-static struct page *gcma_alloc_page(void)
+/* Move up to GCMA_PCP_BATCH free pages from the areas to @pcp */
+static void gcma_pcp_refill(struct gcma_pcp *pcp, int cpu)
 {
 	int i, nr_area;
 	struct gcma_area *area;
-	struct page *page = NULL;
-
-	VM_BUG_ON(!irqs_disabled());
+	struct page *page;
 
 	nr_area = atomic_read(&nr_gcma_area);
 
-	for (i = 0; i < nr_area; i++) {
+	for (i = 0; i < nr_area && pcp->count < GCMA_PCP_BATCH; i++) {
 		area = &areas[i];
-		spin_lock(&area->free_pages_lock);
-		if (list_empty(&area->free_pages)) {
-			spin_unlock(&area->free_pages_lock);
-			continue;
+		gcma_spin_lock(&area->free_pages_lock, GCMA_AREA_LOCK);
+		while (!list_empty(&area->free_pages) && pcp->count < GCMA_PCP_BATCH) {
+			page = list_last_entry(&area->free_pages, struct page, lru);
+			list_move(&page->lru, &pcp->pages);
+			set_page_private(page, cpu + 1);
+			pcp->count++;
 		}
+		spin_unlock(&area->free_pages_lock);
+	}
+}
 
-		page = list_last_entry(&area->free_pages, struct page, lru);
+/* Move @count coldest pages of @pcp back to their areas */
+static void gcma_pcp_drain(struct gcma_pcp *pcp, int count)
+{
+	struct gcma_area *area, *locked = NULL;
+	struct page *page;
+
+	while (count-- && pcp->count) {
+		page = list_last_entry(&pcp->pages, struct page, lru);
+		area = page_area(page);
+		if (area != locked) {
+			if (locked)
+				spin_unlock(&locked->free_pages_lock);
+			gcma_spin_lock(&area->free_pages_lock, GCMA_AREA_LOCK);
+			locked = area;
+		}
+		list_move(&page->lru, &area->free_pages);
+		set_page_private(page, 0);
+		pcp->count--;
+	}
+
+	if (locked)
+		spin_unlock(&locked->free_pages_lock);
+}
+
+/* Return the free pages of the offlined @cpu to their areas */
+static int gcma_pcp_cpu_dead(unsigned int cpu)
+{
+	struct gcma_pcp *pcp = per_cpu_ptr(&gcma_pcp, cpu);
+	unsigned long flags;
+
+	local_irq_save(flags);
+	gcma_spin_lock(&pcp->lock, GCMA_PCP_LOCK);
+	gcma_pcp_drain(pcp, pcp->count);
+	spin_unlock(&pcp->lock);
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+/*
+ * Isolate the free @page from the per-cpu list holding it to prevent further
+ * allocation. Returns false if @page isn't in any per-cpu list.
+ */
+static bool gcma_pcp_isolate(struct page *page)
+{
+	unsigned long owner = READ_ONCE(page->private);
+	struct gcma_pcp *pcp;
+	bool isolated = false;
+
+	if (!owner)
+		return false;
+
+	pcp = per_cpu_ptr(&gcma_pcp, owner - 1);
+	gcma_spin_lock(&pcp->lock, GCMA_PCP_LOCK);
+	if (page_private(page) == owner && PageGCMAFree(page)) {
+		ClearPageGCMAFree(page);
 		list_del_init(&page->lru);
+		set_page_private(page, 0);
+		pcp->count--;
+		isolated = true;
+	}
+	spin_unlock(&pcp->lock);
+
+	return isolated;
+}
+
+static struct page *gcma_alloc_page(void)
+{
+	struct gcma_pcp *pcp;
+	struct page *page = NULL;
+
+	VM_BUG_ON(!irqs_disabled());
+
+	pcp = this_cpu_ptr(&gcma_pcp);
+	gcma_spin_lock(&pcp->lock, GCMA_PCP_LOCK);
+	if (!pcp->count)
+		gcma_pcp_refill(pcp, smp_processor_id());
+
+	if (pcp->count) {
+		page = list_first_entry(&pcp->pages, struct page, lru);
+		list_del_init(&page->lru);
+		set_page_private(page, 0);
+		pcp->count--;
 
 		ClearPageGCMAFree(page);
 		set_page_count(page, 1);
-		spin_unlock(&area->free_pages_lock);
-		inc_gcma_stat(CACHED_PAGE);
-		break;
 	}
+	spin_unlock(&pcp->lock);
+
+	if (page)
+		inc_gcma_stat(CACHED_PAGE);
 
 	return page;
 }
@@ -390,7 +568,21 @@ static void __gcma_free_page(struct page *page)
 
 static void gcma_free_page(struct page *page)
 {
-	__gcma_free_page(page);
+	struct gcma_pcp *pcp;
+
+	VM_BUG_ON(!irqs_disabled());
+
+	pcp = this_cpu_ptr(&gcma_pcp);
+	gcma_spin_lock(&pcp->lock, GCMA_PCP_LOCK);
+	reset_gcma_page(page);
+	VM_BUG_ON(!list_empty(&page->lru));
+	list_add(&page->lru, &pcp->pages);
+	set_page_private(page, smp_processor_id() + 1);
+	SetPageGCMAFree(page);
+	if (++pcp->count > GCMA_PCP_HIGH)
+		gcma_pcp_drain(pcp, GCMA_PCP_BATCH);
+	spin_unlock(&pcp->lock);
+
 	dec_gcma_stat(CACHED_PAGE);
 }
 
@@ -412,9 +604,7 @@ static void gcma_put_page(struct page *page)
 
 		local_irq_save(flags);
 		delete_page_from_lru(page);
-		page_area_lock(page);
 		gcma_free_page(page);
-		page_area_unlock(page);
 		local_irq_restore(flags);
 		if (inode)
 			put_gcma_inode(inode);
@@ -473,7 +663,7 @@ static void isolate_gcma_page(struct gcma_inode *inode, struct page *page)
  */
 static unsigned long __gcma_discard_range(struct gcma_area *area,
 					  unsigned long start_pfn,
-					  unsigned long end_pfn)
+					  unsigned long end_pfn, bool ahead)
 {
 	unsigned long pfn;
 	struct page *page;
@@ -486,7 +676,7 @@ static unsigned long __gcma_discard_range(struct gcma_area *area,
 		struct gcma_inode *inode;
 		unsigned long index;
 again:
-		if (!(++scanned % XA_CHECK_SCHED)) {
+		if (!(++scanned % GCMA_DISCARD_BATCH)) {
 			/* let in any pending interrupt */
 			local_irq_enable();
 			cond_resched();
@@ -494,8 +684,23 @@ again:
 		}
 
 		page = pfn_to_page(pfn);
+		if (page_private(page) == GCMA_DISCARDED_AHEAD) {
+			/* The allocation takes over the page isolated ahead */
+			if (!ahead)
+				set_page_private(page, 0);
+			continue;
+		}
+
+		if (gcma_pcp_isolate(page))
+			goto isolated;
+
 		page_area_lock(page);
 		if (PageGCMAFree(page)) {
+			/* The page moved to a per-cpu list under us */
+			if (page_private(page)) {
+				page_area_unlock(page);
+				goto again;
+			}
 			/*
 			 * Isolate page from the free list to prevent further
 			 * allocation.
@@ -503,7 +708,7 @@ again:
 			ClearPageGCMAFree(page);
 			list_del_init(&page->lru);
 			page_area_unlock(page);
-			continue;
+			goto isolated;
 		}
 
 		rcu_read_lock();
@@ -573,24 +778,76 @@ again:
 		isolate_gcma_page(inode, page);
 		inc_gcma_stat(DISCARDED_PAGE);
 		discard++;
-
+isolated:
+		if (ahead)
+			set_page_private(page, GCMA_DISCARDED_AHEAD);
 	}
 	local_irq_enable();
 
 	return discard;
 }
 
-void gcma_alloc_range(unsigned long start_pfn, unsigned long end_pfn)
+static void gcma_discard_work_fn(struct work_struct *work)
+{
+	struct gcma_discard_work *dw = container_of(work,
+					struct gcma_discard_work, work);
+
+	dw->discarded = __gcma_discard_range(dw->area, dw->start_pfn,
+					     dw->end_pfn, false);
+}
+
+/*
+ * Discard the range in @area in parallel. The caller discards the first
+ * chunk itself while the workers discard the others.
+ */
+static unsigned long gcma_discard_area_range(struct gcma_area *area,
+					     unsigned long start_pfn,
+					     unsigned long end_pfn)
+{
+	struct gcma_discard_work works[GCMA_DISCARD_MAX_WORKERS - 1];
+	unsigned long nr_pfn = end_pfn - start_pfn + 1;
+	unsigned long chunk, discarded;
+	int i, nr_work;
+
+	nr_work = min_t(unsigned long, DIV_ROUND_UP(nr_pfn, GCMA_DISCARD_CHUNK),
+			GCMA_DISCARD_MAX_WORKERS);
+	if (nr_work <= 1)
+		return __gcma_discard_range(area, start_pfn, end_pfn, false);
+
+	chunk = DIV_ROUND_UP(nr_pfn, nr_work);
+	for (i = 1; i < nr_work; i++) {
+		struct gcma_discard_work *dw = &works[i - 1];
+
+		INIT_WORK_ONSTACK(&dw->work, gcma_discard_work_fn);
+		dw->area = area;
+		dw->start_pfn = start_pfn + i * chunk;
+		dw->end_pfn = min(end_pfn, dw->start_pfn + chunk - 1);
+		dw->discarded = 0;
+		queue_work(gcma_discard_wq, &dw->work);
+	}
+
+	discarded = __gcma_discard_range(area, start_pfn,
+					 start_pfn + chunk - 1, false);
+
+	for (i = 1; i < nr_work; i++) {
+		struct gcma_discard_work *dw = &works[i - 1];
+
+		flush_work(&dw->work);
+		discarded += dw->discarded;
+		destroy_work_on_stack(&dw->work);
+	}
+
+	return discarded;
+}
+
+static unsigned long gcma_discard_range(unsigned long start_pfn,
+					unsigned long end_pfn, bool ahead)
 {
-	s64 start_time;
 	int i;
 	struct gcma_area *area;
 	int nr_area = atomic_read(&nr_gcma_area);
-	unsigned long latency, count = end_pfn - start_pfn + 1;
 	unsigned long discarded = 0;
 
-	trace_gcma_alloc_start(start_pfn, count);
-	start_time = ktime_to_ns(ktime_get());
 	for (i = 0; i < nr_area; i++) {
 		unsigned long s_pfn, e_pfn;
 
@@ -604,11 +861,160 @@ void gcma_alloc_range(unsigned long start_pfn, unsigned long end_pfn)
 		s_pfn = max(start_pfn, area->start_pfn);
 		e_pfn = min(end_pfn, area->end_pfn);
 
-		discarded += __gcma_discard_range(area, s_pfn, e_pfn);
+		/* The ahead discard runs in the worker already */
+		if (ahead)
+			discarded += __gcma_discard_range(area, s_pfn, e_pfn,
+							  true);
+		else
+			discarded += gcma_discard_area_range(area, s_pfn, e_pfn);
+	}
+
+	return discarded;
+}
+
+/* Free the pages in the range left isolated by the ahead discard */
+static void gcma_release_ahead_range(unsigned long start_pfn,
+				     unsigned long end_pfn)
+{
+	int i;
+	struct gcma_area *area;
+	int nr_area = atomic_read(&nr_gcma_area);
+
+	for (i = 0; i < nr_area; i++) {
+		unsigned long pfn, s_pfn, e_pfn;
+		unsigned long scanned = 0;
+
+		area = &areas[i];
+		if (area->end_pfn < start_pfn || area->start_pfn > end_pfn)
+			continue;
+
+		s_pfn = max(start_pfn, area->start_pfn);
+		e_pfn = min(end_pfn, area->end_pfn);
+
+		local_irq_disable();
+		for (pfn = s_pfn; pfn <= e_pfn; pfn++) {
+			struct page *page = pfn_to_page(pfn);
+
+			if (!(++scanned % GCMA_DISCARD_BATCH)) {
+				local_irq_enable();
+				cond_resched();
+				local_irq_disable();
+			}
+
+			if (page_private(page) != GCMA_DISCARDED_AHEAD)
+				continue;
+
+			page_area_lock(page);
+			set_page_private(page, 0);
+			__gcma_free_page(page);
+			page_area_unlock(page);
+		}
+		local_irq_enable();
+	}
+}
+
+static void gcma_discard_ahead_fn(struct work_struct *work)
+{
+	struct gcma_discard_ahead *ahead = container_of(work,
+					struct gcma_discard_ahead, work);
+
+	gcma_discard_range(ahead->start_pfn, ahead->end_pfn, true);
+	queue_delayed_work(gcma_discard_wq, &ahead->expire,
+			   GCMA_DISCARD_AHEAD_TIMEOUT);
+}
+
+/* Give the pages back if the predicted allocation didn't come in time */
+static void gcma_discard_ahead_expire(struct work_struct *work)
+{
+	struct gcma_discard_ahead *ahead = container_of(to_delayed_work(work),
+					struct gcma_discard_ahead, expire);
+
+	spin_lock(&gcma_ahead_lock);
+	if (ahead->claimed) {
+		spin_unlock(&gcma_ahead_lock);
+		return;
+	}
+	list_del(&ahead->list);
+	spin_unlock(&gcma_ahead_lock);
+
+	gcma_release_ahead_range(ahead->start_pfn, ahead->end_pfn);
+	kfree(ahead);
+}
+
+/*
+ * Discard the cached pages in the range in background for the allocation
+ * predicted to come soon so that gcma_alloc_range of the range doesn't need
+ * to wait for the discard. The pages are given back unless gcma_alloc_range
+ * overlapping the range is called in GCMA_DISCARD_AHEAD_TIMEOUT.
+ *
+ * The range must not be allocated by gcma_alloc_range at the moment.
+ */
+int gcma_discard_range_ahead(unsigned long start_pfn, unsigned long end_pfn)
+{
+	struct gcma_discard_ahead *ahead;
+
+	if (start_pfn > end_pfn)
+		return -EINVAL;
+
+	ahead = kzalloc(sizeof(*ahead), GFP_KERNEL);
+	if (!ahead)
+		return -ENOMEM;
+
+	ahead->start_pfn = start_pfn;
+	ahead->end_pfn = end_pfn;
+	INIT_WORK(&ahead->work, gcma_discard_ahead_fn);
+	INIT_DELAYED_WORK(&ahead->expire, gcma_discard_ahead_expire);
+
+	spin_lock(&gcma_ahead_lock);
+	list_add_tail(&ahead->list, &gcma_ahead_list);
+	spin_unlock(&gcma_ahead_lock);
+
+	queue_work(gcma_discard_wq, &ahead->work);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gcma_discard_range_ahead);
+
+void gcma_alloc_range(unsigned long start_pfn, unsigned long end_pfn)
+{
+	s64 start_time;
+	struct gcma_discard_ahead *ahead, *tmp;
+	unsigned long latency, count = end_pfn - start_pfn + 1;
+	unsigned long discarded;
+	LIST_HEAD(claimed);
+
+	trace_gcma_alloc_start(start_pfn, count);
+	start_time = ktime_to_ns(ktime_get());
+
+	spin_lock(&gcma_ahead_lock);
+	list_for_each_entry_safe(ahead, tmp, &gcma_ahead_list, list) {
+		if (ahead->start_pfn > end_pfn || ahead->end_pfn < start_pfn)
+			continue;
+		ahead->claimed = true;
+		list_move(&ahead->list, &claimed);
+	}
+	spin_unlock(&gcma_ahead_lock);
+
+	list_for_each_entry(ahead, &claimed, list) {
+		flush_work(&ahead->work);
+		cancel_delayed_work_sync(&ahead->expire);
+	}
+
+	discarded = gcma_discard_range(start_pfn, end_pfn, false);
+
+	list_for_each_entry_safe(ahead, tmp, &claimed, list) {
+		if (ahead->start_pfn < start_pfn)
+			gcma_release_ahead_range(ahead->start_pfn,
+						 start_pfn - 1);
+		if (ahead->end_pfn > end_pfn)
+			gcma_release_ahead_range(end_pfn + 1, ahead->end_pfn);
+		kfree(ahead);
 	}
+
 	trace_gcma_alloc_finish(count, discarded);
 	latency = ktime_to_ns(ktime_get()) - start_time;
 	account_gcma_per_page_alloc_latency(count, latency);
+	account_gcma_discard_latency(latency);
 }
 EXPORT_SYMBOL_GPL(gcma_alloc_range);
 
@@ -640,6 +1046,7 @@ void gcma_free_range(unsigned long start_pfn, unsigned long end_pfn)
 			start_id = area_id;
 		/* The struct page fields would be contaminated so reset them */
 		set_area_id(page, area_id);
+		set_page_private(page, 0);
 		INIT_LIST_HEAD(&page->lru);
 		page_area_lock(page);
 		__gcma_free_page(page);
@@ -650,33 +1057,73 @@ void gcma_free_range(unsigned long start_pfn, unsigned long end_pfn)
 }
 EXPORT_SYMBOL_GPL(gcma_free_range);
 
+/*
+ * Isolate up to @nr pages from the tail of @area's LRU to @pages. The pages
+ * referenced since they were added get another round at the LRU head.
+ * Returns the number of pages isolated and sets @scanned to the number of
+ * pages consumed from the eviction request.
+ */
+static unsigned long isolate_lru_pages(struct gcma_area *area, struct page **pages,
+				       unsigned long nr, unsigned long *scanned)
+{
+	unsigned long isolated = 0, rotated = 0;
+	unsigned long flags;
+	struct page *page, *tmp;
+
+	*scanned = 0;
+
+	local_irq_save(flags);
+	gcma_spin_lock(&area->lru_lock, GCMA_LRU_LOCK);
+	list_for_each_entry_safe_reverse(page, tmp, &area->lru, lru) {
+		if (*scanned == nr || rotated == nr)
+			break;
+
+		if (TestClearPageReferenced(page)) {
+			list_move(&page->lru, &area->lru);
+			rotated++;
+			continue;
+		}
+
+		(*scanned)++;
+		if (gcma_get_page_unless_zero(page)) {
+			list_del_init(&page->lru);
+			pages[isolated++] = page;
+		}
+	}
+	spin_unlock(&area->lru_lock);
+	local_irq_restore(flags);
+
+	return isolated;
+}
+
 void evict_gcma_lru_pages(unsigned long nr_request)
 {
+	static atomic_t evict_cursor = ATOMIC_INIT(0);
+	int nr_area = atomic_read(&nr_gcma_area);
 	unsigned long nr_evicted = 0;
+	int idle = 0;
 
-	while (nr_request) {
+	if (!nr_area)
+		return;
+
+	/* stop once every area had nothing to evict twice in a row */
+	while (nr_request && idle < nr_area * 2) {
 		struct page *pages[MAX_EVICT_BATCH];
+		struct gcma_area *area;
 		int i;
-		unsigned long isolated = 0;
+		unsigned long isolated, scanned;
 		unsigned long flags;
-		struct page *page, *tmp;
+		struct page *page;
 
-		spin_lock_irqsave(&lru_lock, flags);
-		if (list_empty(&gcma_lru)) {
-			spin_unlock_irqrestore(&lru_lock, flags);
-			return;
-		}
-
-		list_for_each_entry_safe_reverse(page, tmp, &gcma_lru, lru) {
-			if (isolated == MAX_EVICT_BATCH || !nr_request)
-				break;
-			nr_request--;
-			if (gcma_get_page_unless_zero(page)) {
-				list_del_init(&page->lru);
-				pages[isolated++] = page;
-			}
+		area = &areas[(unsigned int)atomic_inc_return(&evict_cursor) % nr_area];
+		isolated = isolate_lru_pages(area, pages, min(nr_request, MAX_EVICT_BATCH),
+					     &scanned);
+		if (!scanned) {
+			idle++;
+			continue;
 		}
-		spin_unlock_irqrestore(&lru_lock, flags);
+		idle = 0;
+		nr_request -= scanned;
 
 		/* From now on, pages in the list will never be freed */
 		for (i = 0; i < isolated; i++) {
@@ -699,9 +1146,17 @@ void evict_gcma_lru_pages(unsigned long nr_request)
 	add_gcma_stat(EVICTED_PAGE, nr_evicted);
 }
 
+/* Evict the pages beyond the target as well as a batch for the new stores */
 static void evict_gcma_pages(struct work_struct *work)
 {
-	evict_gcma_lru_pages(MAX_EVICT_BATCH);
+	unsigned long cached = get_gcma_stat(CACHED_PAGE);
+	unsigned long target = gcma_admit_target_pages();
+	unsigned long nr_evict = MAX_EVICT_BATCH;
+
+	if (cached > target)
+		nr_evict = max(nr_evict, cached - target);
+
+	evict_gcma_lru_pages(nr_evict);
 }
 
 static DECLARE_WORK(lru_evict_work, evict_gcma_pages);
@@ -714,6 +1169,9 @@ static DECLARE_WORK(lru_evict_work, evict_gcma_pages);
  * @page is workingset and GCMA has @page: overwrite the stale data
  * @page is !workingset and GCMA doesn't have @page: just bail out
  * @page is !workingset and GCMA has @page: remove the stale @page
+ *
+ * The new workingset page is further subject to the admission filter once
+ * GCMA reaches its target size.
  */
 void gcma_cc_store_page(int hash_id, struct cleancache_filekey key,
 			pgoff_t offset, struct page *page)
@@ -724,6 +1182,8 @@ void gcma_cc_store_page(int hash_id, struct cleancache_filekey key,
 	void *src, *dst;
 	bool is_new = false;
 	bool workingset = true;
+	unsigned long cached;
+	unsigned int freq;
 
 	if (workingset_filter_enabled())
 		workingset = PageWorkingset(page);
@@ -735,6 +1195,8 @@ void gcma_cc_store_page(int hash_id, struct cleancache_filekey key,
 	 */
 	VM_BUG_ON(!irqs_disabled());
 
+	freq = gcma_admit_record(gcma_admit_key(hash_id, &key, offset));
+
 find_inode:
 	gcma_fs = find_gcma_fs(hash_id);
 	if (!gcma_fs)
@@ -771,6 +1233,16 @@ load_page:
 	if (!workingset)
 		goto out_unlock;
 
+	cached = get_gcma_stat(CACHED_PAGE);
+	if (!gcma_admit_page(freq, cached)) {
+		inc_gcma_stat(REJECTED_PAGE);
+		goto out_unlock;
+	}
+
+	/* Make room for the pages admitted beyond the target */
+	if (cached >= gcma_admit_target_pages())
+		queue_work(system_unbound_wq, &lru_evict_work);
+
 	g_page = gcma_alloc_page();
 	if (!g_page) {
 		queue_work(system_unbound_wq, &lru_evict_work);
@@ -802,7 +1274,7 @@ out_unlock:
 	put_gcma_inode(inode);
 }
 
-static int gcma_cc_load_page(int hash_id, struct cleancache_filekey key,
+static int __gcma_cc_load_page(int hash_id, struct cleancache_filekey key,
 			pgoff_t offset, struct page *page)
 {
 	struct gcma_fs *gcma_fs;
@@ -842,6 +1314,23 @@ static int gcma_cc_load_page(int hash_id, struct cleancache_filekey key,
 	return 0;
 }
 
+/*
+ * The missed load is recorded as an access as well so that the page
+ * evicted or rejected but wanted again is admitted at the next store.
+ */
+static int gcma_cc_load_page(int hash_id, struct cleancache_filekey key,
+			pgoff_t offset, struct page *page)
+{
+	int ret = __gcma_cc_load_page(hash_id, key, offset, page);
+
+	gcma_admit_record(gcma_admit_key(hash_id, &key, offset));
+	gcma_admit_account_load(!ret);
+	if (ret)
+		inc_gcma_stat(MISSED_PAGE);
+
+	return ret;
+}
+
 static void gcma_cc_invalidate_page(int hash_id, struct cleancache_filekey key,
 				pgoff_t offset)
 {
@@ -1014,7 +1503,7 @@ struct cleancache_ops gcma_cleancache_ops = {
 
 int __init gcma_init(void)
 {
-	int err;
+	int err, cpu;
 
 	err = gcma_vh_init();
 	if (err)
@@ -1024,6 +1513,26 @@ int __init gcma_init(void)
 	if (!slab_gcma_inode)
 		return -ENOMEM;
 
+	gcma_discard_wq = alloc_workqueue("gcma_discard",
+					  WQ_UNBOUND | WQ_HIGHPRI, 0);
+	if (!gcma_discard_wq) {
+		kmem_cache_destroy(slab_gcma_inode);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct gcma_pcp *pcp = per_cpu_ptr(&gcma_pcp, cpu);
+
+		spin_lock_init(&pcp->lock);
+		INIT_LIST_HEAD(&pcp->pages);
+	}
+
+	/* the pages of an offlined cpu just stay in its list without it */
+	err = cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN, "soc/gcma:dead",
+					NULL, gcma_pcp_cpu_dead);
+	if (err < 0)
+		pr_warn("failed to register the cpu hotplug callback %d\n", err);
+
 	gcma_sysfs_init();
 	gcma_debugfs_init();
 	cleancache_register_ops(&gcma_cleancache_ops);
@@ -1,15 +1,24 @@
 #include <linux/types.h>
 #include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
 
 #include "gcma_core.h"
+#include "gcma_debug.h"
 
 static bool workingset = true;
+static bool admission = true;
 
 bool workingset_filter_enabled(void)
 {
 	return workingset;
 }
 
+bool admission_filter_enabled(void)
+{
+	return admission;
+}
+
 static int gcma_evict_write(void *data, u64 val)
 {
 	unsigned long nr_pages = val;
@@ -19,6 +28,47 @@ static int gcma_evict_write(void *data, u64 val)
 }
 DEFINE_DEBUGFS_ATTRIBUTE(gcma_evict_fops, NULL, gcma_evict_write, "%llu\n");
 
+struct gcma_lock_stat {
+	unsigned long acquired[NR_GCMA_LOCK_TYPES];
+	unsigned long contended[NR_GCMA_LOCK_TYPES];
+};
+
+static DEFINE_PER_CPU(struct gcma_lock_stat, gcma_lock_stat);
+
+static const char * const gcma_lock_names[NR_GCMA_LOCK_TYPES] = {
+	"lru_lock",
+	"area_lock",
+	"pcp_lock",
+};
+
+void count_gcma_lock(enum gcma_lock_type type, bool contended)
+{
+	this_cpu_inc(gcma_lock_stat.acquired[type]);
+	if (contended)
+		this_cpu_inc(gcma_lock_stat.contended[type]);
+}
+
+static int gcma_lock_stat_show(struct seq_file *m, void *v)
+{
+	int cpu, type;
+
+	for (type = 0; type < NR_GCMA_LOCK_TYPES; type++) {
+		unsigned long acquired = 0, contended = 0;
+
+		for_each_possible_cpu(cpu) {
+			struct gcma_lock_stat *stat = per_cpu_ptr(&gcma_lock_stat, cpu);
+
+			acquired += stat->acquired[type];
+			contended += stat->contended[type];
+		}
+		seq_printf(m, "%-10s %12lu %12lu\n", gcma_lock_names[type],
+			   acquired, contended);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(gcma_lock_stat);
+
 int __init gcma_debugfs_init(void)
 {
 	struct dentry *gcma_debugfs_root;
@@ -28,7 +78,10 @@ int __init gcma_debugfs_init(void)
 		return -ENOMEM;
 
 	debugfs_create_bool("workingset", 0644, gcma_debugfs_root, &workingset);
+	debugfs_create_bool("admission", 0644, gcma_debugfs_root, &admission);
 	debugfs_create_file("evict", 0200, gcma_debugfs_root, NULL, &gcma_evict_fops);
+	debugfs_create_file("lock_stat", 0400, gcma_debugfs_root, NULL,
+			    &gcma_lock_stat_fops);
 
 	return 0;
 }
@@ -2,11 +2,22 @@
 #ifndef __GCMA_DEBUG_FS_H__
 #define __GCMA_DEBUG_FS_H__
 
+enum gcma_lock_type {
+	GCMA_LRU_LOCK,
+	GCMA_AREA_LOCK,
+	GCMA_PCP_LOCK,
+	NR_GCMA_LOCK_TYPES,
+};
+
 #ifdef CONFIG_DEBUG_FS
 int gcma_debugfs_init(void);
 bool workingset_filter_enabled(void);
+bool admission_filter_enabled(void);
+void count_gcma_lock(enum gcma_lock_type type, bool contended);
 #else
-int gcma_debugfs_init(void) { return 0; };
-bool workingset_filter_enabled(void) { return true; };
+static inline int gcma_debugfs_init(void) { return 0; };
+static inline bool workingset_filter_enabled(void) { return true; };
+static inline bool admission_filter_enabled(void) { return true; };
+static inline void count_gcma_lock(enum gcma_lock_type type, bool contended) {};
 #endif
 #endif
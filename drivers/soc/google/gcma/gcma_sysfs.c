@@ -1,6 +1,7 @@
 #include <linux/kobject.h>
 #include <linux/sysfs.h>
 #include "gcma_sysfs.h"
+#include "gcma_admit.h"
 
 #if IS_ENABLED(CONFIG_VH_MM)
 extern struct kobject *vendor_mm_kobj;
@@ -19,16 +20,24 @@ enum LATENCY_LEVEL {
 	LATENCY_NUM_LEVELS,
 };
 
-/* gcma_alloc_range per-page latency by ns */
-static struct gcma_alloc_latency {
+struct gcma_latency {
 	unsigned long stat[LATENCY_NUM_LEVELS];
 	unsigned long threshold[LATENCY_NUM_LEVELS];
 	spinlock_t lock;
-} alloc_latency = {
+};
+
+/* gcma_alloc_range per-page latency by ns */
+static struct gcma_latency alloc_latency = {
 	.lock = __SPIN_LOCK_UNLOCKED(alloc_latency.lock),
 	.threshold = {1000, 2000, 4000, ULONG_MAX},
 };
 
+/* gcma_alloc_range discard latency by us */
+static struct gcma_latency discard_latency = {
+	.lock = __SPIN_LOCK_UNLOCKED(discard_latency.lock),
+	.threshold = {1000, 4000, 16000, ULONG_MAX},
+};
+
 void inc_gcma_stat(enum gcma_stat_type type)
 {
 	atomic64_inc(&gcma_stats[type]);
@@ -44,21 +53,34 @@ void add_gcma_stat(enum gcma_stat_type type, unsigned long delta)
 	atomic64_add(delta, &gcma_stats[type]);
 }
 
+static void account_latency(struct gcma_latency *lat, unsigned long latency)
+{
+	spin_lock_irq(&lat->lock);
+	if (latency < lat->threshold[LATENCY_LOW])
+		lat->stat[LATENCY_LOW]++;
+	else if (latency < lat->threshold[LATENCY_MID])
+		lat->stat[LATENCY_MID]++;
+	else if (latency < lat->threshold[LATENCY_HIGH])
+		lat->stat[LATENCY_HIGH]++;
+	else
+		lat->stat[LATENCY_EXTREME_HIGH]++;
+	spin_unlock_irq(&lat->lock);
+}
+
+u64 get_gcma_stat(enum gcma_stat_type type)
+{
+	return (u64)atomic64_read(&gcma_stats[type]);
+}
+
 void account_gcma_per_page_alloc_latency(unsigned long count,
 					 unsigned long latency_ns)
 {
-	unsigned long pp_latency = latency_ns / count;
+	account_latency(&alloc_latency, latency_ns / count);
+}
 
-	spin_lock_irq(&alloc_latency.lock);
-	if (pp_latency < alloc_latency.threshold[LATENCY_LOW])
-		alloc_latency.stat[LATENCY_LOW]++;
-	else if (pp_latency < alloc_latency.threshold[LATENCY_MID])
-		alloc_latency.stat[LATENCY_MID]++;
-	else if (pp_latency < alloc_latency.threshold[LATENCY_HIGH])
-		alloc_latency.stat[LATENCY_HIGH]++;
-	else
-		alloc_latency.stat[LATENCY_EXTREME_HIGH]++;
-	spin_unlock_irq(&alloc_latency.lock);
+void account_gcma_discard_latency(unsigned long latency_ns)
+{
+	account_latency(&discard_latency, latency_ns / NSEC_PER_USEC);
 }
 
 /*
@@ -106,12 +128,44 @@ static ssize_t discarded_show(struct kobject *kobj,
 }
 GCMA_ATTR_RO(discarded);
 
+static ssize_t missed_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n", (u64)atomic64_read(&gcma_stats[MISSED_PAGE]));
+}
+GCMA_ATTR_RO(missed);
+
+static ssize_t rejected_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n", (u64)atomic64_read(&gcma_stats[REJECTED_PAGE]));
+}
+GCMA_ATTR_RO(rejected);
+
+static ssize_t target_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", gcma_admit_target_pages());
+}
+GCMA_ATTR_RO(target);
+
+static ssize_t hit_ratio_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", gcma_admit_hit_ratio());
+}
+GCMA_ATTR_RO(hit_ratio);
+
 static struct attribute *gcma_attrs[] = {
 	&stored_attr.attr,
 	&loaded_attr.attr,
 	&evicted_attr.attr,
 	&cached_attr.attr,
 	&discarded_attr.attr,
+	&missed_attr.attr,
+	&rejected_attr.attr,
+	&target_attr.attr,
+	&hit_ratio_attr.attr,
 	NULL,
 };
 
@@ -119,58 +173,62 @@ static const struct attribute_group gcma_attr_group = {
 	.attrs = gcma_attrs,
 };
 
-static inline unsigned long get_latency_stat(enum LATENCY_LEVEL level)
+static inline unsigned long get_latency_stat(struct gcma_latency *lat,
+					     enum LATENCY_LEVEL level)
 {
 	unsigned long val;
 
-	spin_lock_irq(&alloc_latency.lock);
-	val = alloc_latency.stat[level];
-	spin_unlock_irq(&alloc_latency.lock);
+	spin_lock_irq(&lat->lock);
+	val = lat->stat[level];
+	spin_unlock_irq(&lat->lock);
 
 	return val;
 }
 
-static inline unsigned long get_latency_threshold(enum LATENCY_LEVEL level)
+static inline unsigned long get_latency_threshold(struct gcma_latency *lat,
+						  enum LATENCY_LEVEL level)
 {
 	unsigned long val;
 
-	spin_lock_irq(&alloc_latency.lock);
-	val = alloc_latency.threshold[level];
-	spin_unlock_irq(&alloc_latency.lock);
+	spin_lock_irq(&lat->lock);
+	val = lat->threshold[level];
+	spin_unlock_irq(&lat->lock);
 
 	return val;
 }
 
-static inline int set_latency_threshold(enum LATENCY_LEVEL level, unsigned long latency)
+static inline int set_latency_threshold(struct gcma_latency *lat,
+					enum LATENCY_LEVEL level,
+					unsigned long latency)
 {
 	if (level == LATENCY_EXTREME_HIGH)
 		return -EPERM;
 
-	spin_lock_irq(&alloc_latency.lock);
+	spin_lock_irq(&lat->lock);
 	if (level != LATENCY_LOW &&
-			alloc_latency.threshold[level - 1] >= latency) {
-		spin_unlock_irq(&alloc_latency.lock);
+			lat->threshold[level - 1] >= latency) {
+		spin_unlock_irq(&lat->lock);
 		return -EINVAL;
 	}
 
-	alloc_latency.threshold[level] = latency;
-	spin_unlock_irq(&alloc_latency.lock);
+	lat->threshold[level] = latency;
+	spin_unlock_irq(&lat->lock);
 
 	return 0;
 }
 
-#define LATENCY_ATTR(level_name, sysfs_name)					\
+#define LATENCY_ATTR(lat, level_name, sysfs_name)				\
 static ssize_t sysfs_name##_show(struct kobject *kobj,				\
 				 struct kobj_attribute *attr, char *buf)	\
 {										\
-	return sysfs_emit(buf, "%lu\n", get_latency_stat(level_name));		\
+	return sysfs_emit(buf, "%lu\n", get_latency_stat(&lat, level_name));	\
 }										\
 										\
 static ssize_t sysfs_name##_threshold_show(struct kobject *kobj,		\
 				 struct kobj_attribute *attr, char *buf)	\
 {										\
 	return sysfs_emit(buf, "%lu\n",						\
-				get_latency_threshold(level_name));		\
+				get_latency_threshold(&lat, level_name));	\
 }										\
 										\
 static ssize_t sysfs_name##_threshold_store(struct kobject *kobj,		\
@@ -183,22 +241,32 @@ static ssize_t sysfs_name##_threshold_store(struct kobject *kobj,		\
 	if (kstrtoul(buf, 10, &threshold))					\
 		return -EINVAL;							\
 										\
-	err = set_latency_threshold(level_name, threshold);			\
+	err = set_latency_threshold(&lat, level_name, threshold);		\
 	return err? : len;							\
 }										\
 GCMA_ATTR_RO(sysfs_name);							\
 GCMA_ATTR_RW(sysfs_name##_threshold)						\
 
-LATENCY_ATTR(LATENCY_LOW, latency_low);
-LATENCY_ATTR(LATENCY_MID, latency_mid);
-LATENCY_ATTR(LATENCY_HIGH, latency_high);
-LATENCY_ATTR(LATENCY_EXTREME_HIGH, latency_extreme_high);
+LATENCY_ATTR(alloc_latency, LATENCY_LOW, latency_low);
+LATENCY_ATTR(alloc_latency, LATENCY_MID, latency_mid);
+LATENCY_ATTR(alloc_latency, LATENCY_HIGH, latency_high);
+LATENCY_ATTR(alloc_latency, LATENCY_EXTREME_HIGH, latency_extreme_high);
+
+LATENCY_ATTR(discard_latency, LATENCY_LOW, discard_latency_low);
+LATENCY_ATTR(discard_latency, LATENCY_MID, discard_latency_mid);
+LATENCY_ATTR(discard_latency, LATENCY_HIGH, discard_latency_high);
+LATENCY_ATTR(discard_latency, LATENCY_EXTREME_HIGH,
+	     discard_latency_extreme_high);
 
 static struct attribute *gcma_latency_attrs[] = {
 	&latency_low_attr.attr,
 	&latency_mid_attr.attr,
 	&latency_high_attr.attr,
 	&latency_extreme_high_attr.attr,
+	&discard_latency_low_attr.attr,
+	&discard_latency_mid_attr.attr,
+	&discard_latency_high_attr.attr,
+	&discard_latency_extreme_high_attr.attr,
 	NULL,
 };
 
@@ -211,6 +279,10 @@ static struct attribute *gcma_latency_threshold_attrs[] = {
 	&latency_mid_threshold_attr.attr,
 	&latency_high_threshold_attr.attr,
 	&latency_extreme_high_threshold_attr.attr,
+	&discard_latency_low_threshold_attr.attr,
+	&discard_latency_mid_threshold_attr.attr,
+	&discard_latency_high_threshold_attr.attr,
+	&discard_latency_extreme_high_threshold_attr.attr,
 	NULL,
 };
 
@@ -8,6 +8,8 @@ enum gcma_stat_type {
         EVICTED_PAGE,
         CACHED_PAGE,
         DISCARDED_PAGE,
+        MISSED_PAGE,
+        REJECTED_PAGE,
         NUM_OF_GCMA_STAT,
 };
 
@@ -16,6 +18,8 @@ int gcma_sysfs_init(void);
 void inc_gcma_stat(enum gcma_stat_type type);
 void dec_gcma_stat(enum gcma_stat_type type);
 void add_gcma_stat(enum gcma_stat_type type, unsigned long delta);
+u64 get_gcma_stat(enum gcma_stat_type type);
 void account_gcma_per_page_alloc_latency(unsigned long count,
 					 unsigned long latency_ns);
+void account_gcma_discard_latency(unsigned long latency_ns);
 #endif
@@ -47,6 +47,20 @@ void eh_remove(struct eh_device *eh_dev);
  * the memory used to store the compressed data.
  */
 int eh_compress_page(struct eh_device *eh_dev, struct page *page, void *priv);
+/*
+ * start compressions of @nr pages with a single HW fifo update. pages
+ * which don't fit into the HW fifo are queued to the SW fifo in order.
+ * @priv[i] is passed to the callback of @pages[i].
+ */
+int eh_compress_pages(struct eh_device *eh_dev, struct page **pages,
+		      void **priv, unsigned int nr);
+/*
+ * same as eh_compress_page but returns -EBUSY instead of waiting for
+ * room when the HW fifo is full and the SW fifo is over the fallback
+ * threshold, so the caller could compress the page other way.
+ */
+int eh_compress_page_nowait(struct eh_device *eh_dev, struct page *page,
+			    void *priv);
 int eh_decompress_page(struct eh_device *eh_dev, void *src,
                        unsigned int slen, struct page *page);
 
@@ -6,6 +6,8 @@
 
 extern void gcma_alloc_range(unsigned long start_pfn, unsigned long end_pfn);
 extern void gcma_free_range(unsigned long start_pfn, unsigned long end_pfn);
+extern int gcma_discard_range_ahead(unsigned long start_pfn,
+				    unsigned long end_pfn);
 extern int register_gcma_area(const char *name, phys_addr_t base,
 				phys_addr_t size);
 #endif
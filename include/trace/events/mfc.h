@@ -209,6 +209,49 @@ DEFINE_EVENT(mfc_frame, mfc_frame_bottom,
 	TP_ARGS(ctx_num, reason, type, is_drm)
 );
 
+TRACE_EVENT(mfc_perf_frame,
+
+	TP_PROTO(int core_id,
+			int ctx_num,
+			int type,
+			u32 hw_ns,
+			u32 queue_ns,
+			u32 gap_ns,
+			int mfc_freq),
+
+	TP_ARGS(core_id, ctx_num, type, hw_ns, queue_ns, gap_ns, mfc_freq),
+
+	TP_STRUCT__entry(
+		__field(int, core_id)
+		__field(int, ctx_num)
+		__field(int, type)
+		__field(u32, hw_ns)
+		__field(u32, queue_ns)
+		__field(u32, gap_ns)
+		__field(int, mfc_freq)
+	),
+
+	TP_fast_assign(
+		__entry->core_id	= core_id;
+		__entry->ctx_num	= ctx_num;
+		__entry->type		= type;
+		__entry->hw_ns		= hw_ns;
+		__entry->queue_ns	= queue_ns;
+		__entry->gap_ns		= gap_ns;
+		__entry->mfc_freq	= mfc_freq;
+	),
+
+	TP_printk("core-%d ctx[%d] %s hw=%uns queue=%uns gap=%uns freq=%dkHz",
+			__entry->core_id,
+			__entry->ctx_num,
+			__entry->type ? "nal_q" : "nal_start",
+			__entry->hw_ns,
+			__entry->queue_ns,
+			__entry->gap_ns,
+			__entry->mfc_freq
+	)
+);
+
 #endif /* _TRACE_MFC_H */
 
 /* This part must be outside protection */